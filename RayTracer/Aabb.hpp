@@ -0,0 +1,106 @@
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include "Ray.hpp"
+#include <algorithm>
+
+namespace raytracer {
+
+	/*
+		Axis-aligned bounding box stored as its two extreme corners.
+		A default constructed box is "empty" (min = +inf, max = -inf),
+		so that expanding it with any point or box yields that point or box.
+	*/
+	class aabb {
+	public:
+		// Constructors
+		aabb()
+			: m_min(infinity, infinity, infinity),
+			m_max(-infinity, -infinity, -infinity) {}
+		aabb(const point3& a, const point3& b)
+			: m_min(a), m_max(b) {}
+
+		// Functions
+		point3 min() const { return m_min; }
+		point3 max() const { return m_max; }
+
+		bool empty() const {
+			return m_min.x() > m_max.x() || m_min.y() > m_max.y() || m_min.z() > m_max.z();
+		}
+
+		point3 centroid() const {
+			return 0.5 * (m_min + m_max);
+		}
+
+		real axis_min(int axis) const { return axis == 0 ? m_min.x() : (axis == 1 ? m_min.y() : m_min.z()); }
+		real axis_max(int axis) const { return axis == 0 ? m_max.x() : (axis == 1 ? m_max.y() : m_max.z()); }
+
+		// index of the axis with the largest extent
+		int longest_axis() const {
+			vec3 d = m_max - m_min;
+			if (d.x() > d.y() && d.x() > d.z()) return 0;
+			return d.y() > d.z() ? 1 : 2;
+		}
+
+		real surface_area() const {
+			if (empty()) return 0.0;
+			vec3 d = m_max - m_min;
+			return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+		}
+
+		void expand(const point3& p) {
+			m_min = point3(std::min(m_min.x(), p.x()), std::min(m_min.y(), p.y()), std::min(m_min.z(), p.z()));
+			m_max = point3(std::max(m_max.x(), p.x()), std::max(m_max.y(), p.y()), std::max(m_max.z(), p.z()));
+		}
+
+		// an empty box (min above max) leaves this one as it is
+		void expand(const aabb& box) {
+			if (box.empty()) return;
+			expand(box.m_min);
+			expand(box.m_max);
+		}
+
+		/*
+			Slab test. inv_dir is 1/direction per component, precomputed once per ray
+			by the caller, so the test is multiply-only (IEEE infinities handle
+			axis-parallel rays).
+		*/
+		bool hit(const point3& origin, const vec3& inv_dir, real t_min, real t_max) const {
+			real t0 = (m_min.x() - origin.x()) * inv_dir.x();
+			real t1 = (m_max.x() - origin.x()) * inv_dir.x();
+			t_min = std::max(t_min, std::min(t0, t1));
+			t_max = std::min(t_max, std::max(t0, t1));
+
+			t0 = (m_min.y() - origin.y()) * inv_dir.y();
+			t1 = (m_max.y() - origin.y()) * inv_dir.y();
+			t_min = std::max(t_min, std::min(t0, t1));
+			t_max = std::min(t_max, std::max(t0, t1));
+
+			t0 = (m_min.z() - origin.z()) * inv_dir.z();
+			t1 = (m_max.z() - origin.z()) * inv_dir.z();
+			t_min = std::max(t_min, std::min(t0, t1));
+			t_max = std::min(t_max, std::max(t0, t1));
+
+			return t_min <= t_max;
+		}
+
+		bool hit(const ray& r, real t_min, real t_max) const {
+			vec3 d = r.direction();
+			return hit(r.origin(), vec3(1 / d.x(), 1 / d.y(), 1 / d.z()), t_min, t_max);
+		}
+
+	private:
+		//member data
+		point3 m_min;
+		point3 m_max;
+		//!member data
+	};
+
+	inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+		aabb box = box0;
+		box.expand(box1);
+		return box;
+	}
+}
+
+#endif //!AABB_HPP
\ No newline at end of file
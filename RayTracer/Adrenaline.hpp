@@ -6,28 +6,46 @@ using UINT = unsigned int;
 #include "Utility.hpp"
 #include "Color.hpp"
 #include "Camera.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "Framebuffer.hpp"
+#include "Checkpoint.hpp"
+#include "OutputStage.hpp"
+#include "DeviceScene.hpp"
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <sstream>
 #include <execution>
 #include <functional>
+#include <stdexcept>
+#include <string>
 
 #ifdef KERNEL
-	#include <CL/cl2.hpp>
-#elif defined(SYCL)
-	#include <SYCL/sycl.hpp>
-	namespace sycl = cl::sycl;
-#else
-	#ifdef ENABLE_OMP
-		#include <omp.h>
+	#define CL_HPP_TARGET_OPENCL_VERSION 120
+	#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+	#if __has_include(<CL/opencl.hpp>)
+		#include <CL/opencl.hpp>
+	#else
+		#include <CL/cl2.hpp>
 	#endif
-	#ifdef ENABLE_THREAD
-		#include <thread>
-	#endif
-	#ifdef ENABLE_ASYNC
-		#include <future>
+#endif
+#ifdef SYCL
+	#if __has_include(<sycl/sycl.hpp>)
+		#include <sycl/sycl.hpp>
+	#else
+		#include <CL/sycl.hpp>
 	#endif
 #endif
+#ifdef ENABLE_OMP
+	#include <omp.h>
+#endif
+#ifdef ENABLE_THREAD
+	#include <thread>
+#endif
+#ifdef ENABLE_ASYNC
+	#include <future>
+#endif
 
 namespace raytracer {
 
@@ -49,6 +67,17 @@ namespace raytracer {
 	struct MEASUREMENT_HEAP {
 		int iteration_count;
 		std::vector<double> elapsed;
+		// per-worker busy/idle time of the last thread pool dispatch
+		std::vector<WORKER_TIMES> worker_times;
+		// average number of rays traced per camera sample in the last frame
+		double avg_path_length;
+		// camera samples taken in the last frame, those a progressive render resumed from a checkpoint
+		// instead, and how many fewer than samples_per_pixel for every pixel both together are
+		uint64_t samples_taken;
+		uint64_t samples_resumed;
+		int64_t samples_saved;
+		// what the last frame traced, hit and scattered (RT_COUNTERS builds only, zero otherwise)
+		RAY_COUNTERS counters;
 	};
 
 	struct STATS_DESCRIPTOR {
@@ -58,6 +87,30 @@ namespace raytracer {
 		UINT image_height;
 		int samples_per_pixel;
 		int max_depth;
+		// bounce from which Russian roulette may end paths (0 = never)
+		int rr_depth;
+		// base seed of the per-sample random streams; same seed, same image
+		uint64_t seed;
+		// edge length of the square tiles handed to pool workers (0 = 32)
+		UINT tile_size;
+		// worker count of the thread pool (0 = hardware concurrency)
+		UINT thread_count;
+		/*
+			Adaptive sampling, on when noise_threshold > 0: a pixel stops after
+			min_samples once the standard error of its mean luminance is below
+			noise_threshold times that mean; the samples it leaves go to noisy
+			pixels nearby, up to max_samples each, so a frame takes at most
+			samples_per_pixel per pixel (see adrenaline::render_span).
+			max_samples below samples_per_pixel is rejected.
+			render_w_packets and render_progressive always take samples_per_pixel.
+		*/
+		double noise_threshold;
+		int min_samples;
+		int max_samples;
+		// progressive mode: samples per pixel added by one pass (0 = all in one pass)
+		int pass_samples;
+		// progressive mode: rewrite the output with the image so far every N passes (0 = never)
+		int preview_interval;
 		MEASUREMENT_HEAP measurements;
 
 		[[nodiscard]]
@@ -78,7 +131,6 @@ namespace raytracer {
 
 	public:
 
-		[[noreturn]]
 		void measure(std::function<void()> mfunc) {
 			for (int i = 0; i < m_descriptor.measurements.iteration_count; i++) {
 				t.reset();
@@ -87,6 +139,25 @@ namespace raytracer {
 			}
 		}
 
+		void record_worker_times(const std::vector<WORKER_TIMES>& times) {
+			m_descriptor.measurements.worker_times = times;
+		}
+
+		void record_path_length(double avg_path_length) {
+			m_descriptor.measurements.avg_path_length = avg_path_length;
+		}
+
+		void record_counters(const RAY_COUNTERS& counters) {
+			m_descriptor.measurements.counters = counters;
+		}
+
+		void record_samples(uint64_t taken, uint64_t resumed) {
+			const uint64_t budget = static_cast<uint64_t>(m_descriptor.img_size()) * m_descriptor.samples_per_pixel;
+			m_descriptor.measurements.samples_taken = taken;
+			m_descriptor.measurements.samples_resumed = resumed;
+			m_descriptor.measurements.samples_saved = taken + resumed < budget ? static_cast<int64_t>(budget - taken - resumed) : 0;
+		}
+
 		STATS_DESCRIPTOR get_descriptor() const { return m_descriptor; }
 
 	private:
@@ -94,16 +165,91 @@ namespace raytracer {
 		timer t;
 	};
 
+	// render modes, see the matching adrenaline::render_* functions
+	enum class backend {
+		serial,			// render
+		par,			// render_def, std::execution::par
+		omp,			// render_w_omp
+		thread,			// render_w_thread
+		async,			// render_w_future
+		pool,			// render_w_pool
+		packets,		// render_w_packets
+		progressive,	// render_progressive
+		sycl,			// render_w_sycl
+		opencl			// render_w_opencl
+	};
+
+	inline const char* backend_name(backend b) {
+		switch (b) {
+		case backend::serial:		return "serial";
+		case backend::par:			return "par";
+		case backend::omp:			return "omp";
+		case backend::thread:		return "thread";
+		case backend::async:		return "async";
+		case backend::pool:			return "pool";
+		case backend::packets:		return "packets";
+		case backend::progressive:	return "progressive";
+		case backend::sycl:			return "sycl";
+		case backend::opencl:		return "opencl";
+		}
+		return "";
+	}
+
+	inline backend parse_backend(const std::string& name) {
+		for (backend b : { backend::serial, backend::par, backend::omp, backend::thread,
+			backend::async, backend::pool, backend::packets, backend::progressive, backend::sycl, backend::opencl })
+		{
+			if (name == backend_name(b)) return b;
+		}
+		throw std::runtime_error("unknown backend: " + name);
+	}
+
+	// the fastest render mode compiled into this build
+	inline backend default_backend() {
+#if defined(KERNEL)
+		return backend::opencl;
+#elif defined(SYCL)
+		return backend::sycl;
+#elif defined(ENABLE_POOL)
+		return backend::pool;
+#elif defined(ENABLE_ASYNC)
+		return backend::async;
+#elif defined(ENABLE_OMP)
+		return backend::omp;
+#elif defined(ENABLE_THREAD)
+		return backend::thread;
+#elif defined(MT)
+		return backend::par;
+#else
+		return backend::serial;
+#endif
+	}
+
 	struct ADRENALINE_DESCRIPTOR {
 
 		camera1 cam;
-		hittable_list world;
+		// usually a frozen_scene, or a bvh built over a hittable_list
+		std::shared_ptr<const hittable> world;
 		std::string foutput;
+		image_format format = image_format::P6;
+		// progressive mode: sample sums are saved here after every pass and resumed from (empty = off)
+		std::string fcheckpoint;
+		// tile backends (pool, packets, progressive): per-tile render times are written here as an image (empty = off)
+		std::string fheatmap;
+		// SYCL backend: "gpu" (falls back to the CPU without one), "cpu" or "default"
+		std::string sycl_device = "gpu";
+		// pool, packets and async backends: a P6 or PFM output is written while it renders (see output_stage)
+		bool stream_output = true;
 
 		ADRENALINE_DESCRIPTOR& operator=(const ADRENALINE_DESCRIPTOR& adesc) {
 			cam = adesc.cam;
 			world = adesc.world;
 			foutput = adesc.foutput;
+			format = adesc.format;
+			fcheckpoint = adesc.fcheckpoint;
+			fheatmap = adesc.fheatmap;
+			sycl_device = adesc.sycl_device;
+			stream_output = adesc.stream_output;
 			return *this;
 		}
 
@@ -113,11 +259,26 @@ namespace raytracer {
 	public:
 
 		adrenaline(ADRENALINE_DESCRIPTOR& adesc, STATS_DESCRIPTOR& sdesc)
-			: m_outfile(adesc.foutput, std::ios::out),
-			m_adesc(adesc), m_stats(sdesc)
+			: m_outfile(adesc.foutput, std::ios::out | std::ios::binary),
+			m_stats(sdesc), m_adesc(adesc)
 		{
-			if (adesc.foutput.substr(adesc.foutput.length() - 3) != "ppm")
-				throw std::exception("not correct image format!");
+			check_output(adesc.foutput, adesc.format);
+			check_sampling(sdesc);
+		}
+
+		/*
+			Next frame of a sequence: a new camera and output files, while the
+			pool, the world and its trees stay. The caller moves the world
+			between renders, see frame_sequence.
+		*/
+		void begin_frame(const camera1& cam, const std::string& foutput, const std::string& fcheckpoint) {
+			check_output(foutput, m_adesc.format);
+			m_adesc.cam = cam;
+			m_adesc.foutput = foutput;
+			m_adesc.fcheckpoint = fcheckpoint;
+			m_outfile.close();
+			m_outfile.open(foutput, std::ios::out | std::ios::binary | std::ios::trunc);
+			m_samples_done = 0;
 		}
 
 	public:
@@ -127,214 +288,647 @@ namespace raytracer {
 	#define CL_DEVICE_T CL_DEVICE_TYPE_CPU
 	#elif defined(ENABLE_KERNEL_GPU)
 	#define CL_DEVICE_T CL_DEVICE_TYPE_GPU
+	#else
+	#define CL_DEVICE_T CL_DEVICE_TYPE_CPU
+	#endif
+	// the kernel's source, the CMake build points it into the source tree
+	#ifndef RT_KERNEL_FILE
+	#define RT_KERNEL_FILE "render.cl"
 	#endif
 
-	public:
+		struct OPENCL_DESCRIPTOR {
+			cl::Device device;
+			cl::Context context;
+			cl::Program program;
+		};
+
+		static void check_cl(cl_int err, const char* what) {
+			if (err != CL_SUCCESS)
+				throw std::runtime_error(std::string("OpenCL: ") + what + " failed with " + std::to_string(err));
+		}
 
-		// InitOpenCL
-		void initOpenCL() {
-			// Initialize OpenCL platform, devices, and context
+		/*
+			Picks the first device of type CL_DEVICE_T on any platform, else the
+			first device there is at all, so a CPU runtime such as POCL is enough,
+			and builds RT_KERNEL_FILE for it. Build errors come with the build log.
+		*/
+		static OPENCL_DESCRIPTOR initOpenCL() {
 			std::vector<cl::Platform> platforms;
 			cl::Platform::get(&platforms);
 
-			// Select main platform:
-			cl::Platform platform = platforms[0];
-
-			// Search for available devices on selected platform:
-			std::vector<cl::Device> devices;
-			platform.getDevices(CL_DEVICE_T, &devices);
+			const auto find_device = [&](cl_device_type type, cl::Device& device) {
+				for (const cl::Platform& platform : platforms) {
+					std::vector<cl::Device> devices;
+					if (platform.getDevices(type, &devices) == CL_SUCCESS && !devices.empty()) {
+						device = devices[0];
+						return true;
+					}
+				}
+				return false;
+			};
+			OPENCL_DESCRIPTOR cl_desc;
+			if (!find_device(CL_DEVICE_T, cl_desc.device) && !find_device(CL_DEVICE_TYPE_ALL, cl_desc.device))
+				throw std::runtime_error("OpenCL: no platform with a device found");
+
+			cl_int err = CL_SUCCESS;
+			cl_desc.context = cl::Context(cl_desc.device, nullptr, nullptr, nullptr, &err);
+			check_cl(err, "creating the context");
+
+			std::ifstream file(RT_KERNEL_FILE);
+			if (!file)
+				throw std::runtime_error("OpenCL: cannot open " RT_KERNEL_FILE);
+			const std::string source(std::istreambuf_iterator<char>(file), {});
+
+			cl_desc.program = cl::Program(cl_desc.context, source, false, &err);
+			check_cl(err, "creating the program");
+			if (cl_desc.program.build({ cl_desc.device }, "-cl-std=CL1.2") != CL_SUCCESS) {
+				throw std::runtime_error("OpenCL: building " RT_KERNEL_FILE " failed:\n"
+					+ cl_desc.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cl_desc.device));
+			}
+			return cl_desc;
+		}
 
-			// Select main device:
-			cl::Device device = devices[0];
+		/*
+			OpenCL rendering with render.cl, which is device::render_sample in
+			OpenCL C: the scene goes to the device as the buffers of a device_scene,
+			one work-item renders all samples of its pixel. Work-groups are 8x8
+			pixel tiles (smaller when the kernel allows fewer work-items) of a 2D
+			range rounded up to whole tiles. The sums are read back and loaded into
+			fb a scanline at a time, from where write_img_buff writes them like any
+			other backend's.
+		*/
+		void render_w_opencl(framebuffer& fb) {
+			const frozen_scene* world = dynamic_cast<const frozen_scene*>(m_adesc.world.get());
+			if (!world)
+				throw std::runtime_error("the OpenCL backend renders frozen scenes only!");
+			const device_scene flat = flatten_scene(*world);
+			const DEVICE_CAMERA cam = flatten_camera(m_adesc.cam);
+
+			const OPENCL_DESCRIPTOR cl_desc = initOpenCL();
+			std::cerr << "OpenCL device: " << cl_desc.device.getInfo<CL_DEVICE_NAME>() << std::endl;
+
+			cl_int err = CL_SUCCESS;
+			cl::Kernel kernel(cl_desc.program, "render", &err);
+			check_cl(err, "creating the kernel");
+			size_t tile = 8;
+			const size_t max_group = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cl_desc.device);
+			while (tile > 1 && tile * tile > max_group)
+				tile /= 2;
+
+			cl::CommandQueue queue(cl_desc.context, cl_desc.device, 0, &err);
+			check_cl(err, "creating the queue");
+
+			m_stats.measure([&]() {
+				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+				DEVICE_RENDER_PARAMS params;
+				params.seed = sdesc.seed;
+				params.width = sdesc.image_width;
+				params.height = sdesc.image_height;
+				params.samples_per_pixel = sdesc.samples_per_pixel;
+				params.max_depth = sdesc.max_depth;
+				params.rr_depth = sdesc.rr_depth;
+				params.node_count = flat.node_count;
+
+				const auto input = [&](const auto& v) {
+					cl::Buffer buffer(cl_desc.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+						v.size() * sizeof(v[0]), const_cast<void*>(static_cast<const void*>(v.data())), &err);
+					check_cl(err, "creating an input buffer");
+					return buffer;
+				};
+				const cl::Buffer nodes = input(flat.nodes);
+				const cl::Buffer spheres = input(flat.spheres);
+				const cl::Buffer sphere_materials = input(flat.sphere_materials);
+				const cl::Buffer materials = input(flat.materials);
+
+				std::vector<float> pixels(3 * static_cast<size_t>(sdesc.img_size()));
+				std::vector<uint32_t> segments(sdesc.img_size());
+				cl::Buffer out(cl_desc.context, CL_MEM_WRITE_ONLY, pixels.size() * sizeof(float), nullptr, &err);
+				check_cl(err, "creating the output buffer");
+				cl::Buffer out_segments(cl_desc.context, CL_MEM_WRITE_ONLY, segments.size() * sizeof(uint32_t), nullptr, &err);
+				check_cl(err, "creating the output buffer");
+
+				kernel.setArg(0, nodes);
+				kernel.setArg(1, spheres);
+				kernel.setArg(2, sphere_materials);
+				kernel.setArg(3, materials);
+				kernel.setArg(4, cam);
+				kernel.setArg(5, params);
+				kernel.setArg(6, out);
+				kernel.setArg(7, out_segments);
+
+				const cl::NDRange global((params.width + tile - 1) / tile * tile, (params.height + tile - 1) / tile * tile);
+				check_cl(queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NDRange(tile, tile)), "running the kernel");
+				check_cl(queue.enqueueReadBuffer(out, CL_TRUE, 0, pixels.size() * sizeof(float), pixels.data()), "reading the image");
+				check_cl(queue.enqueueReadBuffer(out_segments, CL_TRUE, 0, segments.size() * sizeof(uint32_t), segments.data()), "reading the path lengths");
+
+				for (UINT j = 0; j < sdesc.image_height; j++)
+					fb.load_row(j, pixels.data() + 3 * static_cast<size_t>(j) * sdesc.image_width);
+				uint64_t total = 0;
+				for (size_t k = 0; k < segments.size(); k++)
+					total += segments[k];
+				m_path_segments.fetch_add(total, std::memory_order_relaxed);
+				m_paths.fetch_add(static_cast<uint64_t>(sdesc.img_size()) * sdesc.samples_per_pixel, std::memory_order_relaxed);
+				record_path_stats();
+			});
+		}
+#endif
+	#ifdef SYCL
+		/*
+			Device of the SYCL backend: the GPU when adesc.sycl_device asks for it and
+			there is one, else the CPU device of the SYCL implementation (oneAPI's
+			OpenCL CPU runtime, AdaptiveCpp's OpenMP backend, ...), so the backend
+			also runs on machines without a GPU. "default" leaves it to the runtime.
+		*/
+		static sycl::device select_sycl_device(const std::string& preference) {
+			if (preference == "gpu") {
+				try { return sycl::device(sycl::gpu_selector_v); }
+				catch (const sycl::exception&) {}
+			}
+			if (preference != "default") {
+				try { return sycl::device(sycl::cpu_selector_v); }
+				catch (const sycl::exception&) {}
+			}
+			return sycl::device(sycl::default_selector_v);
+		}
 
-			cl::Context context(device);
+		/*
+			SYCL rendering. The scene goes to the device as a device_scene, one
+			work-item renders all samples of its pixel with device::render_sample,
+			the generator keyed by (seed, pixel, sample) as on the CPU. Work-groups
+			are 8x8 pixel tiles of a 2D nd_range rounded up to whole tiles; items
+			past the image border return right away. The kernel captures plain
+			values only, never this. The image is the CPU backends' up to float
+			rounding (check with --compare).
+		*/
+		void render_w_sycl(framebuffer& fb) {
+			const frozen_scene* world = dynamic_cast<const frozen_scene*>(m_adesc.world.get());
+			if (!world)
+				throw std::runtime_error("the SYCL backend renders frozen scenes only!");
+			const device_scene flat = flatten_scene(*world);
+			const DEVICE_CAMERA cam = flatten_camera(m_adesc.cam);
+
+			sycl::queue queue(select_sycl_device(m_adesc.sycl_device));
+			std::cerr << "SYCL device: " << queue.get_device().get_info<sycl::info::device::name>() << std::endl;
+
+			m_stats.measure([&]() {
+				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+				const uint32_t width = sdesc.image_width;
+				const uint32_t height = sdesc.image_height;
+				const uint64_t seed = sdesc.seed;
+				const int spp = sdesc.samples_per_pixel;
+				const int max_depth = sdesc.max_depth;
+				const int rr_depth = sdesc.rr_depth;
+				const uint32_t node_count = flat.node_count;
+				constexpr size_t tile = 8;
+
+				std::vector<float> pixels(3 * static_cast<size_t>(sdesc.img_size()));
+				std::vector<uint32_t> segments(sdesc.img_size());
+				{
+					sycl::buffer<DEVICE_NODE, 1> nodes(flat.nodes.data(), sycl::range<1>(flat.nodes.size()));
+					sycl::buffer<DEVICE_SPHERE, 1> spheres(flat.spheres.data(), sycl::range<1>(flat.spheres.size()));
+					sycl::buffer<uint32_t, 1> sphere_materials(flat.sphere_materials.data(), sycl::range<1>(flat.sphere_materials.size()));
+					sycl::buffer<DEVICE_MATERIAL, 1> materials(flat.materials.data(), sycl::range<1>(flat.materials.size()));
+					sycl::buffer<float, 1> out(pixels.data(), sycl::range<1>(pixels.size()));
+					sycl::buffer<uint32_t, 1> out_segments(segments.data(), sycl::range<1>(segments.size()));
+
+					queue.submit([&](sycl::handler& cgh) {
+						sycl::accessor nodes_acc(nodes, cgh, sycl::read_only);
+						sycl::accessor spheres_acc(spheres, cgh, sycl::read_only);
+						sycl::accessor sphere_materials_acc(sphere_materials, cgh, sycl::read_only);
+						sycl::accessor materials_acc(materials, cgh, sycl::read_only);
+						sycl::accessor out_acc(out, cgh, sycl::write_only, sycl::no_init);
+						sycl::accessor segments_acc(out_segments, cgh, sycl::write_only, sycl::no_init);
+
+						const sycl::range<2> global((height + tile - 1) / tile * tile, (width + tile - 1) / tile * tile);
+						cgh.parallel_for(sycl::nd_range<2>(global, sycl::range<2>(tile, tile)),
+							[=](sycl::nd_item<2> item) {
+								const uint32_t j = static_cast<uint32_t>(item.get_global_id(0));
+								const uint32_t i = static_cast<uint32_t>(item.get_global_id(1));
+								if (i >= width || j >= height) return;
+
+								const device::scene_view scene{ &nodes_acc[0], &spheres_acc[0],
+									&sphere_materials_acc[0], &materials_acc[0], node_count };
+								device::fvec3 sum{ 0.0f, 0.0f, 0.0f };
+								uint32_t path_segments = 0;
+								for (int s = 0; s < spp; s++) {
+									int path_length;
+									sum = sum + device::render_sample(scene, cam, i, j, width, height, seed, s, max_depth, rr_depth, path_length);
+									path_segments += path_length;
+								}
 
-			// Read the contents of the .cl file
-			std::ifstream file("render.cl");
-			std::string sourceCode(std::istreambuf_iterator<char>(file), {});
+								const size_t pixel = static_cast<size_t>(j) * width + i;
+								out_acc[3 * pixel + 0] = sum.x;
+								out_acc[3 * pixel + 1] = sum.y;
+								out_acc[3 * pixel + 2] = sum.z;
+								segments_acc[pixel] = path_segments;
+							});
+					});
+				} // leaving the scope waits for the kernel and copies out and out_segments back
+
+				for (UINT j = 0; j < sdesc.image_height; j++)
+					fb.load_row(j, pixels.data() + 3 * static_cast<size_t>(j) * sdesc.image_width);
+				uint64_t total = 0;
+				for (size_t k = 0; k < segments.size(); k++)
+					total += segments[k];
+				m_path_segments.fetch_add(total, std::memory_order_relaxed);
+				m_paths.fetch_add(static_cast<uint64_t>(sdesc.img_size()) * spp, std::memory_order_relaxed);
+				record_path_stats();
+			});
+		}
+	#endif
 
-			// Create program:
-			cl::Program program(context, sourceCode);
-			if (program.build() != CL_SUCCESS)
-				throw std::exception("error building");
+		/*
+			Accumulates all samples of pixel (i, j). Every sample re-keys the thread's
+			generator with (seed, pixel, sample), so the result is the same no matter
+			which thread renders the pixel or how the image is split between threads.
+		*/
+		color render_pixel(int i, int j, const STATS_DESCRIPTOR& sdesc) const {
+			if (sdesc.noise_threshold > 0) {
+				// a pixel on its own has nobody to hand its leftover samples to, see render_span
+				PIXEL_ESTIMATE px;
+				sample_adaptive(i, j, sdesc, sdesc.samples_per_pixel, px);
+				m_path_segments.fetch_add(px.segments, std::memory_order_relaxed);
+				m_paths.fetch_add(px.n, std::memory_order_relaxed);
+				return px.sum * (static_cast<real>(sdesc.samples_per_pixel) / px.n);
+			}
+			return render_samples(i, j, sdesc, 0, sdesc.samples_per_pixel, color{ 0, 0, 0 });
+		}
 
-			// Create Kernel:
-			cl::Kernel kernel(program, "render");
+		/*
+			Pixels [x0, x1) of scanline j into fb. With adaptive sampling the span
+			has samples_per_pixel samples per pixel to spend: every pixel samples
+			until it converges or has taken its share, then what the converged ones
+			left goes, a few samples at a time, to the pixel with the highest noise
+			relative to noise_threshold, up to max_samples each. A frame never takes
+			more samples than samples_per_pixel for every pixel. The backends render
+			the rows of the framebuffer's tiles as spans, so the image does not
+			depend on the backend either.
+		*/
+		void render_span(UINT j, UINT x0, UINT x1, const STATS_DESCRIPTOR& sdesc, framebuffer& fb) const {
+			if (sdesc.noise_threshold <= 0) {
+				for (UINT i = x0; i < x1; i++)
+					fb.set(i, j, render_pixel(i, j, sdesc));
+				return;
+			}
 
-			STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
-			// Create an image buffer for the output image
-			cl::Image2D imageBuffer(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGB, CL_UNSIGNED_INT32),
-				sdesc.image_width, sdesc.image_height);
+			const int spp = sdesc.samples_per_pixel;
+			const int max_samples = sdesc.max_samples;
+			const int step = std::max(1, spp / 4);
+			std::vector<PIXEL_ESTIMATE> span(x1 - x0);
+			int64_t budget = static_cast<int64_t>(x1 - x0) * spp;
+			for (UINT i = x0; i < x1; i++) {
+				sample_adaptive(i, j, sdesc, spp, span[i - x0]);
+				budget -= span[i - x0].n;
+			}
 
-			// Create a buffer for the image descriptor
-			cl::Buffer sdescBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-				sizeof(STATS_DESCRIPTOR), &sdesc);
+			// pixels still taking samples, the noisiest on top, the leftmost on a tie
+			const auto quieter = [](const NOISY_PIXEL& a, const NOISY_PIXEL& b) {
+				return a.ratio < b.ratio || (a.ratio == b.ratio && a.k > b.k);
+			};
+			std::vector<NOISY_PIXEL> noisy;
+			noisy.reserve(span.size());
+			for (size_t k = 0; k < span.size(); k++) {
+				if (span[k].n < max_samples && !converged(span[k], sdesc))
+					noisy.push_back({ noise_ratio(span[k], sdesc), k });
+			}
+			std::make_heap(noisy.begin(), noisy.end(), quieter);
+
+			// only the pixel granted samples changes its ratio, so the others keep their place
+			while (budget > 0 && !noisy.empty()) {
+				std::pop_heap(noisy.begin(), noisy.end(), quieter);
+				const size_t worst = noisy.back().k;
+				noisy.pop_back();
+
+				PIXEL_ESTIMATE& px = span[worst];
+				const int before = px.n;
+				const int64_t grant = std::min<int64_t>(budget, std::min(step, max_samples - before));
+				sample_adaptive(x0 + static_cast<UINT>(worst), j, sdesc, before + static_cast<int>(grant), px);
+				budget -= px.n - before;
+
+				if (px.n < max_samples && !converged(px, sdesc)) {
+					noisy.push_back({ noise_ratio(px, sdesc), worst });
+					std::push_heap(noisy.begin(), noisy.end(), quieter);
+				}
+			}
 
-			// Create a buffer for the adrenaline descriptor
-			cl::Buffer adescBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-				sizeof(ADRENALINE_DESCRIPTOR), &m_adesc);
+			uint64_t segments = 0, samples = 0;
+			for (size_t k = 0; k < span.size(); k++) {
+				fb.set(x0 + static_cast<UINT>(k), j, span[k].sum * (static_cast<real>(spp) / span[k].n));
+				segments += span[k].segments;
+				samples += span[k].n;
+			}
+			m_path_segments.fetch_add(segments, std::memory_order_relaxed);
+			m_paths.fetch_add(samples, std::memory_order_relaxed);
+		}
 
-			// Set kernel arguments
-			kernel.setArg(0, imageBuffer);
-			kernel.setArg(1, sdescBuffer);
-			kernel.setArg(2, adescBuffer);
+		// scanline j as spans of the framebuffer's tile width, see render_span
+		void render_row(UINT j, const STATS_DESCRIPTOR& sdesc, framebuffer& fb) const {
+			for (UINT x0 = 0; x0 < sdesc.image_width; x0 += fb.tile_size())
+				render_span(j, x0, std::min(x0 + fb.tile_size(), sdesc.image_width), sdesc, fb);
+		}
 
-			// Define the global and local work sizes
-			cl::NDRange globalSize(sdesc.image_width, sdesc.image_height);
-			cl::NDRange localSize(1, 1);
+		// samples of one pixel under adaptive sampling
+		struct PIXEL_ESTIMATE {
+			color sum{ 0, 0, 0 };
+			double mean = 0.0, m2 = 0.0;	// of the luminance, Welford's update
+			uint64_t segments = 0;
+			int n = 0;
+		};
+
+		// a pixel of a span in render_span's queue of pixels to give leftover samples
+		struct NOISY_PIXEL {
+			double ratio;
+			size_t k;
+		};
+
+		// standard error of px's mean over what noise_threshold allows, with a floor so black pixels converge too
+		static double noise_ratio(const PIXEL_ESTIMATE& px, const STATS_DESCRIPTOR& sdesc) {
+			if (px.n < 2) return infinity;
+			return std::sqrt(px.m2 / (px.n - 1) / px.n) / (sdesc.noise_threshold * std::max(px.mean, 0.01));
+		}
 
-			cl::CommandQueue queue(context, device);
-			cl::Event event;
-			queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalSize, localSize, nullptr, &event);
+		static bool converged(const PIXEL_ESTIMATE& px, const STATS_DESCRIPTOR& sdesc) {
+			return px.n >= std::max(2, sdesc.min_samples) && noise_ratio(px, sdesc) <= 1.0;
+		}
 
-			// Wait for the kernel execution to complete
-			event.wait();
+		// samples pixel (i, j) on from px.n until it has limit samples or has converged
+		void sample_adaptive(int i, int j, const STATS_DESCRIPTOR& sdesc, int limit, PIXEL_ESTIMATE& px) const {
+			const uint64_t pixel = static_cast<uint64_t>(j) * sdesc.image_width + i;
+			while (px.n < limit) {
+				seed_sample(sdesc.seed, pixel, px.n);
+				auto u = (i + random_double()) / (sdesc.image_width - 1);
+				auto v = (j + random_double()) / (sdesc.image_height - 1);
+				ray r = m_adesc.cam.get_ray(u, v);
+				int path_length;
+				const color sample = ray_color(r, *m_adesc.world, sdesc.max_depth, sdesc.rr_depth, path_length);
+				px.sum += sample;
+				px.segments += path_length;
+				px.n++;
+
+				const double y = luminance(sample);
+				const double delta = y - px.mean;
+				px.mean += delta / px.n;
+				px.m2 += delta * (y - px.mean);
+				if (converged(px, sdesc))
+					break;
+			}
+		}
 
-			// Check for any errors during kernel execution
-			cl_int status = event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
-			if (status != CL_COMPLETE) {
-				std::cerr << "Kernel execution failed with status: " << status << std::endl;
-				// Handle the error appropriately
-				return;
+		/*
+			Adds the samples [first, first + count) of pixel (i, j) onto pixel_color,
+			one by one; summing all samples in passes gives exactly render_pixel's result.
+		*/
+		color render_samples(int i, int j, const STATS_DESCRIPTOR& sdesc, int first, int count, color pixel_color) const {
+			const uint64_t pixel = static_cast<uint64_t>(j) * sdesc.image_width + i;
+			uint64_t segments = 0;
+			for (int s = first; s < first + count; s++) {
+				seed_sample(sdesc.seed, pixel, s);
+				auto u = (i + random_double()) / (sdesc.image_width - 1);
+				auto v = (j + random_double()) / (sdesc.image_height - 1);
+				ray r = m_adesc.cam.get_ray(u, v);
+				int path_length;
+				pixel_color += ray_color(r, *m_adesc.world, sdesc.max_depth, sdesc.rr_depth, path_length);
+				segments += path_length;
 			}
 
-			// Read the output image data
-			std::vector<unsigned char> imageData(sdesc.image_width * sdesc.image_height * 3);
-			cl::array<cl::size_type, 3> origin{}, region{};
-			origin[0] = origin[1] = origin[2] = 0;
-			region[0] = sdesc.image_width;
-			region[1] = sdesc.image_height;
-			region[2] = 1;
-			cl::Event readEvent;
-			queue.enqueueReadImage(imageBuffer, CL_TRUE, origin, region, 0, 0, imageData.data(), nullptr, &readEvent);
-
-			// Wait for the read operation to complete
-			readEvent.wait();
-
-			// Check for any errors during read operation
-			status = readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
-			if (status != CL_COMPLETE) {
-				std::cerr << "Image read failed with status: " << status << std::endl;
-				// Handle the error appropriately
-				return;
+			// one shared update per pixel rather than per sample
+			m_path_segments.fetch_add(segments, std::memory_order_relaxed);
+			m_paths.fetch_add(count, std::memory_order_relaxed);
+			return pixel_color;
+		}
+
+		/*
+			Packet tracing of one tile, one sample index at a time. The camera rays of
+			the tile are made in one pass (camera1::get_rays) and go through the bvh
+			as packets of 8 neighbouring pixels, which walk the same nodes; every path
+			then goes on by itself from its camera ray's hit, bounced rays being too
+			incoherent for packets. Each path keeps the generator seeded like in
+			render_pixel, and samples are summed per pixel in sample order, so the
+			tile comes out bit-identical to render_pixel's.
+		*/
+		void render_tile_packets(const frozen_scene& world, const tile& tl, const STATS_DESCRIPTOR& sdesc, framebuffer& fb) const {
+			const UINT tile_width = tl.x1 - tl.x0;
+			const size_t npixels = static_cast<size_t>(tile_width) * (tl.y1 - tl.y0);
+			std::vector<color> sums(npixels, color{ 0, 0, 0 });
+			std::vector<pcg32> rngs(npixels);
+			ray_batch primary;
+			primary.resize(npixels);
+			pcg32& rng = thread_rng();
+			uint64_t segments = 0;
+
+			for (int s = 0; s < sdesc.samples_per_pixel; s++) {
+				// random numbers pixel by pixel, then all camera rays of the tile in one pass
+				for (UINT j = tl.y0; j < tl.y1; j++) {
+					for (UINT i = tl.x0; i < tl.x1; i++) {
+						seed_sample(sdesc.seed, static_cast<uint64_t>(j) * sdesc.image_width + i, s);
+						const size_t pixel = static_cast<size_t>(j - tl.y0) * tile_width + (i - tl.x0);
+						primary.s[pixel] = static_cast<real>((i + random_double()) / (sdesc.image_width - 1));
+						primary.t[pixel] = static_cast<real>((j + random_double()) / (sdesc.image_height - 1));
+						m_adesc.cam.lens_sample(primary.lens_x[pixel], primary.lens_y[pixel]);
+						rngs[pixel] = rng;
+					}
+				}
+				m_adesc.cam.get_rays(primary);
+
+				for (size_t first = 0; first < npixels; first += ray_packet8::size) {
+					const int n = static_cast<int>(std::min<size_t>(ray_packet8::size, npixels - first));
+					ray_packet8 packet;
+					for (int k = 0; k < n; k++)
+						packet.set(k, primary.get(first + k), infinity);
+					world.hit_packet(packet, 0.0);
+
+					for (int k = 0; k < n; k++) {
+						const ray r = primary.get(first + k);
+						hit_record rec;
+						if (packet.hit(k))
+							world.fill_record(r, packet.prim[k], packet.part[k], packet.t[k], rec);
+						rng = rngs[first + k];
+						int path_length;
+						sums[first + k] += ray_color(r, packet.hit(k), rec, world, sdesc.max_depth, sdesc.rr_depth, path_length);
+						segments += path_length;
+					}
+				}
 			}
 
+			for (UINT j = tl.y0; j < tl.y1; j++)
+				for (UINT i = tl.x0; i < tl.x1; i++)
+					fb.set(i, j, sums[(j - tl.y0) * tile_width + (i - tl.x0)]);
+
+			m_path_segments.fetch_add(segments, std::memory_order_relaxed);
+			m_paths.fetch_add(npixels * sdesc.samples_per_pixel, std::memory_order_relaxed);
 		}
-		//!InitOpenCL
 
-#elif defined(SYCL)
-/* NOTE THAT THIS ONLY WORKS FOR NVIDIA AND INTEL!! */
-
-		[[noreturn]]
-		void initSycl(std::vector<color>& buff) {
-			// this should be fine, it should find GPU automatically (the most performent device)
-			sycl::gpu_selector device_selector;
-			sycl::device device = device_selector.select_device();
-			std::cerr << device.get_info<sycl::info::device::name>();
-
-			sycl::queue queue(device_selector);
-
-			STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
-
-			{
-				sycl::buffer<color, 1> buf(buff.data(), sycl::range<1>(sdesc.img_size()));
-				queue.submit([&](sycl::handler& cgh) {
-					auto acc = buf.get_access<sycl::access::mode::write>(cgh);
-
-					cgh.parallel_for(
-						sycl::range<1>(sdesc.image_height),
-						[=](sycl::item<1> item) {
-							size_t j = item.get_linear_id();
-
-							for (int i = 0; i < sdesc.image_width; ++i) {
-								color pixel_color{ 0, 0, 0 };
-								for (int s = 0; s < sdesc.samples_per_pixel; ++s) {
-									auto u = (i + random_double()) / (sdesc.image_width - 1);
-									auto v = (j + random_double()) / (sdesc.image_height - 1);
-									ray r = m_adesc.cam.get_ray(u, v);
-									pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-								}
-								acc[j * sdesc.image_width + i] = pixel_color;
-							}
-						});
-					});
+		static void check_output(const std::string& foutput, image_format format) {
+			if (foutput.length() < 3 || foutput.substr(foutput.length() - 3) != image_extension(format))
+				throw std::runtime_error("not correct image format!");
+		}
+
+		// adaptive sampling hands out up to max_samples per pixel, less than samples_per_pixel would cut every pixel short
+		static void check_sampling(const STATS_DESCRIPTOR& sdesc) {
+			if (sdesc.noise_threshold > 0 && sdesc.max_samples < sdesc.samples_per_pixel)
+				throw std::runtime_error("max_samples (" + std::to_string(sdesc.max_samples)
+					+ ") is below samples_per_pixel (" + std::to_string(sdesc.samples_per_pixel) + ")!");
+		}
+
+		// stores the frame's average path length and sample count in the stats and resets the counters
+		void record_path_stats(uint64_t samples_resumed = 0) {
+			const uint64_t paths = m_paths.exchange(0);
+			const uint64_t segments = m_path_segments.exchange(0);
+			m_stats.record_path_length(paths ? static_cast<double>(segments) / paths : 0.0);
+			m_stats.record_samples(paths, samples_resumed);
+		#ifdef RT_COUNTERS
+			m_stats.record_counters(counter_registry::instance().collect());
+		#endif
+		}
+
+		/*
+			Wraps a tile task so that, with adesc.fheatmap set, its time is added
+			to tile_ms[t]; without it tile_ms is empty and nothing is timed.
+		*/
+		template<typename TileFn>
+		static auto timed_tiles(std::vector<double>& tile_ms, TileFn&& fn) {
+			return [&tile_ms, fn = std::forward<TileFn>(fn)](size_t t, UINT worker) {
+				if (tile_ms.empty()) {
+					fn(t, worker);
+					return;
+				}
+				timer clock;
+				clock.reset();
+				fn(t, worker);
+				tile_ms[t] += clock.elapsed();
+			};
+		}
+
+		/*
+			Per-tile render times as an image of the render's size: the fastest
+			tile is black, slower ones go through red and yellow to white. A PFM
+			when adesc.fheatmap ends in .pfm, a P6 otherwise.
+		*/
+		void write_heatmap(const std::vector<tile>& tiles, const std::vector<double>& tile_ms) const {
+			if (m_adesc.fheatmap.empty() || tile_ms.empty()) return;
+			const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+			const auto [fastest, slowest] = std::minmax_element(tile_ms.begin(), tile_ms.end());
+			const double range = *slowest > *fastest ? *slowest - *fastest : 1.0;
+
+			std::vector<color> heat(sdesc.img_size());
+			for (size_t t = 0; t < tiles.size(); t++) {
+				const double x = (tile_ms[t] - *fastest) / range;
+				const color c(clamp(3 * x, 0.0, 1.0), clamp(3 * x - 1, 0.0, 1.0), clamp(3 * x - 2, 0.0, 1.0));
+				for (UINT j = tiles[t].y0; j < tiles[t].y1; j++)
+					for (UINT i = tiles[t].x0; i < tiles[t].x1; i++)
+						heat[j * sdesc.image_width + i] = c;
 			}
+
+			const std::string& path = m_adesc.fheatmap;
+			const image_format format = path.size() > 4 && path.substr(path.size() - 4) == ".pfm" ? image_format::PFM : image_format::P6;
+			std::ofstream out(path, std::ios::out | std::ios::binary);
+			write_image(out, format, heat.data(), sdesc.image_width, sdesc.image_height, 1);
+			if (!out)
+				std::cerr << "could not write heatmap " << path << std::endl;
+		}
+
+		/*
+			The writer thread of a render into fb, started before its first pixel,
+			or nullptr when the image is left to write_img_buff: adesc.stream_output
+			is off or the format is P3, whose lines differ in length.
+		*/
+		std::unique_ptr<output_stage> open_output_stage(const framebuffer& fb) {
+			m_image_streamed = false;
+			if (!m_adesc.stream_output || m_adesc.format == image_format::P3)
+				return nullptr;
+			const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+			return std::make_unique<output_stage>(m_outfile, m_adesc.format, fb, sdesc.samples_per_pixel);
+		}
+
+		// waits for the last band, inside the measured time; an incomplete image is written again by write_img_buff
+		void close_output_stage(std::unique_ptr<output_stage>& stage) {
+			if (stage)
+				m_image_streamed = stage->finish();
+			stage.reset();
+		}
+
+		// nothing to do after a render that streamed its whole image (see open_output_stage)
+		void write_img_buff(const framebuffer& fb) {
+			if (m_image_streamed) return;
+			const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+			const int samples = m_samples_done > 0 ? m_samples_done : sdesc.samples_per_pixel;
+			m_outfile.seekp(0);
+			write_image(m_outfile, m_adesc.format, fb, samples);
+		}
+
+		/*
+			Progressive preview: the output is rewritten from its start. P6 and PFM
+			files keep their size from one write to the next, so the file always holds
+			one whole image; P3's does not, it only gets the final image.
+		*/
+		void write_preview(const framebuffer& fb, int samples) {
+			if (m_adesc.format == image_format::P3) return;
+			m_outfile.seekp(0);
+			write_image(m_outfile, m_adesc.format, fb, samples);
 		}
 
-#else
 	#if defined(MT)
 		#ifdef PAR_RENDER_WRITE
 		#else
 
 	#ifdef ENABLE_OMP
 			// OpenMP MT rendering
-			void render_w_omp(color** buff) {
+			void render_w_omp(framebuffer& fb) {
 
 				m_stats.measure([&]() {
 					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
 
 					#pragma omp parallel for
 					for (int j = sdesc.image_height - 1; j >= 0; --j) {
-						for (int i = 0; i < sdesc.image_width; ++i) {
-							color pixel_color{ 0, 0, 0 };
-							for (int s = 0; s < sdesc.samples_per_pixel; ++s) {
-								auto u = (i + random_double()) / (sdesc.image_width - 1);
-								auto v = (j + random_double()) / (sdesc.image_height - 1);
-								ray r = m_adesc.cam.get_ray(u, v);
-								pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-							}
-							(*buff)[j * sdesc.image_width + i] = pixel_color;
-						}
+						render_row(j, sdesc, fb);
 					}
 
+					record_path_stats();
 				});
 			}
 	#endif
 
 			// std::thread MT rendering
 	#ifdef ENABLE_THREAD
-			void render_w_thread(color** buff) {
-				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+			void render_w_thread(framebuffer& fb) {
 
-				auto nthreads = std::thread::hardware_concurrency();
-				auto blocksz = sdesc.img_size() / nthreads;
-				std::vector<std::thread> threads(nthreads);
-				// thread function
-				const auto exec_block = [&](int hstart, int hend) {
-					for (int j = hend - 1; j >= hstart; j--) {
-						for (int i = 0; i < sdesc.image_width; ++i) {
-							color pixel_color{ 0, 0, 0 };
-							for (int s = 0; s < sdesc.samples_per_pixel; ++s) {
-								auto u = (i + random_double()) / (sdesc.image_width - 1);
-								auto v = (j + random_double()) / (sdesc.image_height - 1);
-								ray r = m_adesc.cam.get_ray(u, v);
-								pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-							}
-							(*buff)[j * sdesc.image_width + i] = pixel_color;
+				m_stats.measure([&]() {
+					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+
+					auto nthreads = std::thread::hardware_concurrency();
+					auto blocksz = sdesc.image_height / nthreads;
+					std::vector<std::thread> threads(nthreads);
+					// thread function
+					const auto exec_block = [&](int hstart, int hend) {
+						for (int j = hend - 1; j >= hstart; j--) {
+							render_row(j, sdesc, fb);
 						}
+					};
+					// setup threads
+					for (unsigned i = 0; i < nthreads; i++) {
+						int start = (i * blocksz);
+						int end = ((i + 1) * blocksz);
+						if (i == nthreads - 1)
+							end = sdesc.image_height;
+						threads[i] = std::thread(exec_block, start, end);
 					}
-				};
-				// setup threads
-				for (int i = 0; i < nthreads; i++) {
-					int start = (i * blocksz);
-					int end = ((i + 1) * blocksz);
-					if (i == nthreads - 1)
-						end = sdesc.img_size();
-					threads[i] = std::thread(exec_block, start, end);
-				}
 
-				// wait for all threads to finish
-				for (std::thread& thread : threads)
-					thread.join();
+					// wait for all threads to finish
+					for (std::thread& thread : threads)
+						thread.join();
+
+					record_path_stats();
+				});
 			}
 	#endif
 
 	#ifdef ENABLE_ASYNC
-			// Future & async MT rendering
-			void render_w_future(color** buff) {
+			// Future & async MT rendering, one task per scanline; finished scanlines go to the output stage
+			void render_w_future(framebuffer& fb) {
 
 				m_stats.measure([&]() {
 					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+					std::unique_ptr<output_stage> stage = open_output_stage(fb);
 
 					std::vector<std::future<void>> futures;
 					futures.reserve(sdesc.image_height);
@@ -343,16 +937,9 @@ namespace raytracer {
 						futures.emplace_back(
 							std::async(std::launch::async, 
 							[&, j]() {
-								for (int i = 0; i < sdesc.image_width; ++i) {
-									color pixel_color{ 0, 0, 0 };
-									for (int s = 0; s < sdesc.samples_per_pixel; ++s) {
-										auto u = (i + random_double()) / (sdesc.image_width - 1);
-										auto v = (j + random_double()) / (sdesc.image_height - 1);
-										ray r = m_adesc.cam.get_ray(u, v);
-										pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-									}
-									(*buff)[j * sdesc.image_width + i] = pixel_color;
-								}
+								render_row(j, sdesc, fb);
+								if (stage)
+									stage->push(tile{ 0, static_cast<UINT>(j), sdesc.image_width, static_cast<UINT>(j) + 1 });
 							}
 							)
 						);
@@ -362,76 +949,189 @@ namespace raytracer {
 					for (auto& future : futures) {
 						future.wait();
 					}
+					close_output_stage(stage);
+
+					record_path_stats();
 				});
 			}
 
 	#endif
 
-			// Default MT rendering
-			void render_def(color** buff) {
+	#ifdef ENABLE_POOL
+			// Work-stealing thread pool MT rendering over Morton-ordered tiles; finished tiles go to the output stage
+			void render_w_pool(framebuffer& fb) {
 
-				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+				m_stats.measure([&]() {
+					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+					std::unique_ptr<output_stage> stage = open_output_stage(fb);
+
+					// the pool outlives a single render, workers are only spawned once
+					if (!m_pool)
+						m_pool = std::make_unique<thread_pool>(sdesc.thread_count);
+
+					const std::vector<tile> tiles = make_morton_tiles(sdesc.image_width, sdesc.image_height, fb.tile_size());
+					std::vector<double> tile_ms(m_adesc.fheatmap.empty() ? 0 : tiles.size());
+					std::vector<WORKER_TIMES> times = m_pool->run(tiles.size(), timed_tiles(tile_ms,
+						[&](size_t t, UINT) {
+							const tile& tl = tiles[t];
+							for (UINT j = tl.y0; j < tl.y1; j++)
+								render_span(j, tl.x0, tl.x1, sdesc, fb);
+							if (stage)
+								stage->push(tl);
+						}
+					));
+					close_output_stage(stage);
+					m_stats.record_worker_times(times);
+					record_path_stats();
+					write_heatmap(tiles, tile_ms);
+				});
+			}
 
-				std::vector<int> range(sdesc.image_width);
-				std::generate(std::begin(range), std::end(range),
-					[n = 0]() mutable {
-						return n++;
-					}
-				);
+			/*
+				Packet MT rendering on the thread pool, see render_tile_packets.
+				Packets need the flat layout of a frozen_scene; any other world is
+				rendered by render_w_pool instead.
+			*/
+			void render_w_packets(framebuffer& fb) {
+				const frozen_scene* world = dynamic_cast<const frozen_scene*>(m_adesc.world.get());
+				if (!world) {
+					render_w_pool(fb);
+					return;
+				}
 
-				for (int j = sdesc.image_height-1; j >= 0; j--) {
-					std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-					std::for_each(
-						std::execution::par,
-						std::begin(range),
-						std::end(range),
-						[&](int& i) {
-							color pixel_color{ 0, 0, 0 };
-							for (int s = 0; s < sdesc.samples_per_pixel; s++) {
-								auto u = (i + random_double()) / (sdesc.image_width - 1);
-								auto v = (j + random_double()) / (sdesc.image_height - 1);
-								ray r = m_adesc.cam.get_ray(u, v);
-								pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-							}
-							(*buff)[j * sdesc.image_width + i] = pixel_color;
+				m_stats.measure([&]() {
+					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+					std::unique_ptr<output_stage> stage = open_output_stage(fb);
+
+					if (!m_pool)
+						m_pool = std::make_unique<thread_pool>(sdesc.thread_count);
+
+					const std::vector<tile> tiles = make_morton_tiles(sdesc.image_width, sdesc.image_height, fb.tile_size());
+					std::vector<double> tile_ms(m_adesc.fheatmap.empty() ? 0 : tiles.size());
+					std::vector<WORKER_TIMES> times = m_pool->run(tiles.size(), timed_tiles(tile_ms,
+						[&](size_t t, UINT) {
+							render_tile_packets(*world, tiles[t], sdesc, fb);
+							if (stage)
+								stage->push(tiles[t]);
 						}
-					);
-				}
+					));
+					close_output_stage(stage);
+					m_stats.record_worker_times(times);
+					record_path_stats();
+					write_heatmap(tiles, tile_ms);
+				});
 			}
 
-			void write_img_buff(color** buff) {
+			/*
+				Progressive MT rendering on the thread pool. samples_per_pixel is reached
+				in passes of pass_samples; every pass adds its samples onto the sums in
+				fb (see render_samples). The sums are kept as floats between passes, so
+				the final image is render_w_pool's up to float rounding. After each
+				pass the sums go to adesc.fcheckpoint, when set, and every
+				preview_interval passes the output shows the image so far. A run
+				finding a checkpoint of the same render continues from it: a killed job
+				loses at most one pass, and a finished one gets more samples by raising
+				samples_per_pixel. A checkpoint of another scene, camera or settings is
+				an error rather than overwritten. Only the first of several measured
+				iterations resumes, the others render from scratch. Checkpoints need a
+				frozen_scene, other worlds have no fingerprint.
+			*/
+			void render_progressive(framebuffer& fb) {
+				const frozen_scene* world = dynamic_cast<const frozen_scene*>(m_adesc.world.get());
+				const std::string fcheckpoint = world ? m_adesc.fcheckpoint : std::string();
+				if (!world && !m_adesc.fcheckpoint.empty())
+					std::cerr << "checkpoints need a frozen scene, not writing " << m_adesc.fcheckpoint << std::endl;
+				bool resume = !fcheckpoint.empty();
 
-				std::stringstream ss;
-				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
+				m_stats.measure([&]() {
+					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
 
-				m_outfile.rdbuf()->pubsetbuf(nullptr, 0); // Disable buffering ??
-				ss << "P3\n" << sdesc.image_width << " " << sdesc.image_height << " \n255\n";
-				m_outfile.write(ss.str().c_str(), ss.str().size());
-				ss.str(std::string());
+					if (!m_pool)
+						m_pool = std::make_unique<thread_pool>(sdesc.thread_count);
+
+					CHECKPOINT_HEADER checkpoint;
+					checkpoint.seed = sdesc.seed;
+					checkpoint.scene = world ? hash_camera(m_adesc.cam.descriptor(), world->fingerprint()) : 0;
+					checkpoint.width = sdesc.image_width;
+					checkpoint.height = sdesc.image_height;
+					checkpoint.max_depth = sdesc.max_depth;
+					checkpoint.rr_depth = sdesc.rr_depth;
+
+					int done = resume ? load_checkpoint(fcheckpoint, checkpoint, fb) : 0;
+					resume = false;
+					if (done < 0)
+						throw std::runtime_error(fcheckpoint + " is a checkpoint of another scene, camera or render settings; "
+							"remove it or give another --checkpoint");
+					if (done == 0)
+						fb.clear();
+					else
+						std::cerr << "resuming " << fcheckpoint << " at " << done << " samples per pixel" << std::endl;
+					const int resumed = done;
+
+					const std::vector<tile> tiles = make_morton_tiles(sdesc.image_width, sdesc.image_height, fb.tile_size());
+					const int pass_samples = sdesc.pass_samples > 0 ? sdesc.pass_samples : sdesc.samples_per_pixel;
+					std::vector<WORKER_TIMES> times;
+					// summed over all passes
+					std::vector<double> tile_ms(m_adesc.fheatmap.empty() ? 0 : tiles.size());
+
+					for (int pass = 1; done < sdesc.samples_per_pixel; pass++) {
+						const int first = done;
+						const int count = std::min(pass_samples, sdesc.samples_per_pixel - done);
+						times = m_pool->run(tiles.size(), timed_tiles(tile_ms,
+							[&](size_t t, UINT) {
+								const tile& tl = tiles[t];
+								for (UINT j = tl.y0; j < tl.y1; j++) {
+									for (UINT i = tl.x0; i < tl.x1; i++)
+										fb.set(i, j, render_samples(i, j, sdesc, first, count, fb.get(i, j)));
+								}
+							}
+						));
+						done += count;
+
+						checkpoint.samples = done;
+						if (!fcheckpoint.empty() && !save_checkpoint(fcheckpoint, checkpoint, fb))
+							std::cerr << "could not write checkpoint " << fcheckpoint << std::endl;
+						if (sdesc.preview_interval > 0 && pass % sdesc.preview_interval == 0 && done < sdesc.samples_per_pixel)
+							write_preview(fb, done);
+					}
 
-				for (int j = sdesc.image_height-1; j >= 0; j--) {
-					for (int i = 0; i < sdesc.image_width; i++) {
-						color clr = (*buff)[j * sdesc.image_width + i];
-						auto r = clr.x();
-						auto g = clr.y();
-						auto b = clr.z();
+					m_samples_done = done;
+					m_stats.record_worker_times(times);
+					record_path_stats(static_cast<uint64_t>(sdesc.img_size()) * resumed);
+					write_heatmap(tiles, tile_ms);
+				});
+			}
+	#endif
 
-						// Divide the color by the number of samples.
-						auto scale = 1.0 / sdesc.samples_per_pixel;
-						r = std::sqrt(scale * r);
-						g = std::sqrt(scale * g);
-						b = std::sqrt(scale * b);
+			// Default MT rendering
+			void render_def(framebuffer& fb) {
 
-						// Write the translated [0,255] value of each color component.
-						ss << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-							<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-							<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+				m_stats.measure([&]() {
+					const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
 
-						m_outfile.write(ss.str().c_str(), ss.str().size());
+					// pixels in parallel; adaptive sampling shares its budget over tile wide spans, which go whole
+					const UINT span = sdesc.noise_threshold > 0 ? fb.tile_size() : 1;
+					std::vector<UINT> range((sdesc.image_width + span - 1) / span);
+					std::generate(std::begin(range), std::end(range),
+						[n = 0u, span]() mutable {
+							return span * n++;
+						}
+					);
 
-						ss.str(std::string());
+					for (int j = sdesc.image_height-1; j >= 0; j--) {
+						std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+						std::for_each(
+							std::execution::par,
+							std::begin(range),
+							std::end(range),
+							[&](UINT x0) {
+								render_span(j, x0, std::min(x0 + span, sdesc.image_width), sdesc, fb);
+							}
+						);
 					}
-				}
+
+					record_path_stats();
+				});
 			}
 		#endif
 
@@ -452,15 +1152,8 @@ namespace raytracer {
 
 					for (int j = sdesc.image_height - 1; j >= 0; j--) {
 						//std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-						for (int i = 0; i < sdesc.image_width; i++) {
-							color pixel_color{ 0, 0, 0 };
-							for (int s = 0; s < sdesc.samples_per_pixel; s++) {
-								auto u = (i + random_double()) / (sdesc.image_width - 1);
-								auto v = (j + random_double()) / (sdesc.image_height - 1);
-								ray r = m_adesc.cam.get_ray(u, v);
-								pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-							}
-							auto clr = pixel_color / sdesc.samples_per_pixel;
+						for (UINT i = 0; i < sdesc.image_width; i++) {
+							auto clr = render_pixel(i, j, sdesc) / sdesc.samples_per_pixel;
 							auto r = std::sqrt(clr.x());
 							auto g = std::sqrt(clr.y());
 							auto b = std::sqrt(clr.z());
@@ -473,67 +1166,85 @@ namespace raytracer {
 							ss.str(std::string());
 						}
 					}
-				});
-			}
-		#else
-			void render(color** buff) {
 
-			const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
-
-			for (int j = sdesc.image_height - 1; j >= 0; j--) {
-				std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-				for (int i = 0; i < sdesc.image_width; i++) {
-					color pixel_color{ 0, 0, 0 };
-					for (int s = 0; s < sdesc.samples_per_pixel; s++) {
-						auto u = (i + random_double()) / (sdesc.image_width - 1);
-						auto v = (j + random_double()) / (sdesc.image_height - 1);
-						ray r = m_adesc.cam.get_ray(u, v);
-						pixel_color += ray_color(r, m_adesc.world, sdesc.max_depth);
-					}
-					(*buff)[j * sdesc.image_width + i] = pixel_color;
-				}
+					record_path_stats();
+				});
 			}
-		}
-
-		void write_img_buff(color** buff) {
-
-			std::stringstream ss;
-			const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
-
-			ss << "P3\n" << sdesc.image_width << " " << sdesc.image_height << " " << "\n255\n";
-			m_outfile.write(ss.str().c_str(), ss.str().size());
-			ss.str(std::string());
-
-			m_outfile.rdbuf()->pubsetbuf(nullptr, 0); // Disable buffering ??
+		#endif
+	#endif
 
-			for (int j = sdesc.image_height - 1; j >= 0; j--) {
-				for (int i = 0; i < sdesc.image_width; i++) {
-					color clr = (*buff)[j * sdesc.image_width + i];
-					auto r = clr.x();
-					auto g = clr.y();
-					auto b = clr.z();
+	#if defined(MT) || !defined(PAR_RENDER_WRITE)
+		// ST (single-thread) rendering; MT builds keep it as the serial baseline
+		void render(framebuffer& fb) {
 
-					// Divide the color by the number of samples.
-					auto scale = 1.0 / sdesc.samples_per_pixel;
-					r = std::sqrt(scale * r);
-					g = std::sqrt(scale * g);
-					b = std::sqrt(scale * b);
+			m_stats.measure([&]() {
+				const STATS_DESCRIPTOR sdesc = m_stats.get_descriptor();
 
-					// Write the translated [0,255] value of each color component.
-					ss << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-						<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-						<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+				for (int j = sdesc.image_height - 1; j >= 0; j--) {
+					std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+					render_row(j, sdesc, fb);
+				}
 
-					m_outfile.write(ss.str().c_str(), ss.str().size());
+				record_path_stats();
+			});
+		}
 
-					ss.str(std::string());
-				}
+		/*
+			Renders with backend b into fb; returns false when b is not compiled
+			into this build (see the ENABLE_* and MT defines).
+		*/
+		bool render(backend b, framebuffer& fb) {
+			m_image_streamed = false;
+			switch (b) {
+			case backend::serial:
+				render(fb);
+				return true;
+		#ifdef SYCL
+			case backend::sycl:
+				render_w_sycl(fb);
+				return true;
+		#endif
+		#ifdef KERNEL
+			case backend::opencl:
+				render_w_opencl(fb);
+				return true;
+		#endif
+		#if defined(MT) && !defined(PAR_RENDER_WRITE)
+			case backend::par:
+				render_def(fb);
+				return true;
+		#ifdef ENABLE_OMP
+			case backend::omp:
+				render_w_omp(fb);
+				return true;
+		#endif
+		#ifdef ENABLE_THREAD
+			case backend::thread:
+				render_w_thread(fb);
+				return true;
+		#endif
+		#ifdef ENABLE_ASYNC
+			case backend::async:
+				render_w_future(fb);
+				return true;
+		#endif
+		#ifdef ENABLE_POOL
+			case backend::pool:
+				render_w_pool(fb);
+				return true;
+			case backend::packets:
+				render_w_packets(fb);
+				return true;
+			case backend::progressive:
+				render_progressive(fb);
+				return true;
+		#endif
+		#endif
+			default:
+				return false;
 			}
 		}
-		#endif
-
 	#endif
-#endif
 
 
 	private:
@@ -541,6 +1252,15 @@ namespace raytracer {
 		std::ofstream m_outfile;
 		stats m_stats;
 		ADRENALINE_DESCRIPTOR m_adesc;
+		mutable std::atomic<uint64_t> m_paths{ 0 };
+		mutable std::atomic<uint64_t> m_path_segments{ 0 };
+		// samples per pixel summed by the last progressive render (0 = samples_per_pixel)
+		int m_samples_done = 0;
+		// the last render wrote the output itself, write_img_buff is skipped
+		bool m_image_streamed = false;
+	#ifdef ENABLE_POOL
+		std::unique_ptr<thread_pool> m_pool;
+	#endif
 		//!member data
 	};
 }
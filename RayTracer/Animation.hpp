@@ -0,0 +1,121 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace raytracer {
+
+	// where a sphere's center is at the last frame
+	struct SPHERE_MOTION {
+		uint32_t sphere;	// index in the scene
+		point3 to;
+	};
+
+	/*
+		What an instance does by the last frame: it turns by degrees about axis
+		through its own origin, before its transform, and moves by translate,
+		after it.
+	*/
+	struct INSTANCE_MOTION {
+		uint32_t instance;	// index in the scene
+		vec3 translate;
+		vec3 axis = vec3(0, 1, 0);
+		real degrees = 0;
+	};
+
+	/*
+		Linear motion over a sequence of frames. The first frame shows the
+		scene as it was loaded, the last one has everything where the motions
+		say; the frames in between are interpolated.
+	*/
+	struct ANIMATION {
+		uint32_t frames = 1;
+		// the camera's at the last frame, unset = it stays
+		std::optional<point3> look_from;
+		std::optional<point3> look_at;
+		std::vector<SPHERE_MOTION> spheres;
+		std::vector<INSTANCE_MOTION> instances;
+	};
+
+	inline vec3 animation_lerp(const vec3& a, const vec3& b, real t) { return a + t * (b - a); }
+
+	// the camera at time t, 0 at the first frame and 1 at the last, of a camera that starts as camera
+	inline CAM_DESCRIPTOR frame_camera(const ANIMATION& animation, const CAM_DESCRIPTOR& camera, real t) {
+		CAM_DESCRIPTOR camd = camera;
+		if (animation.look_from)
+			camd.look_from = animation_lerp(camera.look_from, *animation.look_from, t);
+		if (animation.look_at)
+			camd.look_at = animation_lerp(camera.look_at, *animation.look_at, t);
+		return camd;
+	}
+
+	/*
+		Moves a frozen world from frame to frame. The world, its trees and
+		whatever renders it stay alive for the whole sequence; a frame only
+		sets the moving spheres and instances and refits the trees, which costs
+		a pass over the bvh nodes instead of a build.
+	*/
+	class frame_sequence {
+	public:
+		// takes where the moving things start from world, so before it is frozen
+		frame_sequence(const ANIMATION& animation, const scene& world, const CAM_DESCRIPTOR& camera)
+			: m_animation(animation), m_camera(camera)
+		{
+			for (const SPHERE_MOTION& motion : animation.spheres)
+				m_sphere_start.push_back(world.spheres().center(motion.sphere));
+			for (const INSTANCE_MOTION& motion : animation.instances)
+				m_instance_start.push_back(world.instances()[motion.instance].transform);
+		}
+
+		uint32_t frames() const { return m_animation.frames > 0 ? m_animation.frames : 1; }
+
+		// 0 at the first frame, 1 at the last
+		real time(uint32_t frame) const {
+			return frames() > 1 ? static_cast<real>(frame) / (frames() - 1) : 0;
+		}
+
+		// puts world into frame's state and refits it; returns the frame's camera
+		CAM_DESCRIPTOR apply(uint32_t frame, frozen_scene& world) const {
+			const real t = time(frame);
+			for (size_t k = 0; k < m_sphere_start.size(); k++) {
+				const SPHERE_MOTION& motion = m_animation.spheres[k];
+				world.set_sphere_center(motion.sphere, animation_lerp(m_sphere_start[k], motion.to, t));
+			}
+			for (size_t k = 0; k < m_instance_start.size(); k++) {
+				const INSTANCE_MOTION& motion = m_animation.instances[k];
+				world.set_instance_transform(motion.instance, affine_transform::translate(t * motion.translate)
+					* m_instance_start[k] * affine_transform::rotate(motion.axis, t * motion.degrees));
+			}
+			world.refit();
+
+			return frame_camera(m_animation, m_camera, t);
+		}
+
+	private:
+		//member data
+		ANIMATION m_animation;
+		CAM_DESCRIPTOR m_camera;
+		std::vector<point3> m_sphere_start;
+		std::vector<affine_transform> m_instance_start;
+		//!member data
+	};
+
+	// path with the frame number before the extension: output.ppm, 7 -> output_0007.ppm
+	inline std::string frame_path(const std::string& path, uint32_t frame) {
+		std::string number = std::to_string(frame);
+		if (number.size() < 4)
+			number.insert(0, 4 - number.size(), '0');
+		const size_t dot = path.find_last_of('.');
+		const size_t slash = path.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return path + "_" + number;
+		return path.substr(0, dot) + "_" + number + path.substr(dot);
+	}
+}
+
+#endif //!ANIMATION_HPP
@@ -0,0 +1,546 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include "Adrenaline.hpp"
+#include "Sphere.hpp"
+#include "Scene.hpp"
+#include <iomanip>
+#include <random>
+#include <thread>
+
+namespace raytracer {
+namespace bench {
+
+	/*
+		Spheres of radius 0.4 scattered uniformly in a cube whose volume grows
+		with the count, so that the density (and the expected number of hits
+		along a ray) stays roughly the same for every scene size.
+	*/
+	inline hittable_list random_spheres(size_t count, std::shared_ptr<material> mat, unsigned int seed = 7) {
+		std::mt19937 gen(seed);
+		const double side = 2.0 * std::cbrt(static_cast<double>(count));
+		std::uniform_real_distribution<double> coord(-side / 2, side / 2);
+
+		hittable_list list;
+		list.objects.reserve(count);
+		for (size_t i = 0; i < count; i++)
+			list.add(std::make_shared<sphere>(point3(coord(gen), coord(gen), coord(gen)), 0.4, mat));
+		return list;
+	}
+
+	// rays from a point outside the cube towards random points inside it
+	inline std::vector<ray> random_rays(size_t count, size_t nspheres, unsigned int seed = 11) {
+		std::mt19937 gen(seed);
+		const double side = 2.0 * std::cbrt(static_cast<double>(nspheres));
+		std::uniform_real_distribution<double> coord(-side / 2, side / 2);
+
+		std::vector<ray> rays(count);
+		const point3 origin{ 0.0, 0.0, static_cast<real>(side) };
+		for (auto& r : rays)
+			r = ray(origin, point3(coord(gen), coord(gen), coord(gen)) - origin);
+		return rays;
+	}
+
+	struct trace_result {
+		double ms_per_ray;
+		size_t hits;
+		double t_sum;
+	};
+
+	inline trace_result trace_all(const hittable& world, const std::vector<ray>& rays, size_t count) {
+		timer t;
+		hit_record rec;
+		trace_result result{ 0.0, 0, 0.0 };
+
+		t.reset();
+		for (size_t i = 0; i < count; i++) {
+			if (world.hit(rays[i], 0.001, infinity, rec)) {
+				result.hits++;
+				result.t_sum += rec.t;
+			}
+		}
+		result.ms_per_ray = t.elapsed() / count;
+		return result;
+	}
+
+	// the four spheres main renders
+	inline std::shared_ptr<const frozen_scene> default_scene() {
+		scene builder;
+		const material* ground = builder.add_material<lambertian>(color(0.8, 0.8, 0.0));
+		const material* center = builder.add_material<lambertian>(color(0.7, 0.3, 0.3));
+		const material* left = builder.add_material<metal>(color(0.8, 0.8, 0.8));
+		const material* right = builder.add_material<metal>(color(0.8, 0.6, 0.2));
+		builder.add_sphere(point3(0.0, -100.5, -1.0), 100.0, ground);
+		builder.add_sphere(point3(0.0, 0.0, -1.0), 0.5, center);
+		builder.add_sphere(point3(-1.0, 0.0, -1.0), 0.5, left);
+		builder.add_sphere(point3(1.0, 0.0, -1.0), 0.5, right);
+		return builder.freeze();
+	}
+
+	// the default camera's ground sphere plus count small spheres in front of it, half diffuse, half metal
+	inline std::shared_ptr<const frozen_scene> sphere_field_scene(size_t count, unsigned int seed = 5) {
+		scene builder;
+		const material* ground = builder.add_material<lambertian>(color(0.8, 0.8, 0.0));
+		const material* diffuse = builder.add_material<lambertian>(color(0.7, 0.3, 0.3));
+		const material* shiny = builder.add_material<metal>(color(0.8, 0.6, 0.2));
+		builder.reserve_spheres(count + 1);
+		builder.add_sphere(point3(0.0, -100.5, -1.0), 100.0, ground);
+		std::mt19937 gen(seed);
+		// drawn in double, so float builds get the same scene
+		std::uniform_real_distribution<double> xy(-4.0, 4.0), z(-12.0, -2.0), rad(0.02, 0.2);
+		for (size_t i = 0; i < count; i++) {
+			const double x = xy(gen), y = xy(gen) * 0.25 + 0.5, zz = z(gen);
+			builder.add_sphere(point3(static_cast<real>(x), static_cast<real>(y), static_cast<real>(zz)), rad(gen), i % 2 ? diffuse : shiny);
+		}
+		return builder.freeze();
+	}
+
+	/*
+		Same hits at (nearly) the same distances. The tolerance follows the scalar:
+		the batch kernels round differently than sphere::hit (operation order,
+		FMA contraction), and in a float build that flips the odd grazing ray.
+	*/
+	inline bool same_hits(const trace_result& a, const trace_result& b) {
+		const double tolerance = std::sqrt(std::numeric_limits<real>::epsilon());
+		const double hit_difference = std::fabs(static_cast<double>(a.hits) - static_cast<double>(b.hits));
+		return hit_difference <= tolerance * a.hits && std::fabs(a.t_sum - b.t_sum) <= tolerance * std::fabs(a.t_sum);
+	}
+
+	/*
+		Compares the linear hittable_list scan with the bvh for growing scene sizes.
+		The linear scan gets a ray budget inversely proportional to the scene size,
+		so the 1M sphere case finishes in a reasonable time.
+	*/
+	inline void bvh_vs_list(std::ostream& out) {
+		const size_t sizes[] = { 10, 1'000, 100'000, 1'000'000 };
+		const size_t bvh_rays = 200'000;
+		auto mat = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+		out << "BVH vs hittable_list\n";
+		out << std::setw(10) << "spheres"
+			<< std::setw(14) << "build ms"
+			<< std::setw(16) << "list ns/ray"
+			<< std::setw(16) << "bvh ns/ray"
+			<< std::setw(12) << "speedup"
+			<< std::setw(10) << "agree" << '\n';
+
+		for (size_t n : sizes) {
+			hittable_list list = random_spheres(n, mat);
+			std::vector<ray> rays = random_rays(bvh_rays, n);
+
+			timer t;
+			t.reset();
+			bvh accel(list);
+			const double build_ms = t.elapsed();
+
+			const size_t list_rays = std::clamp<size_t>(200'000'000 / n, 64, bvh_rays);
+			trace_result lin = trace_all(list, rays, list_rays);
+			trace_result acc = trace_all(accel, rays, bvh_rays);
+			trace_result check = trace_all(accel, rays, list_rays);
+
+			const bool agree = lin.hits == check.hits && std::fabs(lin.t_sum - check.t_sum) <= 1e-6 * std::fabs(lin.t_sum);
+			out << std::setw(10) << n
+				<< std::setw(14) << std::fixed << std::setprecision(2) << build_ms
+				<< std::setw(16) << std::setprecision(1) << lin.ms_per_ray * 1e6
+				<< std::setw(16) << acc.ms_per_ray * 1e6
+				<< std::setw(11) << std::setprecision(1) << lin.ms_per_ray / acc.ms_per_ray << 'x'
+				<< std::setw(10) << (agree ? "yes" : "NO") << '\n';
+		}
+		out << std::defaultfloat;
+	}
+
+	/*
+		Write throughput of the image writers on a synthetic 4K frame, including
+		the scanline resolve of the tiled framebuffer and opening, writing and
+		closing the file.
+	*/
+	inline void image_write_throughput(std::ostream& out) {
+		const unsigned int width = 3840, height = 2160;
+		const int spp = 100;
+
+		std::mt19937 gen(3);
+		std::uniform_real_distribution<double> value(0.0, static_cast<double>(spp));
+		framebuffer fb(width, height);
+		for (unsigned int j = 0; j < height; j++)
+			for (unsigned int i = 0; i < width; i++)
+				fb.set(i, j, color(value(gen), value(gen), value(gen)));
+
+		out << "Image write " << width << "x" << height << '\n';
+		out << std::setw(8) << "format"
+			<< std::setw(12) << "ms"
+			<< std::setw(12) << "MB"
+			<< std::setw(12) << "MB/s"
+			<< std::setw(14) << "Mpixel/s" << '\n';
+
+		for (image_format format : { image_format::P3, image_format::P6, image_format::PFM }) {
+			const std::string path = std::string("bench_output.") + image_extension(format);
+
+			timer t;
+			t.reset();
+			{
+				std::ofstream file(path, std::ios::out | std::ios::binary);
+				write_image(file, format, fb, spp);
+			}
+			const double ms = t.elapsed();
+
+			std::ifstream written(path, std::ios::binary | std::ios::ate);
+			const double mb = static_cast<double>(written.tellg()) / (1024.0 * 1024.0);
+			written.close();
+			std::remove(path.c_str());
+
+			const char* name = format == image_format::P3 ? "P3" : (format == image_format::P6 ? "P6" : "PFM");
+			out << std::setw(8) << name
+				<< std::setw(12) << std::fixed << std::setprecision(1) << ms
+				<< std::setw(12) << mb
+				<< std::setw(12) << mb / (ms / 1000.0)
+				<< std::setw(14) << fb.pixel_count() / (ms * 1000.0) << '\n';
+		}
+		out << std::defaultfloat;
+	}
+
+	/*
+		Batch kernel of sphere_pack (SPHERE_PACK_LANES wide) vs. one virtual
+		sphere::hit per object, both brute force, and the packed frozen_scene
+		(bvh with sphere_pack leaves) vs. a bvh over individual spheres.
+	*/
+	inline void sphere_pack_kernel(std::ostream& out) {
+		auto mat = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+		const size_t nrays = 100'000;
+
+		out << "Sphere batch kernel, " << SPHERE_PACK_LANES << " lane(s)\n";
+		out << std::setw(10) << "spheres"
+			<< std::setw(18) << "list ns/ray"
+			<< std::setw(18) << "pack ns/ray"
+			<< std::setw(12) << "speedup"
+			<< std::setw(10) << "agree" << '\n';
+
+		for (size_t n : { 4, 16, 64, 256, 1024 }) {
+			hittable_list list = random_spheres(n, mat);
+			sphere_pack pack;
+			pack.reserve(n);
+			for (const auto& object : list.objects) {
+				const sphere& s = static_cast<const sphere&>(*object);
+				pack.add(s.center, s.radius, s.mat_ptr);
+			}
+			const std::vector<ray> rays = random_rays(nrays, n);
+
+			trace_result lin = trace_all(list, rays, nrays);
+			trace_result packed = trace_all(pack, rays, nrays);
+			const bool agree = same_hits(lin, packed);
+			out << std::setw(10) << n
+				<< std::setw(18) << std::fixed << std::setprecision(1) << lin.ms_per_ray * 1e6
+				<< std::setw(18) << packed.ms_per_ray * 1e6
+				<< std::setw(11) << lin.ms_per_ray / packed.ms_per_ray << 'x'
+				<< std::setw(10) << (agree ? "yes" : "NO") << '\n';
+		}
+
+		for (size_t n : { 100'000 }) {
+			hittable_list list = random_spheres(n, mat);
+			bvh accel(list);
+			scene builder;
+			builder.reserve_spheres(n);
+			for (const auto& object : list.objects) {
+				const sphere& s = static_cast<const sphere&>(*object);
+				builder.add_sphere(s.center, s.radius, s.mat_ptr);
+			}
+			std::shared_ptr<const frozen_scene> frozen = builder.freeze();
+			const std::vector<ray> rays = random_rays(nrays, n);
+
+			trace_result tree = trace_all(accel, rays, nrays);
+			trace_result packed = trace_all(*frozen, rays, nrays);
+			const bool agree = same_hits(tree, packed);
+			out << std::setw(10) << n
+				<< std::setw(18) << std::fixed << std::setprecision(1) << tree.ms_per_ray * 1e6
+				<< std::setw(18) << packed.ms_per_ray * 1e6
+				<< std::setw(11) << tree.ms_per_ray / packed.ms_per_ray << 'x'
+				<< std::setw(10) << (agree ? "yes" : "NO") << "   (bvh vs frozen_scene)\n";
+		}
+		out << std::defaultfloat;
+	}
+
+	/*
+		Multi-thread scaling of closest-hit queries on a frozen_scene with a handful
+		of shared materials. The "shared_ptr" column replays what the old hit path
+		did on top of that: two shared_ptr<material> copies per hit (sphere::hit
+		assigning mat_ptr, hittable_list::hit copying temp_rec), all threads
+		contending on the same few control blocks.
+	*/
+	inline void refcount_scaling(std::ostream& out) {
+		const size_t nspheres = 10'000;
+		const size_t rays_per_thread = 200'000;
+
+		std::vector<std::shared_ptr<material>> owners = {
+			std::make_shared<lambertian>(color(0.8, 0.8, 0.0)),
+			std::make_shared<lambertian>(color(0.7, 0.3, 0.3)),
+			std::make_shared<metal>(color(0.8, 0.8, 0.8)),
+			std::make_shared<metal>(color(0.8, 0.6, 0.2))
+		};
+
+		scene builder;
+		hittable_list list = random_spheres(nspheres, owners[0]);
+		builder.reserve_spheres(nspheres);
+		for (size_t i = 0; i < list.objects.size(); i++) {
+			const sphere& s = static_cast<const sphere&>(*list.objects[i]);
+			builder.add_sphere(s.center, s.radius, owners[i % owners.size()].get());
+		}
+		std::shared_ptr<const frozen_scene> world = builder.freeze();
+		const std::vector<ray> rays = random_rays(rays_per_thread, nspheres);
+
+		const auto run = [&](unsigned int nthreads, bool refcount) {
+			std::vector<std::thread> threads;
+			timer t;
+			t.reset();
+			for (unsigned int id = 0; id < nthreads; id++) {
+				threads.emplace_back([&]() {
+					hit_record rec;
+					std::shared_ptr<material> held;
+					for (const ray& r : rays) {
+						if (!world->hit(r, 0.001, infinity, rec) || !refcount) continue;
+						for (const auto& owner : owners) {
+							if (owner.get() != rec.mat_ptr) continue;
+							std::shared_ptr<material> copy = owner;
+							held = copy;
+						}
+					}
+				});
+			}
+			for (std::thread& thread : threads)
+				thread.join();
+			return (static_cast<double>(nthreads) * rays.size()) / (t.elapsed() * 1000.0); // Mrays/s
+		};
+
+		const unsigned int hw = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<unsigned int> counts;
+		for (unsigned int n = 1; n < hw; n *= 2)
+			counts.push_back(n);
+		counts.push_back(hw);
+
+		out << "Hit path scaling, " << nspheres << " spheres\n";
+		out << std::setw(8) << "threads"
+			<< std::setw(16) << "raw Mrays/s"
+			<< std::setw(12) << "scaling"
+			<< std::setw(20) << "shared_ptr Mrays/s"
+			<< std::setw(12) << "scaling" << '\n';
+
+		double raw_base = 0.0, ref_base = 0.0;
+		for (unsigned int n : counts) {
+			const double raw = run(n, false);
+			const double ref = run(n, true);
+			if (n == 1) {
+				raw_base = raw;
+				ref_base = ref;
+			}
+			out << std::setw(8) << n
+				<< std::setw(16) << std::fixed << std::setprecision(2) << raw
+				<< std::setw(11) << std::setprecision(0) << 100.0 * raw / (n * raw_base) << '%'
+				<< std::setw(20) << std::setprecision(2) << ref
+				<< std::setw(11) << std::setprecision(0) << 100.0 * ref / (n * ref_base) << '%' << '\n';
+		}
+		out << std::defaultfloat;
+	}
+
+#if defined(MT) && defined(ENABLE_POOL)
+	/*
+		render_w_pool (one ray at a time) vs. render_w_packets (packets of 8,
+		sorted secondary rays) on the same frozen scene. Both render the same
+		image, which is checked as well.
+	*/
+	inline void packet_tracing(std::ostream& out) {
+		const size_t nspheres = 10'000;
+
+		STATS_DESCRIPTOR sdesc = {};
+		sdesc.aspect_ratio = 16.0 / 9.0;
+		sdesc.image_width = 400;
+		sdesc.image_height = static_cast<UINT>(sdesc.image_width / sdesc.aspect_ratio);
+		sdesc.samples_per_pixel = 4;
+		sdesc.max_depth = 50;
+		sdesc.rr_depth = 3;
+		sdesc.tile_size = 32;
+		sdesc.measurements.iteration_count = 1;
+		sdesc.measurements.elapsed = std::vector<double>(1);
+
+		ADRENALINE_DESCRIPTOR adesc;
+		adesc.cam = camera1(CAM_DESCRIPTOR{});
+		adesc.world = sphere_field_scene(nspheres);
+		adesc.foutput = "bench_packets.ppm";
+		adesc.format = image_format::P6;
+		adesc.stream_output = false;
+		adrenaline adr(adesc, sdesc);
+
+		framebuffer single(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+		framebuffer packed(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+		const auto run = [&](framebuffer& fb, bool packets) {
+			if (packets)
+				adr.render_w_packets(fb);
+			else
+				adr.render_w_pool(fb);
+			const double rays = sdesc.measurements.avg_path_length * sdesc.img_size() * sdesc.samples_per_pixel;
+			return rays / (sdesc.measurements.elapsed[0] * 1000.0); // Mrays/s
+		};
+		const double single_rate = run(single, false);
+		const double packed_rate = run(packed, true);
+		const bool same = single.same_pixels(packed);
+
+		out << "Packet tracing, " << nspheres + 1 << " spheres, "
+			<< sdesc.image_width << 'x' << sdesc.image_height << " @ " << sdesc.samples_per_pixel << " spp\n";
+		out << std::setw(18) << "pool Mrays/s"
+			<< std::setw(18) << "packet Mrays/s"
+			<< std::setw(12) << "speedup"
+			<< std::setw(16) << "same image" << '\n';
+		out << std::setw(18) << std::fixed << std::setprecision(2) << single_rate
+			<< std::setw(18) << packed_rate
+			<< std::setw(11) << packed_rate / single_rate << 'x'
+			<< std::setw(16) << (same ? "yes" : "NO") << '\n';
+		out << std::defaultfloat;
+	}
+#endif
+
+#if defined(MT) && defined(ENABLE_POOL)
+	/*
+		Time to the last byte of a 4K frame: render_w_pool followed by
+		write_img_buff against the same render with the output stage writing
+		finished bands while it runs. Both files have to be the same.
+	*/
+	inline void pipelined_output(std::ostream& out) {
+		STATS_DESCRIPTOR sdesc = {};
+		sdesc.aspect_ratio = 16.0 / 9.0;
+		sdesc.image_width = 3840;
+		sdesc.image_height = 2160;
+		sdesc.samples_per_pixel = 1;
+		sdesc.max_depth = 8;
+		sdesc.rr_depth = 3;
+		sdesc.tile_size = 32;
+		sdesc.measurements.iteration_count = 1;
+		sdesc.measurements.elapsed = std::vector<double>(1);
+		const std::shared_ptr<const frozen_scene> world = sphere_field_scene(1000);
+
+		out << "Pipelined output, " << sdesc.image_width << 'x' << sdesc.image_height << " @ " << sdesc.samples_per_pixel << " spp\n";
+		out << std::setw(8) << "format"
+			<< std::setw(14) << "mode"
+			<< std::setw(12) << "render ms"
+			<< std::setw(14) << "last byte ms"
+			<< std::setw(12) << "same file" << '\n';
+
+		for (image_format format : { image_format::P6, image_format::PFM }) {
+			std::string files[2];
+			for (int streamed = 0; streamed < 2; streamed++) {
+				ADRENALINE_DESCRIPTOR adesc;
+				adesc.cam = camera1(CAM_DESCRIPTOR{});
+				adesc.world = world;
+				adesc.foutput = std::string(streamed ? "bench_streamed." : "bench_written.") + image_extension(format);
+				adesc.format = format;
+				adesc.stream_output = streamed == 1;
+
+				framebuffer fb(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+				timer total;
+				{
+					adrenaline adr(adesc, sdesc);
+					total.reset();
+					adr.render_w_pool(fb);
+					adr.write_img_buff(fb);
+				}
+				const double last_byte = total.elapsed();
+
+				std::ifstream in(adesc.foutput, std::ios::in | std::ios::binary);
+				files[streamed].assign(std::istreambuf_iterator<char>(in), {});
+				in.close();
+				std::remove(adesc.foutput.c_str());
+
+				out << std::setw(8) << (format == image_format::P6 ? "P6" : "PFM")
+					<< std::setw(14) << (streamed ? "streamed" : "after render")
+					<< std::setw(12) << std::fixed << std::setprecision(1) << sdesc.measurements.elapsed[0]
+					<< std::setw(14) << last_byte
+					<< std::setw(12) << (!streamed ? "" : files[0] == files[1] ? "yes" : "NO") << '\n';
+			}
+		}
+		out << std::defaultfloat;
+	}
+#endif
+
+#if defined(SYCL) && defined(MT) && defined(ENABLE_POOL)
+	/*
+		The SYCL backend against the native CPU modes on the same scenes. The
+		device renders in float, so its image is compared to the pool's with
+		compare_images instead of bit by bit.
+	*/
+	inline void sycl_backend(std::ostream& out) {
+		STATS_DESCRIPTOR sdesc = {};
+		sdesc.aspect_ratio = 16.0 / 9.0;
+		sdesc.image_width = 400;
+		sdesc.image_height = static_cast<UINT>(sdesc.image_width / sdesc.aspect_ratio);
+		sdesc.samples_per_pixel = 16;
+		sdesc.max_depth = 50;
+		sdesc.rr_depth = 3;
+		sdesc.tile_size = 32;
+		sdesc.measurements.iteration_count = 1;
+		sdesc.measurements.elapsed = std::vector<double>(1);
+
+		// linear image of a render buffer, as encode_image would store it as a PFM
+		const auto to_image = [&](const framebuffer& fb) {
+			pfm_image img;
+			img.width = sdesc.image_width;
+			img.height = sdesc.image_height;
+			img.pixels.resize(3 * fb.pixel_count());
+			const float scale = 1.0f / sdesc.samples_per_pixel;
+			for (UINT j = 0; j < fb.height(); j++)
+				fb.resolve_row(j, img.pixels.data() + 3 * static_cast<size_t>(j) * fb.width());
+			for (float& v : img.pixels)
+				v *= scale;
+			return img;
+		};
+
+		out << "SYCL backend, " << sdesc.image_width << 'x' << sdesc.image_height << " @ " << sdesc.samples_per_pixel << " spp\n";
+		out << std::setw(14) << "scene"
+			<< std::setw(12) << "backend"
+			<< std::setw(12) << "ms"
+			<< std::setw(12) << "Mrays/s"
+			<< std::setw(16) << "rmse vs pool" << '\n';
+
+		for (const char* name : { "default", "spheres_10k" }) {
+			ADRENALINE_DESCRIPTOR adesc;
+			adesc.cam = camera1(CAM_DESCRIPTOR{});
+			adesc.world = std::string(name) == "default" ? default_scene() : sphere_field_scene(10'000);
+			adesc.foutput = "bench_sycl.ppm";
+			adesc.format = image_format::P6;
+			adesc.stream_output = false;
+			adrenaline adr(adesc, sdesc);
+
+			pfm_image reference;
+			for (backend b : { backend::pool, backend::packets, backend::sycl }) {
+				framebuffer fb(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+				adr.render(b, fb);
+				const double ms = sdesc.measurements.elapsed[0];
+				const double rays = sdesc.measurements.avg_path_length * sdesc.measurements.samples_taken;
+
+				const pfm_image img = to_image(fb);
+				if (b == backend::pool)
+					reference = img;
+				out << std::setw(14) << name
+					<< std::setw(12) << backend_name(b)
+					<< std::setw(12) << std::fixed << std::setprecision(1) << ms
+					<< std::setw(12) << std::setprecision(2) << rays / (ms * 1000.0)
+					<< std::setw(16) << std::setprecision(5) << compare_images(reference, img).rmse << '\n';
+			}
+		}
+		out << std::defaultfloat;
+	}
+#endif
+
+	inline int run_all() {
+		bvh_vs_list(std::cout);
+		image_write_throughput(std::cout);
+		sphere_pack_kernel(std::cout);
+		refcount_scaling(std::cout);
+#if defined(MT) && defined(ENABLE_POOL)
+		packet_tracing(std::cout);
+		pipelined_output(std::cout);
+#endif
+#if defined(SYCL) && defined(MT) && defined(ENABLE_POOL)
+		sycl_backend(std::cout);
+#endif
+		return 0;
+	}
+}
+}
+
+#endif //!BENCHMARK_HPP
\ No newline at end of file
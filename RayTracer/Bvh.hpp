@@ -0,0 +1,434 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "Hittable.hpp"
+#include "Packet.hpp"
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+namespace raytracer {
+
+	/*
+		Node of a flattened (depth-first ordered) bounding volume hierarchy.
+		The first child of an interior node is always stored right after it,
+		so only the index of the second child has to be kept.
+	*/
+	struct bvh_node {
+		aabb box;
+		uint32_t offset{};	// leaf: index of the first primitive, interior: index of the second child
+		uint16_t count{};	// number of primitives in a leaf, 0 for interior nodes
+		uint16_t axis{};	// split axis of an interior node
+
+		bool is_leaf() const { return count > 0; }
+	};
+
+	/*
+		Geometry-agnostic BVH. It is built from the bounding boxes of the primitives
+		only; after the build order() maps every leaf slot back to the index of the
+		primitive it was built from, so the owner can store its primitives in leaf order.
+	*/
+	class bvh_tree {
+	public:
+		static constexpr uint32_t max_leaf_size = 4;
+		static constexpr int sah_bins = 16;
+		static constexpr int max_sah_depth = 64;
+		static constexpr int stack_size = 128;
+
+		bvh_tree() = default;
+		bvh_tree(const std::vector<aabb>& boxes, uint32_t leaf_size = max_leaf_size) { build(boxes, leaf_size); }
+
+		/*
+			leaf_size bounds the leaves the build has to make; the SAH may stop at
+			up to four times as many primitives when splitting them would not pay.
+			Expensive primitives, such as whole instances, want 1.
+		*/
+		void build(const std::vector<aabb>& boxes, uint32_t leaf_size = max_leaf_size) {
+			m_nodes.clear();
+			m_order.clear();
+			m_leaf_size = leaf_size > 0 ? leaf_size : 1;
+			if (boxes.empty()) return;
+
+			std::vector<build_prim> prims(boxes.size());
+			for (uint32_t i = 0; i < boxes.size(); i++)
+				prims[i] = { boxes[i], boxes[i].centroid(), i };
+
+			// a binary tree with at most one primitive per leaf has 2n-1 nodes
+			m_nodes.reserve(2 * boxes.size());
+			build_recursive(prims, 0, static_cast<uint32_t>(prims.size()), 0);
+
+			m_order.resize(prims.size());
+			for (size_t i = 0; i < prims.size(); i++)
+				m_order[i] = prims[i].index;
+		}
+
+		const std::vector<bvh_node>& nodes() const { return m_nodes; }
+		const std::vector<uint32_t>& order() const { return m_order; }
+		bool empty() const { return m_nodes.empty(); }
+
+		aabb bounds() const {
+			return m_nodes.empty() ? aabb() : m_nodes[0].box;
+		}
+
+		/*
+			Recomputes every box bottom-up after primitives moved, keeping the
+			tree as it was built: leaf_box(slot) returns the box of the primitive
+			in leaf slot slot (the owner's storage order, see order()). Children
+			come after their parent, so one backward pass over the nodes does it,
+			in a fraction of a build's time. The tree gets worse the further the
+			primitives move from where it was built; build again after big moves.
+		*/
+		template<typename LeafBoxFn>
+		void refit(LeafBoxFn&& leaf_box) {
+			for (size_t i = m_nodes.size(); i-- > 0; ) {
+				bvh_node& node = m_nodes[i];
+				node.box = aabb();
+				if (node.is_leaf()) {
+					for (uint32_t k = node.offset; k < node.offset + node.count; k++)
+						node.box.expand(leaf_box(k));
+				}
+				else {
+					node.box.expand(m_nodes[i + 1].box);
+					node.box.expand(m_nodes[node.offset].box);
+				}
+			}
+		}
+
+		/*
+			Closest-hit traversal. leaf(first, count, t_min, closest) has to test the
+			primitives [first, first + count) against the ray, shrink closest to the
+			nearest hit it finds and return whether it found one.
+		*/
+		template<typename LeafFn>
+		bool traverse(const ray& r, real t_min, real t_max, LeafFn&& leaf) const {
+			if (m_nodes.empty()) return false;
+
+			const point3 origin = r.origin();
+			const vec3 dir = r.direction();
+			const vec3 inv_dir{ 1 / dir.x(), 1 / dir.y(), 1 / dir.z() };
+			const bool dir_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+			std::array<uint32_t, stack_size> stack;
+			int sp = 0;
+			uint32_t current = 0;
+			real closest = t_max;
+			bool hit_anything = false;
+
+			while (true) {
+				const bvh_node& node = m_nodes[current];
+				RT_COUNT(box_tests);
+				if (node.box.hit(origin, inv_dir, t_min, closest)) {
+					if (node.is_leaf()) {
+						if (leaf(node.offset, static_cast<uint32_t>(node.count), t_min, closest))
+							hit_anything = true;
+					}
+					else {
+						// visit the child on the ray's side of the split plane first
+						if (dir_neg[node.axis]) {
+							stack[sp++] = current + 1;
+							current = node.offset;
+						}
+						else {
+							stack[sp++] = node.offset;
+							current = current + 1;
+						}
+						continue;
+					}
+				}
+				if (sp == 0) break;
+				current = stack[--sp];
+			}
+
+			return hit_anything;
+		}
+
+		/*
+			Packet traversal. A node is entered when at least one active ray of the
+			packet hits its box; the child order follows the first active ray.
+			leaf(first, count, lanes, t_min) has to intersect the rays in the lanes
+			bitmask with the primitives [first, first + count) and update packet.t
+			and packet.prim of every lane that found a closer hit.
+		*/
+		template<int N, typename LeafFn>
+		void traverse_packet(ray_packet<N>& packet, real t_min, LeafFn&& leaf) const {
+			if (m_nodes.empty() || packet.active == 0) return;
+
+			int lead = 0;
+			while (!(packet.active & (1u << lead))) lead++;
+			const bool dir_neg[3] = { packet.inv_dx[lead] < 0, packet.inv_dy[lead] < 0, packet.inv_dz[lead] < 0 };
+
+			std::array<uint32_t, stack_size> stack;
+			int sp = 0;
+			uint32_t current = 0;
+
+			while (true) {
+				const bvh_node& node = m_nodes[current];
+				const point3 bmin = node.box.min(), bmax = node.box.max();
+				RT_COUNT_N(box_tests, std::bitset<32>(packet.active).count());
+
+				// branch-free slab test of all lanes, the compiler vectorizes this loop
+				uint32_t lanes = 0;
+				for (int k = 0; k < N; k++) {
+					real t0 = (bmin.x() - packet.ox[k]) * packet.inv_dx[k];
+					real t1 = (bmax.x() - packet.ox[k]) * packet.inv_dx[k];
+					real tnear = std::max(t_min, std::min(t0, t1));
+					real tfar = std::min(packet.t[k], std::max(t0, t1));
+					t0 = (bmin.y() - packet.oy[k]) * packet.inv_dy[k];
+					t1 = (bmax.y() - packet.oy[k]) * packet.inv_dy[k];
+					tnear = std::max(tnear, std::min(t0, t1));
+					tfar = std::min(tfar, std::max(t0, t1));
+					t0 = (bmin.z() - packet.oz[k]) * packet.inv_dz[k];
+					t1 = (bmax.z() - packet.oz[k]) * packet.inv_dz[k];
+					tnear = std::max(tnear, std::min(t0, t1));
+					tfar = std::min(tfar, std::max(t0, t1));
+					lanes |= static_cast<uint32_t>(tnear <= tfar) << k;
+				}
+				lanes &= packet.active;
+
+				if (lanes) {
+					if (node.is_leaf()) {
+						leaf(node.offset, static_cast<uint32_t>(node.count), lanes, t_min);
+					}
+					else {
+						if (dir_neg[node.axis]) {
+							stack[sp++] = current + 1;
+							current = node.offset;
+						}
+						else {
+							stack[sp++] = node.offset;
+							current = current + 1;
+						}
+						continue;
+					}
+				}
+				if (sp == 0) break;
+				current = stack[--sp];
+			}
+		}
+
+	private:
+		struct build_prim {
+			aabb box;
+			point3 centroid;
+			uint32_t index;
+		};
+
+		struct sah_bin {
+			aabb box;
+			uint32_t count = 0;
+		};
+
+		static double axis_of(const point3& p, int axis) {
+			return axis == 0 ? p.x() : (axis == 1 ? p.y() : p.z());
+		}
+
+		uint32_t make_leaf(const aabb& box, uint32_t begin, uint32_t end) {
+			bvh_node node;
+			node.box = box;
+			node.offset = begin;
+			node.count = static_cast<uint16_t>(end - begin);
+			m_nodes.push_back(node);
+			return static_cast<uint32_t>(m_nodes.size() - 1);
+		}
+
+		uint32_t build_recursive(std::vector<build_prim>& prims, uint32_t begin, uint32_t end, int depth) {
+			aabb box, centroid_box;
+			for (uint32_t i = begin; i < end; i++) {
+				box.expand(prims[i].box);
+				centroid_box.expand(prims[i].centroid);
+			}
+
+			const uint32_t n = end - begin;
+			if (n <= m_leaf_size)
+				return make_leaf(box, begin, end);
+
+			uint32_t mid = begin;
+			int split_axis = centroid_box.longest_axis();
+			const double extent = centroid_box.axis_max(split_axis) - centroid_box.axis_min(split_axis);
+
+			if (extent <= 0.0) {
+				// all centroids coincide, SAH cannot separate them
+				mid = begin + n / 2;
+			}
+			else if (depth >= max_sah_depth) {
+				// guard the traversal stack against pathological SAH chains
+				mid = begin + n / 2;
+				std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+					[split_axis](const build_prim& a, const build_prim& b) {
+						return axis_of(a.centroid, split_axis) < axis_of(b.centroid, split_axis);
+					});
+			}
+			else {
+				/*
+					Binned surface area heuristic: the cost of a split is
+					SA(left) * N(left) + SA(right) * N(right), relative to the cost
+					of intersecting every primitive of the node (SA(node) * N).
+				*/
+				double best_cost = infinity;
+				int best_axis = -1, best_split = 0;
+
+				for (int axis = 0; axis < 3; axis++) {
+					const double cmin = centroid_box.axis_min(axis);
+					const double cext = centroid_box.axis_max(axis) - cmin;
+					if (cext <= 0.0) continue;
+					const double scale = sah_bins / cext;
+
+					std::array<sah_bin, sah_bins> bins{};
+					for (uint32_t i = begin; i < end; i++) {
+						int b = std::min(sah_bins - 1, static_cast<int>((axis_of(prims[i].centroid, axis) - cmin) * scale));
+						bins[b].count++;
+						bins[b].box.expand(prims[i].box);
+					}
+
+					// sweep from the right to get the cost of every right partition
+					std::array<double, sah_bins> right_cost{};
+					aabb acc;
+					uint32_t acc_count = 0;
+					for (int b = sah_bins - 1; b > 0; b--) {
+						acc.expand(bins[b].box);
+						acc_count += bins[b].count;
+						right_cost[b] = acc_count * acc.surface_area();
+					}
+
+					acc = aabb();
+					acc_count = 0;
+					for (int b = 0; b < sah_bins - 1; b++) {
+						acc.expand(bins[b].box);
+						acc_count += bins[b].count;
+						const double cost = acc_count * acc.surface_area() + right_cost[b + 1];
+						if (acc_count > 0 && acc_count < n && cost < best_cost) {
+							best_cost = cost;
+							best_axis = axis;
+							best_split = b;
+						}
+					}
+				}
+
+				const double leaf_cost = n * box.surface_area();
+				if (best_axis < 0 || (best_cost >= leaf_cost && n <= 4 * m_leaf_size))
+					return make_leaf(box, begin, end);
+
+				split_axis = best_axis;
+				const double cmin = centroid_box.axis_min(split_axis);
+				const double scale = sah_bins / (centroid_box.axis_max(split_axis) - cmin);
+				auto it = std::partition(prims.begin() + begin, prims.begin() + end,
+					[=](const build_prim& p) {
+						int b = std::min(sah_bins - 1, static_cast<int>((axis_of(p.centroid, split_axis) - cmin) * scale));
+						return b <= best_split;
+					});
+				mid = static_cast<uint32_t>(it - prims.begin());
+			}
+
+			const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.emplace_back();
+			build_recursive(prims, begin, mid, depth + 1);
+			const uint32_t second = build_recursive(prims, mid, end, depth + 1);
+
+			bvh_node& node = m_nodes[index];
+			node.box = box;
+			node.offset = second;
+			node.count = 0;
+			node.axis = static_cast<uint16_t>(split_axis);
+			return index;
+		}
+
+	private:
+		//member data
+		std::vector<bvh_node> m_nodes;
+		std::vector<uint32_t> m_order;
+		uint32_t m_leaf_size = max_leaf_size;
+		//!member data
+	};
+
+	/*
+		Bounding volume hierarchy over arbitrary hittables, usable anywhere a
+		hittable_list is. Objects without finite bounds are kept aside and tested linearly.
+	*/
+	class bvh : public hittable {
+	public:
+		bvh() = default;
+
+		// shares ownership of the list's objects
+		bvh(const hittable_list& list)
+			: m_owned(list.objects)
+		{
+			std::vector<const hittable*> objects;
+			objects.reserve(list.objects.size());
+			for (const auto& object : list.objects)
+				objects.push_back(object.get());
+			build(objects);
+		}
+
+		// the caller keeps the objects alive for the lifetime of the bvh
+		bvh(const std::vector<const hittable*>& objects) {
+			build(objects);
+		}
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			bool hit_anything = m_tree.traverse(r, t_min, t_max,
+				[&](uint32_t first, uint32_t count, real tmin, real& closest) {
+					bool hit_leaf = false;
+					for (uint32_t i = first; i < first + count; i++) {
+						if (m_objects[i]->hit(r, tmin, closest, rec)) {
+							hit_leaf = true;
+							closest = rec.t;
+						}
+					}
+					return hit_leaf;
+				});
+
+			double closest = hit_anything ? rec.t : t_max;
+			for (const hittable* object : m_unbounded) {
+				if (object->hit(r, t_min, closest, rec)) {
+					hit_anything = true;
+					closest = rec.t;
+				}
+			}
+
+			return hit_anything;
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			if (!m_unbounded.empty() || m_tree.empty()) return false;
+			output_box = m_tree.bounds();
+			return true;
+		}
+
+		const bvh_tree& tree() const { return m_tree; }
+
+	private:
+		void build(const std::vector<const hittable*>& objects) {
+			std::vector<const hittable*> bounded;
+			std::vector<aabb> boxes;
+			bounded.reserve(objects.size());
+			boxes.reserve(objects.size());
+
+			aabb box;
+			for (const hittable* object : objects) {
+				if (object->bounding_box(box)) {
+					bounded.push_back(object);
+					boxes.push_back(box);
+				}
+				else {
+					m_unbounded.push_back(object);
+				}
+			}
+
+			m_tree.build(boxes);
+
+			m_objects.resize(bounded.size());
+			for (size_t i = 0; i < bounded.size(); i++)
+				m_objects[i] = bounded[m_tree.order()[i]];
+		}
+
+	private:
+		//member data
+		bvh_tree m_tree;
+		std::vector<const hittable*> m_objects; // in leaf order
+		std::vector<const hittable*> m_unbounded;
+		std::vector<std::shared_ptr<hittable>> m_owned;
+		//!member data
+	};
+}
+
+#endif //!BVH_HPP
\ No newline at end of file
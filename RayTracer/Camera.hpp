@@ -3,65 +3,173 @@
 
 #include "Utility.hpp"
 #include "Ray.hpp"
+#include <vector>
 
 namespace raytracer {
 
 	class camera {
 	};
 
+	/*
+		Positionable thin-lens camera. The defaults look down -z from the origin
+		with a 90 degree vertical field of view, i.e. a viewport two units high
+		at distance one.
+	*/
 	struct CAM_DESCRIPTOR {
-		double aspect_ratio = 16.0 / 9.0;
-		/*
-			For the standard square pixel spacing,
-			the viewport's aspect ratio should be the same as our rendered image.
-			We'll just pick a viewport two units in height.
-		*/
-		double viewport_height = 2.0;
-		/*
-			We'll also set the distance between the projection plane and the projection point
-			to be one unit.
-		*/
-		double focal_length = 1.0;
-		double viewport_width = aspect_ratio * viewport_height;
+		point3 look_from = point3{ 0.0, 0.0, 0.0 };
+		point3 look_at = point3{ 0.0, 0.0, -1.0 };
+		vec3 up = vec3{ 0.0, 1.0, 0.0 };
+		// vertical field of view, in degrees
+		real vfov = 90.0;
+		real aspect_ratio = real(16.0 / 9.0);
+		// lens diameter, 0 = pinhole (everything in focus)
+		real aperture = 0.0;
+		// distance of the plane in focus (0 = |look_at - look_from|)
+		real focus_dist = 0.0;
+	};
+
+	/*
+		Why camd cannot make a camera, nullptr if it can: without a view
+		direction, or with one parallel to up, camera1's basis is NaN and every
+		pixel comes out black. The scene loaders reject such cameras.
+	*/
+	inline const char* camera_problem(const CAM_DESCRIPTOR& camd) {
+		const vec3 view = camd.look_at - camd.look_from;
+		if (view.length_squared() == 0)
+			return "look_from and look_at are the same point";
+		if (cross(camd.up, view).length_squared() <= 1e-12 * camd.up.length_squared() * view.length_squared())
+			return "up is zero or parallel to the view direction";
+		return nullptr;
+	}
 
-		vec3 horizontal = vec3{ viewport_width, 0.0, 0.0 };
-		vec3 vertical = vec3{ 0.0, viewport_height, 0.0 };
-		point3 origin = point3{ 0.0, 0.0, 0.0 };
-		point3 lower_left_corner = origin - horizontal / 2 - vertical / 2 - vec3{ 0.0, 0.0, focal_length };
+	// what camera1 derives from its CAM_DESCRIPTOR, computed once when the camera is made
+	struct CAM_BASIS {
+		point3 origin;
+		point3 lower_left_corner;
+		vec3 to_corner;		// lower_left_corner - origin
+		vec3 horizontal;	// edges of the film, which lies in the plane of focus
+		vec3 vertical;
+		vec3 u, v, w;		// right, up and backwards
+		real lens_radius;
+	};
+
+	/*
+		Primary rays of a batch of film positions as structure of arrays. The
+		caller fills s, t and, with lens_sample, lens_x and lens_y; camera1::get_rays
+		then writes origins and directions in one loop the compiler vectorizes.
+	*/
+	struct ray_batch {
+		std::vector<real> s, t;
+		std::vector<real> lens_x, lens_y;
+		std::vector<real> ox, oy, oz;
+		std::vector<real> dx, dy, dz;
+
+		void resize(size_t n) {
+			for (std::vector<real>* v : { &s, &t, &lens_x, &lens_y, &ox, &oy, &oz, &dx, &dy, &dz })
+				v->resize(n);
+		}
+
+		size_t size() const { return s.size(); }
+
+		ray get(size_t k) const { return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k])); }
 	};
 
     class camera1 : virtual camera {
     public:
 
-		camera1() = default;
+		camera1() : camera1(CAM_DESCRIPTOR{}) {}
 
         camera1(CAM_DESCRIPTOR camd) {
 			m_camd = camd;
-			//const double aspect_ratio = 16.0 / 9.0;
-			//double viewport_height = 2.0;
-			//double focal_length = 1.0;
-			//double viewport_width = aspect_ratio * viewport_height;
-
-			//origin = point3{ 0, 0, 0 };
-			//horizontal = vec3(viewport_width, 0, 0);
-			//vertical = vec3(0, viewport_height, 0);
-			//lower_left_corner = origin - horizontal / 2 - vertical / 2 - vec3{ 0, 0, focal_length };
+
+			const real h = static_cast<real>(std::tan(degrees_to_radians(camd.vfov) / 2));
+			const real viewport_height = 2 * h;
+			const real viewport_width = camd.aspect_ratio * viewport_height;
+			const real focus_dist = camd.focus_dist > 0 ? camd.focus_dist : (camd.look_from - camd.look_at).length();
+
+			m_basis.w = unit_vector(camd.look_from - camd.look_at);
+			m_basis.u = unit_vector(cross(camd.up, m_basis.w));
+			m_basis.v = cross(m_basis.w, m_basis.u);
+
+			m_basis.origin = camd.look_from;
+			m_basis.horizontal = focus_dist * viewport_width * m_basis.u;
+			m_basis.vertical = focus_dist * viewport_height * m_basis.v;
+			m_basis.lower_left_corner = m_basis.origin - m_basis.horizontal / 2 - m_basis.vertical / 2 - focus_dist * m_basis.w;
+			m_basis.to_corner = m_basis.lower_left_corner - m_basis.origin;
+			m_basis.lens_radius = camd.aperture / 2;
         }
 
-        ray get_ray(double u, double v) const {
-            return ray(
-				m_camd.origin,
-				m_camd.lower_left_corner
-					+ u * m_camd.horizontal
-					+ v * m_camd.vertical
-					- m_camd.origin
-			);
+		/*
+			Ray through film position (s, t), both in [0, 1]. A lens takes two more
+			random numbers (lens_sample) after the caller's two for s and t.
+		*/
+        ray get_ray(real s, real t) const {
+			const vec3 direction = m_basis.to_corner + s * m_basis.horizontal + t * m_basis.vertical;
+			if (m_basis.lens_radius <= 0)
+				return ray(m_basis.origin, direction);
+
+			real x, y;
+			lens_sample(x, y);
+			const vec3 offset = m_basis.u * x + m_basis.v * y;
+			return ray(m_basis.origin + offset, direction - offset);
         }
 
+		// point on the lens, scaled by its radius; a pinhole camera draws no random numbers
+		void lens_sample(real& x, real& y) const {
+			if (m_basis.lens_radius <= 0) {
+				x = y = 0;
+				return;
+			}
+			const vec3 p = random_in_unit_disk();
+			x = m_basis.lens_radius * p.x();
+			y = m_basis.lens_radius * p.y();
+		}
+
+		// get_ray for every entry of batch, the same rays to the bit
+		void get_rays(ray_batch& batch) const {
+			primary_rays(m_basis, batch.size(), batch.s.data(), batch.t.data(), batch.lens_x.data(), batch.lens_y.data(),
+				batch.ox.data(), batch.oy.data(), batch.oz.data(), batch.dx.data(), batch.dy.data(), batch.dz.data());
+		}
+
+		const CAM_DESCRIPTOR& descriptor() const { return m_camd; }
+		const CAM_BASIS& basis() const { return m_basis; }
+
     private:
+		/*
+			The loop behind get_rays. The arrays are restrict parameters (GCC ignores
+			restrict on locals) and the basis is read into locals, so the compiler
+			knows the stores alias nothing it reads and vectorizes the loop.
+		*/
+		static void primary_rays(const CAM_BASIS& b, size_t n,
+			const real* __restrict s, const real* __restrict t, const real* __restrict lx, const real* __restrict ly,
+			real* __restrict ox, real* __restrict oy, real* __restrict oz,
+			real* __restrict dx, real* __restrict dy, real* __restrict dz)
+		{
+			const real o[3] = { b.origin.x(), b.origin.y(), b.origin.z() };
+			const real c[3] = { b.to_corner.x(), b.to_corner.y(), b.to_corner.z() };
+			const real h[3] = { b.horizontal.x(), b.horizontal.y(), b.horizontal.z() };
+			const real v[3] = { b.vertical.x(), b.vertical.y(), b.vertical.z() };
+			const real u_lens[3] = { b.u.x(), b.u.y(), b.u.z() };
+			const real v_lens[3] = { b.v.x(), b.v.y(), b.v.z() };
+			for (size_t k = 0; k < n; k++) {
+				const real offx = u_lens[0] * lx[k] + v_lens[0] * ly[k];
+				const real offy = u_lens[1] * lx[k] + v_lens[1] * ly[k];
+				const real offz = u_lens[2] * lx[k] + v_lens[2] * ly[k];
+				ox[k] = o[0] + offx;
+				oy[k] = o[1] + offy;
+				oz[k] = o[2] + offz;
+				dx[k] = c[0] + s[k] * h[0] + t[k] * v[0] - offx;
+				dy[k] = c[1] + s[k] * h[1] + t[k] * v[1] - offy;
+				dz[k] = c[2] + s[k] * h[2] + t[k] * v[2] - offz;
+			}
+		}
+
+		//member data
 		CAM_DESCRIPTOR m_camd;
+		CAM_BASIS m_basis;
+		//!member data
     };
 }
 
 
-#endif //!CAMERA_HPP
\ No newline at end of file
+#endif //!CAMERA_HPP
@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "Camera.hpp"
+#include "Framebuffer.hpp"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace raytracer {
+
+	/*
+		Header of a progressive render checkpoint: the per-pixel sample sums
+		follow it, three floats per pixel in scanlines from the bottom, whatever
+		the tiling of the framebuffer that wrote them. A checkpoint only resumes a
+		render with the same size, seed, path settings, scene and camera; the
+		last two are kept as a hash (frozen_scene::fingerprint, hash_camera).
+	*/
+	struct CHECKPOINT_HEADER {
+		char magic[4] = { 'R', 'T', 'C', 'K' };
+		uint32_t version = 3;
+		uint64_t seed = 0;
+		uint64_t scene = 0;		// hash of the scene and the camera
+		uint32_t pixel_size = 3 * sizeof(float);
+		uint32_t width = 0;
+		uint32_t height = 0;
+		int32_t max_depth = 0;
+		int32_t rr_depth = 0;
+		int32_t samples = 0;	// samples per pixel accumulated so far
+
+		// everything but the sample count matches
+		bool resumes(const CHECKPOINT_HEADER& other) const {
+			return std::memcmp(magic, other.magic, sizeof(magic)) == 0 && version == other.version
+				&& seed == other.seed && scene == other.scene && pixel_size == other.pixel_size
+				&& width == other.width && height == other.height
+				&& max_depth == other.max_depth && rr_depth == other.rr_depth;
+		}
+	};
+
+	// h going on with everything of camd that moves a camera ray
+	inline uint64_t hash_camera(const CAM_DESCRIPTOR& camd, uint64_t h) {
+		const real values[] = { camd.look_from.x(), camd.look_from.y(), camd.look_from.z(),
+			camd.look_at.x(), camd.look_at.y(), camd.look_at.z(), camd.up.x(), camd.up.y(), camd.up.z(),
+			camd.vfov, camd.aspect_ratio, camd.aperture, camd.focus_dist };
+		return hash_bytes(values, sizeof(values), h);
+	}
+
+	/*
+		Loads the sums into fb when the file exists and fits expected; the
+		accumulated sample count is returned, 0 if there is no checkpoint and
+		-1 if there is one of another render.
+	*/
+	inline int load_checkpoint(const std::string& path, const CHECKPOINT_HEADER& expected, framebuffer& fb) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in) return 0;
+
+		CHECKPOINT_HEADER header;
+		in.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!in || !expected.resumes(header) || header.samples < 0) return -1;
+
+		if (header.width != fb.width() || header.height != fb.height()) return -1;
+
+		std::vector<float> line(3 * static_cast<size_t>(header.width));
+		for (unsigned int j = 0; j < header.height; j++) {
+			in.read(reinterpret_cast<char*>(line.data()), line.size() * sizeof(float));
+			if (!in) return -1;
+			fb.load_row(j, line.data());
+		}
+		return header.samples;
+	}
+
+	/*
+		Written to a temporary file that then replaces the old checkpoint, so a
+		job killed mid-write still leaves the previous pass behind.
+	*/
+	inline bool save_checkpoint(const std::string& path, const CHECKPOINT_HEADER& header, const framebuffer& fb) {
+		const std::string tmp = path + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			std::vector<float> line(3 * static_cast<size_t>(fb.width()));
+			for (unsigned int j = 0; j < fb.height(); j++) {
+				fb.resolve_row(j, line.data());
+				out.write(reinterpret_cast<const char*>(line.data()), line.size() * sizeof(float));
+			}
+			if (!out) return false;
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp, path, ec);
+		return !ec;
+	}
+}
+
+#endif //!CHECKPOINT_HPP
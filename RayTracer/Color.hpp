@@ -7,6 +7,7 @@
 #include "Hittable.hpp"
 #include "Material.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace raytracer {
@@ -32,28 +33,89 @@ namespace raytracer {
             << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
             << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
     }
+    // Rec. 709 luma of a linear color
+    inline real luminance(const color& c) {
+        return real(0.2126) * c.x() + real(0.7152) * c.y() + real(0.0722) * c.z();
+    }
+
     /*
         The ray_color(ray) function linearly blends white and blue depending on the height of the y
         coordinate after scaling the ray direction to unit length (so −1.0<y<1.0).
         Because we're looking at the y height after normalizing the vector, you'll notice a horizontal gradient to the color in addition to the vertical gradient.
     */
-    color ray_color(const ray& r, const hittable& world, int depth) {
-        hit_record rec;
+    inline color sky_color(const ray& r) {
+        vec3 unit_direction = unit_vector(r.direction());
+        auto t = 0.5 * (unit_direction.y() + 1.0);
+        return (1.0 - t) * color { 1.0, 1.0, 1.0 }
+        + t * color{ 0.5, 0.7, 1.0 };
+    }
+
+    /*
+        Iterative path tracer: instead of recursing once per bounce, the product of
+        all attenuations so far (the throughput) is carried along the path.
+        From bounce rr_depth on, Russian roulette ends the path with probability
+        1 - p, p being the throughput's largest component (capped at 0.95); surviving
+        paths are divided by p, which keeps the estimate unbiased. rr_depth <= 0
+        disables the roulette. path_length receives the number of rays traced.
+        This overload continues a path whose first ray r was traced already (e.g. in
+        a packet): hit tells whether it hit anything, rec what.
+    */
+    color ray_color(const ray& r, bool hit, hit_record rec, const hittable& world, int max_depth, int rr_depth, int& path_length) {
+        color throughput{ 1.0, 1.0, 1.0 };
+        ray current = r;
+
+        path_length = 0;
+        for (int depth = 0; depth < max_depth; depth++) {
+            if (depth > 0)
+                hit = world.hit(current, 0, infinity, rec);
+            path_length++;
+            RT_COUNT(rays);
 
-        if (depth <= 0)
-            return color{ 0, 0, 0 };
+            if (!hit) {
+                RT_COUNT_PATH(escaped, path_length);
+                return throughput * sky_color(current);
+            }
+            RT_COUNT(hits);
 
-        if (world.hit(r, 0, infinity, rec)) {
             ray scattered;
             color attenuation;
-            if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, world, depth - 1);
-            return color{ 0, 0, 0 };
+            if (!rec.mat_ptr->scatter(current, rec, attenuation, scattered)) {
+                // a light ends the path with its radiance, anything else absorbed the ray
+                if (rec.mat_ptr->emits()) {
+                    RT_COUNT_PATH(lit, path_length);
+                    return throughput * rec.mat_ptr->emitted();
+                }
+                RT_COUNT_PATH(absorbed, path_length);
+                return color{ 0, 0, 0 };
+            }
+
+            throughput = throughput * attenuation;
+            current = scattered;
+
+            if (rr_depth > 0 && depth + 1 >= rr_depth) {
+                real p = std::min(real(0.95), std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+                if (random_double() >= p) {
+                    RT_COUNT_PATH(roulette, path_length);
+                    return color{ 0, 0, 0 };
+                }
+                throughput /= p;
+            }
         }
-        vec3 unit_direction = unit_vector(r.direction());
-        auto t = 0.5 * (unit_direction.y() + 1.0);
-        return (1.0 - t) * color { 1.0, 1.0, 1.0 }
-        + t * color{ 0.5, 0.7, 1.0 };
+
+        // ray bounce limit exceeded, no more light is gathered
+        RT_COUNT_PATH(bounce_limit, path_length);
+        return color{ 0, 0, 0 };
+    }
+
+    color ray_color(const ray& r, const hittable& world, int max_depth, int rr_depth, int& path_length) {
+        hit_record rec;
+        const bool hit = max_depth > 0 && world.hit(r, 0, infinity, rec);
+        return ray_color(r, hit, rec, world, max_depth, rr_depth, path_length);
+    }
+
+    color ray_color(const ray& r, const hittable& world, int depth) {
+        int path_length;
+        return ray_color(r, world, depth, 0, path_length);
     }
 }
 
@@ -0,0 +1,179 @@
+#ifndef COUNTERS_HPP
+#define COUNTERS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace raytracer {
+
+	// material types the scatter counters are kept apart for
+	enum class material_kind { lambertian, metal, dielectric, emissive, count };
+
+	inline const char* material_kind_name(material_kind kind) {
+		switch (kind) {
+		case material_kind::lambertian: return "lambertian";
+		case material_kind::metal: return "metal";
+		case material_kind::dielectric: return "dielectric";
+		case material_kind::emissive: return "emissive";
+		default: return "?";
+		}
+	}
+
+	/*
+		What the renderer did during one frame. Only counted in RT_COUNTERS
+		builds, in every other build the RT_COUNT macros below compile to nothing
+		and the counters stay zero.
+	*/
+	struct RAY_COUNTERS {
+		static constexpr int depth_bins = 64;
+		static constexpr int kinds = static_cast<int>(material_kind::count);
+
+		uint64_t rays = 0;				// ray segments traced
+		uint64_t box_tests = 0;			// bvh node boxes tested, once per ray of a packet
+		uint64_t primitive_tests = 0;	// ray-sphere tests
+		uint64_t hits = 0;				// segments that hit a primitive
+		// how paths ended
+		uint64_t escaped = 0;			// missed everything, got the sky's color
+		uint64_t absorbed = 0;			// the material scattered nothing
+		uint64_t lit = 0;				// reached an emissive material
+		uint64_t roulette = 0;			// killed by Russian roulette
+		uint64_t bounce_limit = 0;		// reached max_depth
+		// paths by number of segments, the last bin holds depth_bins - 1 and longer
+		uint64_t depth_histogram[depth_bins] = {};
+		// material::scatter calls and how many of them absorbed the ray, per material_kind
+		uint64_t scatters[kinds] = {};
+		uint64_t scatter_absorbed[kinds] = {};
+
+		uint64_t paths() const { return escaped + absorbed + lit + roulette + bounce_limit; }
+
+		void end_path(uint64_t RAY_COUNTERS::* ending, int length) {
+			++(this->*ending);
+			++depth_histogram[std::min(std::max(length, 0), depth_bins - 1)];
+		}
+
+		void scatter(material_kind kind, bool absorbs) {
+			++scatters[static_cast<int>(kind)];
+			scatter_absorbed[static_cast<int>(kind)] += absorbs;
+		}
+
+		RAY_COUNTERS& operator+=(const RAY_COUNTERS& other) {
+			rays += other.rays;
+			box_tests += other.box_tests;
+			primitive_tests += other.primitive_tests;
+			hits += other.hits;
+			escaped += other.escaped;
+			absorbed += other.absorbed;
+			lit += other.lit;
+			roulette += other.roulette;
+			bounce_limit += other.bounce_limit;
+			for (int k = 0; k < depth_bins; k++)
+				depth_histogram[k] += other.depth_histogram[k];
+			for (int k = 0; k < kinds; k++) {
+				scatters[k] += other.scatters[k];
+				scatter_absorbed[k] += other.scatter_absorbed[k];
+			}
+			return *this;
+		}
+	};
+
+	/*
+		Every thread counts into a RAY_COUNTERS of its own, so the hot paths
+		touch neither atomics nor cache lines shared with other threads. The
+		registry knows all of them and merges them at the end of a frame; a
+		thread that exits (std::async, std::thread workers) hands its counts
+		over before its counters go away.
+	*/
+	class counter_registry {
+	public:
+		static counter_registry& instance() {
+			static counter_registry registry;
+			return registry;
+		}
+
+		void attach(RAY_COUNTERS* counters) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_live.push_back(counters);
+		}
+
+		void detach(RAY_COUNTERS* counters) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_retired += *counters;
+			m_live.erase(std::remove(m_live.begin(), m_live.end(), counters), m_live.end());
+		}
+
+		/*
+			Sums and clears the counters of every thread. The live counters are read
+			without synchronization, so this may only run while no thread renders,
+			i.e. between frames.
+		*/
+		RAY_COUNTERS collect() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			RAY_COUNTERS total = m_retired;
+			m_retired = RAY_COUNTERS{};
+			for (RAY_COUNTERS* counters : m_live) {
+				total += *counters;
+				*counters = RAY_COUNTERS{};
+			}
+			return total;
+		}
+
+	private:
+		//member data
+		std::mutex m_mutex;
+		std::vector<RAY_COUNTERS*> m_live;
+		RAY_COUNTERS m_retired;
+		//!member data
+	};
+
+	inline RAY_COUNTERS& thread_counters() {
+		struct slot {
+			RAY_COUNTERS counters;
+			slot() { counter_registry::instance().attach(&counters); }
+			~slot() { counter_registry::instance().detach(&counters); }
+		};
+		thread_local slot s;
+		return s.counters;
+	}
+
+	inline void print_counters(std::ostream& out, const RAY_COUNTERS& c) {
+		const double rays = static_cast<double>(std::max<uint64_t>(c.rays, 1));
+		const double paths = static_cast<double>(std::max<uint64_t>(c.paths(), 1));
+		out << std::fixed << std::setprecision(2)
+			<< "Rays: " << c.rays << " in " << c.paths() << " paths (" << c.rays / paths << " per path)\n"
+			<< "Box tests per ray: " << c.box_tests / rays << ", sphere tests per ray: " << c.primitive_tests / rays
+			<< ", hit rate: " << 100.0 * c.hits / rays << "%\n"
+			<< "Paths ended by: sky " << 100.0 * c.escaped / paths << "%, absorption " << 100.0 * c.absorbed / paths
+			<< "%, light " << 100.0 * c.lit / paths
+			<< "%, roulette " << 100.0 * c.roulette / paths << "%, bounce limit " << 100.0 * c.bounce_limit / paths << "%\n";
+		for (int k = 0; k < RAY_COUNTERS::kinds; k++) {
+			if (c.scatters[k] == 0) continue;
+			out << "Scatters, " << material_kind_name(static_cast<material_kind>(k)) << ": " << c.scatters[k]
+				<< " (" << 100.0 * c.scatter_absorbed[k] / c.scatters[k] << "% absorbed)\n";
+		}
+		out << "Path lengths:";
+		for (int k = 0; k < RAY_COUNTERS::depth_bins; k++) {
+			if (c.depth_histogram[k] == 0) continue;
+			out << ' ' << k << (k == RAY_COUNTERS::depth_bins - 1 ? "+" : "") << ':' << 100.0 * c.depth_histogram[k] / paths << '%';
+		}
+		out << '\n' << std::defaultfloat;
+	}
+}
+
+// RT_COUNT(field), RT_COUNT_N(field, n), RT_COUNT_PATH(ending, length), RT_COUNT_SCATTER(kind, absorbs)
+#ifdef RT_COUNTERS
+	#define RT_COUNT(field) (++::raytracer::thread_counters().field)
+	#define RT_COUNT_N(field, n) (::raytracer::thread_counters().field += (n))
+	#define RT_COUNT_PATH(ending, length) (::raytracer::thread_counters().end_path(&::raytracer::RAY_COUNTERS::ending, (length)))
+	#define RT_COUNT_SCATTER(kind, absorbs) (::raytracer::thread_counters().scatter(::raytracer::material_kind::kind, (absorbs)))
+#else
+	#define RT_COUNT(field) ((void)0)
+	#define RT_COUNT_N(field, n) ((void)0)
+	#define RT_COUNT_PATH(ending, length) ((void)0)
+	#define RT_COUNT_SCATTER(kind, absorbs) ((void)0)
+#endif
+
+#endif //!COUNTERS_HPP
@@ -0,0 +1,342 @@
+#ifndef DEVICESCENE_HPP
+#define DEVICESCENE_HPP
+
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace raytracer {
+
+	/*
+		Plain-data copy of a frozen_scene for the device backends (SYCL kernels,
+		render.cl): no pointers to follow, no virtual calls, single precision and
+		fixed 16 byte multiples that an OpenCL C struct can mirror.
+	*/
+	struct DEVICE_NODE {
+		float min[3];
+		uint32_t offset;	// leaf: index of the first sphere, interior: index of the second child
+		float max[3];
+		uint16_t count;		// number of spheres in a leaf, 0 for interior nodes
+		uint16_t axis;		// split axis of an interior node
+	};
+
+	struct DEVICE_SPHERE {
+		float center[3];
+		float radius;
+	};
+
+	struct DEVICE_MATERIAL {
+		uint32_t kind;		// material_kind
+		float albedo[3];
+		float fuzz;
+		float ior;
+	};
+
+	struct DEVICE_CAMERA {
+		float origin[3];
+		float lower_left_corner[3];
+		float horizontal[3];
+		float vertical[3];
+		float lens_u[3];	// camera right and up, the lens offset's axes
+		float lens_v[3];
+		float lens_radius;	// 0 = pinhole
+	};
+
+	// everything else the kernel of render.cl needs, passed by value
+	struct DEVICE_RENDER_PARAMS {
+		uint64_t seed;
+		uint32_t width;
+		uint32_t height;
+		int32_t samples_per_pixel;
+		int32_t max_depth;
+		int32_t rr_depth;
+		uint32_t node_count;
+	};
+
+	// render.cl declares the same structs, their sizes must not drift apart
+	static_assert(sizeof(DEVICE_NODE) == 32 && sizeof(DEVICE_SPHERE) == 16 && sizeof(DEVICE_MATERIAL) == 24
+		&& sizeof(DEVICE_CAMERA) == 76 && sizeof(DEVICE_RENDER_PARAMS) == 32, "device structs out of sync with render.cl");
+
+	/*
+		Spheres are in the frozen scene's bvh leaf order, sphere_materials[i] is
+		the index of sphere i's material. No array is ever empty (a scene without
+		spheres gets one unused element each), as some runtimes reject zero sized
+		buffers; node_count says whether there is a tree at all.
+	*/
+	struct device_scene {
+		std::vector<DEVICE_NODE> nodes;
+		std::vector<DEVICE_SPHERE> spheres;
+		std::vector<uint32_t> sphere_materials;
+		std::vector<DEVICE_MATERIAL> materials;
+		uint32_t node_count = 0;
+	};
+
+	// spheres only: the kernels know no triangles, a scene with meshes throws std::runtime_error
+	inline device_scene flatten_scene(const frozen_scene& world) {
+		if (!world.meshes().empty())
+			throw std::runtime_error("the device backends render spheres only, this scene has triangle meshes");
+		device_scene flat;
+		for (const bvh_node& node : world.tree().nodes()) {
+			const point3 bmin = node.box.min(), bmax = node.box.max();
+			flat.nodes.push_back({
+				{ static_cast<float>(bmin.x()), static_cast<float>(bmin.y()), static_cast<float>(bmin.z()) }, node.offset,
+				{ static_cast<float>(bmax.x()), static_cast<float>(bmax.y()), static_cast<float>(bmax.z()) }, node.count, node.axis });
+		}
+		flat.node_count = static_cast<uint32_t>(flat.nodes.size());
+
+		std::unordered_map<const material*, uint32_t> ids;
+		const sphere_pack& spheres = world.spheres();
+		for (size_t i = 0; i < spheres.size(); i++) {
+			const point3 c = spheres.center(i);
+			flat.spheres.push_back({ { static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z()) },
+				static_cast<float>(spheres.radius(i)) });
+
+			const material* mat = spheres.material_of(i);
+			auto [it, inserted] = ids.emplace(mat, static_cast<uint32_t>(flat.materials.size()));
+			if (inserted) {
+				const MATERIAL_DESCRIPTOR desc = mat->describe();
+				flat.materials.push_back({ static_cast<uint32_t>(desc.kind),
+					{ static_cast<float>(desc.albedo.x()), static_cast<float>(desc.albedo.y()), static_cast<float>(desc.albedo.z()) },
+					static_cast<float>(desc.fuzz), static_cast<float>(desc.ior) });
+			}
+			flat.sphere_materials.push_back(it->second);
+		}
+
+		if (flat.nodes.empty()) flat.nodes.push_back({});
+		if (flat.spheres.empty()) flat.spheres.push_back({});
+		if (flat.sphere_materials.empty()) flat.sphere_materials.push_back(0);
+		if (flat.materials.empty()) flat.materials.push_back({});
+		return flat;
+	}
+
+	inline DEVICE_CAMERA flatten_camera(const camera1& cam) {
+		const CAM_BASIS& basis = cam.basis();
+		const auto store = [](const vec3& v, float* dst) {
+			dst[0] = static_cast<float>(v.x());
+			dst[1] = static_cast<float>(v.y());
+			dst[2] = static_cast<float>(v.z());
+		};
+		DEVICE_CAMERA dcam;
+		store(basis.origin, dcam.origin);
+		store(basis.lower_left_corner, dcam.lower_left_corner);
+		store(basis.horizontal, dcam.horizontal);
+		store(basis.vertical, dcam.vertical);
+		store(basis.u, dcam.lens_u);
+		store(basis.v, dcam.lens_v);
+		dcam.lens_radius = static_cast<float>(basis.lens_radius);
+		return dcam;
+	}
+
+	/*
+		The path tracer as device code: the same algorithm as ray_color and
+		render_samples, on the flat scene, in float and with nothing a kernel
+		cannot do (no allocation, exceptions, virtual calls or thread_locals).
+		It compiles as plain C++ as well, so it runs on the host for testing.
+	*/
+	namespace device {
+
+		struct fvec3 {
+			float x, y, z;
+		};
+
+		inline fvec3 make_fvec3(const float* v) { return { v[0], v[1], v[2] }; }
+		inline fvec3 operator+(fvec3 a, fvec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+		inline fvec3 operator-(fvec3 a, fvec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+		inline fvec3 operator*(fvec3 a, fvec3 b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+		inline fvec3 operator*(float s, fvec3 a) { return { s * a.x, s * a.y, s * a.z }; }
+		inline float dot(fvec3 a, fvec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+		inline fvec3 normalize(fvec3 a) { return (1.0f / std::sqrt(dot(a, a))) * a; }
+
+		// pointers into the buffers of a device_scene, as the kernel sees them
+		struct scene_view {
+			const DEVICE_NODE* nodes;
+			const DEVICE_SPHERE* spheres;
+			const uint32_t* sphere_materials;
+			const DEVICE_MATERIAL* materials;
+			uint32_t node_count;
+		};
+
+		// uniform in [0, 1), 24 bits
+		inline float next_float(pcg32& rng) {
+			return (rng.next_uint() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		inline fvec3 random_in_unit_sphere(pcg32& rng) {
+			while (true) {
+				const float x = 2 * next_float(rng) - 1;
+				const float y = 2 * next_float(rng) - 1;
+				const float z = 2 * next_float(rng) - 1;
+				const fvec3 p{ x, y, z };
+				if (dot(p, p) < 1)
+					return p;
+			}
+		}
+
+		inline fvec3 random_unit_vector(pcg32& rng) {
+			while (true) {
+				const fvec3 p = random_in_unit_sphere(rng);
+				const float len2 = dot(p, p);
+				if (len2 > 0)
+					return (1.0f / std::sqrt(len2)) * p;
+			}
+		}
+
+		inline bool hit_box(const DEVICE_NODE& node, fvec3 o, fvec3 inv_d, float t_min, float t_max) {
+			const float org[3] = { o.x, o.y, o.z }, inv[3] = { inv_d.x, inv_d.y, inv_d.z };
+			for (int a = 0; a < 3; a++) {
+				float t0 = (node.min[a] - org[a]) * inv[a];
+				float t1 = (node.max[a] - org[a]) * inv[a];
+				if (inv[a] < 0) { const float tmp = t0; t0 = t1; t1 = tmp; }
+				t_min = t0 > t_min ? t0 : t_min;
+				t_max = t1 < t_max ? t1 : t_max;
+				if (t_max < t_min) return false;
+			}
+			return true;
+		}
+
+		// closest hit beyond t_min, through the bvh like bvh_tree::traverse
+		inline bool closest_hit(const scene_view& scene, fvec3 o, fvec3 d, float t_min, float& t, uint32_t& prim) {
+			if (scene.node_count == 0) return false;
+			const fvec3 inv_d{ 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+			const float a = dot(d, d);
+
+			uint32_t stack[bvh_tree::stack_size];
+			int sp = 0;
+			uint32_t current = 0;
+			bool hit_anything = false;
+			while (true) {
+				const DEVICE_NODE& node = scene.nodes[current];
+				if (hit_box(node, o, inv_d, t_min, t)) {
+					if (node.count > 0) {
+						for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+							const DEVICE_SPHERE& s = scene.spheres[k];
+							const fvec3 oc = o - make_fvec3(s.center);
+							const float half_b = dot(oc, d);
+							const float c = dot(oc, oc) - s.radius * s.radius;
+							const float discriminant = half_b * half_b - a * c;
+							if (discriminant < 0) continue;
+							const float sqrtd = std::sqrt(discriminant);
+							float root = (-half_b - sqrtd) / a;
+							if (root < t_min || t < root) {
+								root = (-half_b + sqrtd) / a;
+								if (root < t_min || t < root) continue;
+							}
+							t = root;
+							prim = k;
+							hit_anything = true;
+						}
+					}
+					else {
+						const bool neg = node.axis == 0 ? d.x < 0 : node.axis == 1 ? d.y < 0 : d.z < 0;
+						stack[sp++] = neg ? current + 1 : node.offset;
+						current = neg ? node.offset : current + 1;
+						continue;
+					}
+				}
+				if (sp == 0) break;
+				current = stack[--sp];
+			}
+			return hit_anything;
+		}
+
+		/*
+			One sample of pixel (i, j), the generator keyed like seed_sample does it.
+			Bounced rays start at t_min = 0 as in ray_color, so both images agree.
+		*/
+		inline fvec3 render_sample(const scene_view& scene, const DEVICE_CAMERA& cam, uint32_t i, uint32_t j,
+			uint32_t width, uint32_t height, uint64_t seed, int sample, int max_depth, int rr_depth, int& path_length)
+		{
+			pcg32 rng(mix64(seed ^ mix64(static_cast<uint64_t>(sample))), static_cast<uint64_t>(j) * width + i);
+			const float u = (i + next_float(rng)) / (width - 1);
+			const float v = (j + next_float(rng)) / (height - 1);
+			fvec3 o = make_fvec3(cam.origin);
+			fvec3 d = make_fvec3(cam.lower_left_corner) + u * make_fvec3(cam.horizontal) + v * make_fvec3(cam.vertical) - o;
+			if (cam.lens_radius > 0) {
+				// camera1::lens_sample
+				float x, y;
+				do {
+					x = 2 * next_float(rng) - 1;
+					y = 2 * next_float(rng) - 1;
+				} while (x * x + y * y >= 1);
+				const fvec3 offset = (cam.lens_radius * x) * make_fvec3(cam.lens_u) + (cam.lens_radius * y) * make_fvec3(cam.lens_v);
+				o = o + offset;
+				d = d - offset;
+			}
+
+			fvec3 throughput{ 1.0f, 1.0f, 1.0f };
+			path_length = 0;
+			for (int depth = 0; depth < max_depth; depth++) {
+				path_length++;
+
+				float t = 3.4e38f;
+				uint32_t prim = 0;
+				if (!closest_hit(scene, o, d, 0.0f, t, prim)) {
+					const float y = 0.5f * (normalize(d).y + 1.0f);
+					return throughput * fvec3{ 1.0f - 0.5f * y, 1.0f - 0.3f * y, 1.0f };
+				}
+
+				const DEVICE_SPHERE& s = scene.spheres[prim];
+				const fvec3 p = o + t * d;
+				fvec3 normal = (1.0f / s.radius) * (p - make_fvec3(s.center));
+				const bool front_face = dot(d, normal) <= 0;
+				if (!front_face)
+					normal = -1.0f * normal;
+
+				// the scatter functions of Material.hpp
+				const DEVICE_MATERIAL& mat = scene.materials[scene.sphere_materials[prim]];
+				o = p;
+				if (mat.kind == static_cast<uint32_t>(material_kind::emissive)) {
+					return throughput * make_fvec3(mat.albedo);
+				}
+				else if (mat.kind == static_cast<uint32_t>(material_kind::metal)) {
+					const fvec3 unit = normalize(d);
+					d = unit - (2 * dot(unit, normal)) * normal;
+					if (mat.fuzz > 0)
+						d = d + mat.fuzz * random_in_unit_sphere(rng);
+					if (dot(d, normal) <= 0)
+						return { 0, 0, 0 };
+				}
+				else if (mat.kind == static_cast<uint32_t>(material_kind::dielectric)) {
+					const float offset = 1e-4f * std::fmax(1.0f, std::fmax(std::fabs(p.x), std::fmax(std::fabs(p.y), std::fabs(p.z))));
+					const float ratio = front_face ? 1.0f / mat.ior : mat.ior;
+					const fvec3 unit = normalize(d);
+					const float cos_theta = std::fmin(-dot(unit, normal), 1.0f);
+					const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+					float r0 = (1.0f - ratio) / (1.0f + ratio);
+					r0 = r0 * r0;
+					const float reflectance = r0 + (1.0f - r0) * std::pow(1.0f - cos_theta, 5.0f);
+					if (ratio * sin_theta > 1.0f || reflectance > next_float(rng)) {
+						d = unit - (2 * dot(unit, normal)) * normal;
+						o = p + offset * normal;
+					}
+					else {
+						const fvec3 perp = ratio * (unit + cos_theta * normal);
+						d = perp - std::sqrt(std::fabs(1.0f - dot(perp, perp))) * normal;
+						o = p - offset * normal;
+					}
+				}
+				else {
+					d = normal + random_unit_vector(rng);
+					if (std::fabs(d.x) < 1e-8f && std::fabs(d.y) < 1e-8f && std::fabs(d.z) < 1e-8f)
+						d = normal;
+				}
+				throughput = throughput * make_fvec3(mat.albedo);
+
+				if (rr_depth > 0 && depth + 1 >= rr_depth) {
+					float q = throughput.x > throughput.y ? throughput.x : throughput.y;
+					q = throughput.z > q ? throughput.z : q;
+					q = q < 0.95f ? q : 0.95f;
+					if (next_float(rng) >= q)
+						return { 0, 0, 0 };
+					throughput = (1.0f / q) * throughput;
+				}
+			}
+			return { 0, 0, 0 };
+		}
+	}
+}
+
+#endif //!DEVICESCENE_HPP
@@ -0,0 +1,342 @@
+#ifndef FRAMEBENCHMARK_HPP
+#define FRAMEBENCHMARK_HPP
+
+#include "Benchmark.hpp"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+	#pragma comment(lib, "psapi.lib")
+#else
+	#include <sys/resource.h>
+#endif
+
+namespace raytracer {
+namespace bench {
+
+	// peak resident set size of the process so far, in bytes (0 if unknown)
+	inline uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.PeakWorkingSetSize;
+		return 0;
+#else
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	#ifdef __APPLE__
+		return static_cast<uint64_t>(usage.ru_maxrss);			// bytes
+	#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;	// kilobytes
+	#endif
+#endif
+	}
+
+	struct FRAME_CONFIG {
+		std::string scene;
+		UINT width;
+		UINT height;
+		int samples_per_pixel;
+		UINT threads;
+
+		// the key a run is matched to its baseline with
+		std::string key() const {
+			return scene + ' ' + std::to_string(width) + 'x' + std::to_string(height)
+				+ ' ' + std::to_string(samples_per_pixel) + "spp " + std::to_string(threads) + 't';
+		}
+	};
+
+	struct FRAME_RESULT {
+		FRAME_CONFIG config;
+		double wall_ms;				// median of the timed renders
+		double mrays_per_s;			// camera samples times the average path length, per second
+		double msamples_per_s;		// camera samples per second
+		double peak_rss_mb;			// process peak after the run, so a bound on what it needed
+		double scaling_efficiency;	// t(1 thread) / (threads * t(threads)), 1 = linear
+	};
+
+	/*
+		Standard configurations: both scenes at two resolutions, every power of
+		two thread count up to the hardware concurrency and the concurrency
+		itself. quick keeps only the small resolution, for a check on every
+		commit rather than a full measurement.
+	*/
+	inline std::vector<FRAME_CONFIG> frame_configs(bool quick) {
+		const unsigned int hw = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<UINT> counts;
+		for (unsigned int n = 1; n < hw; n *= 2)
+			counts.push_back(n);
+		counts.push_back(hw);
+
+		std::vector<std::pair<UINT, UINT>> sizes = { { 320, 180 } };
+		if (!quick)
+			sizes.emplace_back(640, 360);
+
+		std::vector<FRAME_CONFIG> configs;
+		for (const char* scene : { "default", "spheres_10k" })
+			for (const auto& [width, height] : sizes)
+				for (UINT threads : counts)
+					configs.push_back({ scene, width, height, quick ? 4 : 8, threads });
+		return configs;
+	}
+
+	inline std::shared_ptr<const frozen_scene> frame_scene(const std::string& name) {
+		if (name == "spheres_10k")
+			return sphere_field_scene(10'000);
+		return default_scene();
+	}
+
+#ifdef ENABLE_POOL
+	/*
+		One frame on the thread pool with the given settings. The pool is
+		created by the first of the timed renders, which are repeated, so its
+		start-up only shows up in one of them and not in the median.
+	*/
+	inline FRAME_RESULT run_frame(const FRAME_CONFIG& config, const std::shared_ptr<const frozen_scene>& world) {
+		constexpr int repetitions = 5;
+
+		STATS_DESCRIPTOR sdesc = {};
+		sdesc.aspect_ratio = static_cast<double>(config.width) / config.height;
+		sdesc.image_width = config.width;
+		sdesc.image_height = config.height;
+		sdesc.samples_per_pixel = config.samples_per_pixel;
+		sdesc.max_depth = 50;
+		sdesc.rr_depth = 3;
+		sdesc.tile_size = 32;
+		sdesc.thread_count = config.threads;
+		sdesc.measurements.iteration_count = repetitions;
+		sdesc.measurements.elapsed = std::vector<double>(repetitions);
+
+		ADRENALINE_DESCRIPTOR adesc;
+		CAM_DESCRIPTOR cdesc;
+		cdesc.aspect_ratio = static_cast<real>(sdesc.aspect_ratio);
+		adesc.cam = camera1(cdesc);
+		adesc.world = world;
+		adesc.foutput = "bench_frame.ppm";
+		adesc.format = image_format::P6;
+		adesc.stream_output = false;
+		adrenaline adr(adesc, sdesc);
+
+		framebuffer fb(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+		adr.render_w_pool(fb);
+
+		std::vector<double> elapsed = sdesc.measurements.elapsed;
+		std::sort(elapsed.begin(), elapsed.end());
+		const double ms = elapsed[repetitions / 2];
+		const double samples = static_cast<double>(sdesc.measurements.samples_taken);
+
+		FRAME_RESULT result;
+		result.config = config;
+		result.wall_ms = ms;
+		result.mrays_per_s = samples * sdesc.measurements.avg_path_length / (ms * 1000.0);
+		result.msamples_per_s = samples / (ms * 1000.0);
+		result.peak_rss_mb = peak_rss_bytes() / (1024.0 * 1024.0);
+		result.scaling_efficiency = 1.0;
+		return result;
+	}
+#endif
+
+	inline void write_frame_json(std::ostream& out, const std::vector<FRAME_RESULT>& results) {
+		out << "{\n"
+			<< "  \"version\": 1,\n"
+			<< "  \"real\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double") << "\",\n"
+			<< "  \"sphere_pack_lanes\": " << sphere_pack::lanes << ",\n"
+			<< "  \"hardware_threads\": " << std::max(1u, std::thread::hardware_concurrency()) << ",\n"
+			<< "  \"runs\": [\n";
+		out << std::fixed;
+		for (size_t k = 0; k < results.size(); k++) {
+			const FRAME_RESULT& r = results[k];
+			out << "    { \"scene\": \"" << r.config.scene << "\""
+				<< ", \"width\": " << r.config.width
+				<< ", \"height\": " << r.config.height
+				<< ", \"spp\": " << r.config.samples_per_pixel
+				<< ", \"threads\": " << r.config.threads
+				<< std::setprecision(3)
+				<< ", \"wall_ms\": " << r.wall_ms
+				<< ", \"mrays_per_s\": " << r.mrays_per_s
+				<< ", \"msamples_per_s\": " << r.msamples_per_s
+				<< ", \"peak_rss_mb\": " << r.peak_rss_mb
+				<< ", \"scaling_efficiency\": " << r.scaling_efficiency
+				<< " }" << (k + 1 < results.size() ? "," : "") << '\n';
+		}
+		out << std::defaultfloat << "  ]\n}\n";
+	}
+
+	/*
+		Reads the runs back from a file written by write_frame_json. This is
+		no general JSON parser: every object of the "runs" array has to be flat,
+		with string and number values only, which is all the writer produces.
+	*/
+	inline std::vector<FRAME_RESULT> read_frame_json(std::istream& in) {
+		std::stringstream ss;
+		ss << in.rdbuf();
+		const std::string text = ss.str();
+
+		size_t pos = text.find("\"runs\"");
+		if (pos == std::string::npos || (pos = text.find('[', pos)) == std::string::npos)
+			throw std::runtime_error("no runs in the benchmark results!");
+
+		std::vector<FRAME_RESULT> results;
+		while ((pos = text.find_first_of("{]", pos)) != std::string::npos && text[pos] == '{') {
+			const size_t end = text.find('}', pos);
+			if (end == std::string::npos)
+				throw std::runtime_error("unterminated run in the benchmark results!");
+
+			std::map<std::string, std::string> fields;
+			size_t k = pos + 1;
+			while ((k = text.find('"', k)) != std::string::npos && k < end) {
+				const size_t key_end = text.find('"', k + 1);
+				const std::string key = text.substr(k + 1, key_end - k - 1);
+				size_t v = text.find(':', key_end) + 1;
+				while (v < end && std::isspace(static_cast<unsigned char>(text[v]))) v++;
+				size_t v_end;
+				if (text[v] == '"') {
+					v_end = text.find('"', v + 1);
+					fields[key] = text.substr(v + 1, v_end - v - 1);
+					v_end++;
+				}
+				else {
+					v_end = text.find_first_of(",}", v);
+					fields[key] = text.substr(v, v_end - v);
+				}
+				k = v_end;
+			}
+
+			const auto number = [&](const char* key) {
+				const auto it = fields.find(key);
+				return it == fields.end() ? 0.0 : std::strtod(it->second.c_str(), nullptr);
+			};
+			FRAME_RESULT r;
+			r.config.scene = fields["scene"];
+			r.config.width = static_cast<UINT>(number("width"));
+			r.config.height = static_cast<UINT>(number("height"));
+			r.config.samples_per_pixel = static_cast<int>(number("spp"));
+			r.config.threads = static_cast<UINT>(number("threads"));
+			r.wall_ms = number("wall_ms");
+			r.mrays_per_s = number("mrays_per_s");
+			r.msamples_per_s = number("msamples_per_s");
+			r.peak_rss_mb = number("peak_rss_mb");
+			r.scaling_efficiency = number("scaling_efficiency");
+			results.push_back(r);
+			pos = end + 1;
+		}
+		return results;
+	}
+
+	/*
+		Prints every run that is slower than its baseline run (same scene, size,
+		spp and thread count) by more than threshold, as a fraction of the
+		baseline Mrays/s; runs without a baseline are skipped. Returns the
+		number of regressions.
+	*/
+	inline int compare_frame_results(std::ostream& out, const std::vector<FRAME_RESULT>& baseline,
+		const std::vector<FRAME_RESULT>& current, double threshold)
+	{
+		std::map<std::string, const FRAME_RESULT*> by_key;
+		for (const FRAME_RESULT& r : baseline)
+			by_key[r.config.key()] = &r;
+
+		int regressions = 0;
+		out << "Against the baseline, threshold " << std::fixed << std::setprecision(1) << 100.0 * threshold << "%\n";
+		for (const FRAME_RESULT& r : current) {
+			const auto it = by_key.find(r.config.key());
+			if (it == by_key.end() || it->second->mrays_per_s <= 0.0) continue;
+			const double change = r.mrays_per_s / it->second->mrays_per_s - 1.0;
+			const bool regressed = change < -threshold;
+			regressions += regressed;
+			out << std::setw(36) << std::left << r.config.key() << std::right
+				<< std::setw(10) << std::setprecision(2) << it->second->mrays_per_s
+				<< " -> " << std::setw(8) << r.mrays_per_s << " Mrays/s"
+				<< std::setw(9) << std::setprecision(1) << std::showpos << 100.0 * change << '%' << std::noshowpos
+				<< (regressed ? "  REGRESSION" : "") << '\n';
+		}
+		out << std::defaultfloat;
+		return regressions;
+	}
+
+	struct FRAME_OPTIONS {
+		std::string json;		// results are written here when not empty
+		std::string baseline;	// results are compared against this file when not empty
+		double threshold = 0.05;
+		bool quick = false;
+	};
+
+	/*
+		Whole-frame benchmark: renders every standard configuration, prints a
+		table, optionally writes the results as JSON and compares them against a
+		baseline. The exit code is 1 if any run regressed, so a CI job can gate
+		on it.
+	*/
+	inline int run_frames(const FRAME_OPTIONS& options) {
+#ifdef ENABLE_POOL
+		std::vector<FRAME_RESULT> baseline;
+		if (!options.baseline.empty()) {
+			std::ifstream in(options.baseline);
+			if (!in) {
+				std::cerr << "cannot open " << options.baseline << '\n';
+				return 2;
+			}
+			baseline = read_frame_json(in);
+		}
+
+		std::cout << std::setw(36) << std::left << "configuration" << std::right
+			<< std::setw(11) << "wall ms"
+			<< std::setw(10) << "Mrays/s"
+			<< std::setw(12) << "Msamples/s"
+			<< std::setw(10) << "RSS MB"
+			<< std::setw(10) << "scaling" << '\n';
+
+		std::vector<FRAME_RESULT> results;
+		std::map<std::string, std::shared_ptr<const frozen_scene>> scenes;
+		double single_thread_ms = 0.0;
+		for (const FRAME_CONFIG& config : frame_configs(options.quick)) {
+			auto& world = scenes[config.scene];
+			if (!world)
+				world = frame_scene(config.scene);
+
+			FRAME_RESULT r = run_frame(config, world);
+			// frame_configs lists the thread counts of a scene and size in ascending order, from 1
+			if (config.threads == 1)
+				single_thread_ms = r.wall_ms;
+			r.scaling_efficiency = single_thread_ms / (config.threads * r.wall_ms);
+			results.push_back(r);
+
+			std::cout << std::setw(36) << std::left << config.key() << std::right << std::fixed
+				<< std::setw(11) << std::setprecision(1) << r.wall_ms
+				<< std::setw(10) << std::setprecision(2) << r.mrays_per_s
+				<< std::setw(12) << r.msamples_per_s
+				<< std::setw(10) << std::setprecision(1) << r.peak_rss_mb
+				<< std::setw(9) << std::setprecision(0) << 100.0 * r.scaling_efficiency << '%' << '\n'
+				<< std::defaultfloat;
+		}
+
+		if (!options.json.empty()) {
+			std::ofstream out(options.json);
+			write_frame_json(out, results);
+			if (!out) {
+				std::cerr << "cannot write " << options.json << '\n';
+				return 2;
+			}
+		}
+
+		if (options.baseline.empty())
+			return 0;
+		const int regressions = compare_frame_results(std::cout, baseline, results, options.threshold);
+		std::cout << regressions << " regression(s)\n";
+		return regressions > 0 ? 1 : 0;
+#else
+		(void)options;
+		std::cerr << "the frame benchmark renders on the thread pool, build with ENABLE_POOL\n";
+		return 2;
+#endif
+	}
+}
+}
+
+#endif //!FRAMEBENCHMARK_HPP
@@ -0,0 +1,115 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include "ImageWriter.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace raytracer {
+
+	/*
+		Render target of the CPU backends: per-pixel sample sums as three floats,
+		in tile_size x tile_size tiles stored one after the other, each starting
+		on a cache line of its own. The tile backends render whole tiles of the
+		same size (make_morton_tiles with tile_size()), so every cache line is
+		written by one worker only; in a row-major image the rows of two
+		neighbouring tiles meet inside a line. The image writers take the image
+		a scanline at a time from resolve_row.
+	*/
+	class framebuffer {
+	public:
+		static constexpr size_t cache_line = 64;
+
+		framebuffer(unsigned int width, unsigned int height, unsigned int tile_size = 32)
+			: m_width(width), m_height(height), m_tile_size(tile_size > 0 ? tile_size : 32)
+		{
+			m_tiles_x = (m_width + m_tile_size - 1) / m_tile_size;
+			m_tiles_y = (m_height + m_tile_size - 1) / m_tile_size;
+			// edge tiles are stored whole, so a tile's pixels are found the same way everywhere
+			const size_t floats = 3 * static_cast<size_t>(m_tile_size) * m_tile_size;
+			m_tile_lines = (floats * sizeof(float) + cache_line - 1) / cache_line;
+			m_lines.resize(m_tile_lines * m_tiles_x * m_tiles_y);
+		}
+
+		unsigned int width() const { return m_width; }
+		unsigned int height() const { return m_height; }
+		unsigned int tile_size() const { return m_tile_size; }
+		size_t pixel_count() const { return static_cast<size_t>(m_width) * m_height; }
+		size_t memory_bytes() const { return m_lines.size() * cache_line; }
+
+		// pixel (i, j), row 0 at the bottom like the render loops
+		void set(unsigned int i, unsigned int j, const color& c) {
+			float* p = pixel(i, j);
+			p[0] = static_cast<float>(c.x());
+			p[1] = static_cast<float>(c.y());
+			p[2] = static_cast<float>(c.z());
+		}
+
+		color get(unsigned int i, unsigned int j) const {
+			const float* p = pixel(i, j);
+			return color(p[0], p[1], p[2]);
+		}
+
+		void clear() { std::fill(m_lines.begin(), m_lines.end(), CACHE_LINE{}); }
+
+		// scanline j as 3 * width() floats; a tile's row is contiguous, so one copy per tile
+		void resolve_row(unsigned int j, float* dst) const {
+			for (unsigned int tx = 0; tx < m_tiles_x; tx++) {
+				const unsigned int x0 = tx * m_tile_size;
+				const unsigned int n = std::min(m_tile_size, m_width - x0);
+				std::memcpy(dst + 3 * static_cast<size_t>(x0), pixel(x0, j), 3 * n * sizeof(float));
+			}
+		}
+
+		// the reverse of resolve_row, for backends that produce scanlines
+		void load_row(unsigned int j, const float* src) {
+			for (unsigned int tx = 0; tx < m_tiles_x; tx++) {
+				const unsigned int x0 = tx * m_tile_size;
+				const unsigned int n = std::min(m_tile_size, m_width - x0);
+				std::memcpy(pixel(x0, j), src + 3 * static_cast<size_t>(x0), 3 * n * sizeof(float));
+			}
+		}
+
+		// same size and the same sums to the bit
+		bool same_pixels(const framebuffer& other) const {
+			if (m_width != other.m_width || m_height != other.m_height) return false;
+			std::vector<float> a(3 * static_cast<size_t>(m_width)), b(a.size());
+			for (unsigned int j = 0; j < m_height; j++) {
+				resolve_row(j, a.data());
+				other.resolve_row(j, b.data());
+				if (std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) != 0) return false;
+			}
+			return true;
+		}
+
+	private:
+		struct alignas(cache_line) CACHE_LINE {
+			float f[cache_line / sizeof(float)];
+		};
+
+		size_t offset(unsigned int i, unsigned int j) const {
+			const size_t t = static_cast<size_t>(j / m_tile_size) * m_tiles_x + i / m_tile_size;
+			const size_t k = static_cast<size_t>(j % m_tile_size) * m_tile_size + i % m_tile_size;
+			return t * m_tile_lines * (cache_line / sizeof(float)) + 3 * k;
+		}
+
+		float* pixel(unsigned int i, unsigned int j) { return reinterpret_cast<float*>(m_lines.data()) + offset(i, j); }
+		const float* pixel(unsigned int i, unsigned int j) const { return reinterpret_cast<const float*>(m_lines.data()) + offset(i, j); }
+
+		//member data
+		unsigned int m_width, m_height, m_tile_size;
+		unsigned int m_tiles_x, m_tiles_y;
+		size_t m_tile_lines;				// cache lines per tile
+		std::vector<CACHE_LINE> m_lines;	// over-aligned, so the vector allocates on a line boundary
+		//!member data
+	};
+
+	// the sums of fb as an image, resolved one scanline at a time
+	inline void write_image(std::ostream& out, image_format format, const framebuffer& fb, int samples_per_pixel) {
+		write_image(out, format, [&fb](unsigned int j, float* dst) { fb.resolve_row(j, dst); },
+			fb.width(), fb.height(), samples_per_pixel);
+	}
+}
+
+#endif //!FRAMEBUFFER_HPP
@@ -2,6 +2,9 @@
 #define HITTABLE_HPP
 
 #include "Ray.hpp"
+#include "Aabb.hpp"
+#include "Counters.hpp"
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -12,8 +15,9 @@ namespace raytracer {
     struct hit_record {
         point3 p;
         vec3 normal;
-        std::shared_ptr<material> mat_ptr;
-        double t{};
+        // non-owning: copying a hit_record must not touch a reference count
+        const material* mat_ptr{};
+        real t{};
         bool front_face{};
 
         inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -22,9 +26,20 @@ namespace raytracer {
         }
     };
 
+    /*
+        How far a bounced ray's origin goes off a surface at p. Bounced rays are
+        traced from t_min = 0, and the rounding error of a hit point grows with
+        its coordinates, so the offset does too.
+    */
+    inline real surface_offset(const point3& p) {
+        return real(1e-5) * std::max({ real(1), std::fabs(p.x()), std::fabs(p.y()), std::fabs(p.z()) });
+    }
+
     class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        // returns false when the object has no finite bounds
+        virtual bool bounding_box(aabb& output_box) const = 0;
     };
 
     class hittable_list : public hittable {
@@ -36,6 +51,7 @@ namespace raytracer {
         void add(std::shared_ptr<hittable> object) { objects.push_back(object); }
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
 
     public:
         std::vector<std::shared_ptr<hittable>> objects;
@@ -56,6 +72,19 @@ namespace raytracer {
 
         return hit_anything;
     }
+
+    bool hittable_list::bounding_box(aabb& output_box) const {
+        if (objects.empty()) return false;
+
+        aabb temp_box;
+        output_box = aabb();
+        for (const auto& object : objects) {
+            if (!object->bounding_box(temp_box)) return false;
+            output_box.expand(temp_box);
+        }
+
+        return true;
+    }
 }
 
 #endif //!HITTABLE_HPP
\ No newline at end of file
@@ -0,0 +1,253 @@
+#ifndef IMAGEWRITER_HPP
+#define IMAGEWRITER_HPP
+
+#include "Vec3.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace raytracer {
+
+	enum class image_format {
+		P3,		// ASCII PPM, one text line per pixel
+		P6,		// binary PPM, 8 bits per channel
+		PFM		// portable float map, linear 32-bit float per channel
+	};
+
+	// file extension the format is expected to be written to
+	inline const char* image_extension(image_format format) {
+		return format == image_format::PFM ? "pfm" : "ppm";
+	}
+
+	/*
+		Source of an image's pixels for the writers: fills dst with row j (0 at
+		the bottom) as 3 * width floats, the per-pixel sample sums. The writers
+		ask for one row at a time, so a tiled buffer (see framebuffer) is
+		resolved into scanlines on the way out and never copied whole.
+	*/
+	using row_reader = std::function<void(unsigned int j, float* dst)>;
+
+	/*
+		Averages the samples, applies gamma 2 and quantizes to [0,255] for one
+		scanline. The body is branch-free (min/max instead of clamp's ifs), so the
+		compiler can vectorize the whole row.
+	*/
+	inline void quantize_row(const float* row, unsigned int width, double scale, unsigned char* dst) {
+		for (unsigned int i = 0; i < 3 * width; i++) {
+			const double v = std::sqrt(scale * row[i]);
+			dst[i] = static_cast<unsigned char>(256 * std::min(std::max(v, 0.0), 0.999));
+		}
+	}
+
+	// header of a P6 or PFM file; a negative PFM scale marks little-endian data
+	inline std::string image_header(image_format format, unsigned int width, unsigned int height) {
+		const std::string size = std::to_string(width) + " " + std::to_string(height);
+		return format == image_format::PFM ? "PF\n" + size + "\n-1.0\n" : "P6\n" + size + "\n255\n";
+	}
+
+	// bytes of one encoded P6 or PFM scanline; every scanline has the same size
+	inline size_t scanline_bytes(image_format format, unsigned int width) {
+		return 3 * static_cast<size_t>(width) * (format == image_format::PFM ? sizeof(float) : 1);
+	}
+
+	// one scanline of sums as P6 bytes or PFM floats, dst holds scanline_bytes
+	inline void encode_scanline(image_format format, const float* row, unsigned int width, double scale, char* dst) {
+		if (format == image_format::P6) {
+			quantize_row(row, width, scale, reinterpret_cast<unsigned char*>(dst));
+			return;
+		}
+		for (unsigned int i = 0; i < 3 * width; i++) {
+			const float v = static_cast<float>(scale * row[i]);
+			std::memcpy(dst + i * sizeof(float), &v, sizeof(float));
+		}
+	}
+
+	/*
+		Byte offset of scanline j (0 at the bottom) in a P6 or PFM file. PPM wants
+		the top row first, PFM stores the bottom row first, which is the render
+		buffers' own order.
+	*/
+	inline size_t scanline_offset(image_format format, unsigned int width, unsigned int height, unsigned int j) {
+		const size_t row = format == image_format::PFM ? j : height - 1 - j;
+		return image_header(format, width, height).size() + row * scanline_bytes(format, width);
+	}
+
+	/*
+		A whole P6 or PFM file in one block, so the file goes out in a single
+		write; the output stage (see output_stage) writes the same bytes a band
+		of scanlines at a time.
+	*/
+	inline std::vector<char> encode_image(image_format format, const row_reader& rows, unsigned int width, unsigned int height, int samples_per_pixel) {
+		const std::string header = image_header(format, width, height);
+		const size_t row_bytes = scanline_bytes(format, width);
+
+		std::vector<char> data(header.size() + row_bytes * height);
+		std::memcpy(data.data(), header.data(), header.size());
+
+		const double scale = 1.0 / samples_per_pixel;
+		std::vector<float> line(3 * static_cast<size_t>(width));
+		for (unsigned int j = 0; j < height; j++) {
+			rows(j, line.data());
+			encode_scanline(format, line.data(), width, scale, data.data() + scanline_offset(format, width, height, j));
+		}
+		return data;
+	}
+
+	// the original text writer: one stringstream and one stream write per pixel
+	inline void write_p3(std::ostream& out, const row_reader& rows, unsigned int width, unsigned int height, int samples_per_pixel) {
+		std::stringstream ss;
+
+		ss << "P3\n" << width << " " << height << " \n255\n";
+		out.write(ss.str().c_str(), ss.str().size());
+		ss.str(std::string());
+
+		std::vector<float> line(3 * static_cast<size_t>(width));
+		for (int j = height - 1; j >= 0; j--) {
+			rows(j, line.data());
+			for (unsigned int i = 0; i < width; i++) {
+				double r = line[3 * i + 0];
+				double g = line[3 * i + 1];
+				double b = line[3 * i + 2];
+
+				// Divide the color by the number of samples.
+				auto scale = 1.0 / samples_per_pixel;
+				r = std::sqrt(scale * r);
+				g = std::sqrt(scale * g);
+				b = std::sqrt(scale * b);
+
+				// Write the translated [0,255] value of each color component.
+				ss << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
+					<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
+					<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+
+				out.write(ss.str().c_str(), ss.str().size());
+
+				ss.str(std::string());
+			}
+		}
+	}
+
+	// the stream has to be opened in binary mode for P6 and PFM
+	inline void write_image(std::ostream& out, image_format format, const row_reader& rows,
+		unsigned int width, unsigned int height, int samples_per_pixel)
+	{
+		if (format == image_format::P3) {
+			write_p3(out, rows, width, height, samples_per_pixel);
+			return;
+		}
+
+		const std::vector<char> data = encode_image(format, rows, width, height, samples_per_pixel);
+		out.write(data.data(), data.size());
+		out.flush();
+	}
+
+	// a row-major buffer of colors, e.g. write_heatmap's
+	inline void write_image(std::ostream& out, image_format format, const color* buff,
+		unsigned int width, unsigned int height, int samples_per_pixel)
+	{
+		const row_reader rows = [buff, width](unsigned int j, float* dst) {
+			const color* row = buff + static_cast<size_t>(j) * width;
+			for (unsigned int i = 0; i < width; i++) {
+				dst[3 * i + 0] = static_cast<float>(row[i].x());
+				dst[3 * i + 1] = static_cast<float>(row[i].y());
+				dst[3 * i + 2] = static_cast<float>(row[i].z());
+			}
+		};
+		write_image(out, format, rows, width, height, samples_per_pixel);
+	}
+
+	// decoded PFM, bottom row first like the render buffers, 3 floats per pixel
+	struct pfm_image {
+		unsigned int width = 0;
+		unsigned int height = 0;
+		std::vector<float> pixels;
+	};
+
+	// reads a color PFM as written by encode_image; the stream has to be opened in binary mode
+	inline pfm_image read_pfm(std::istream& in) {
+		std::string magic;
+		double scale = 0.0;
+		pfm_image img;
+		in >> magic >> img.width >> img.height >> scale;
+		if (!in || magic != "PF")
+			throw std::runtime_error("not a color PFM image!");
+		in.get(); // the single whitespace between header and data
+
+		img.pixels.resize(3 * static_cast<size_t>(img.width) * img.height);
+		in.read(reinterpret_cast<char*>(img.pixels.data()), img.pixels.size() * sizeof(float));
+		if (!in)
+			throw std::runtime_error("truncated PFM image!");
+
+		// a positive scale marks big-endian data
+		if (scale > 0.0) {
+			for (float& f : img.pixels) {
+				char* bytes = reinterpret_cast<char*>(&f);
+				std::reverse(bytes, bytes + sizeof(float));
+			}
+		}
+		return img;
+	}
+
+	struct IMAGE_DIFF {
+		double rmse;			// root mean square error over all channels of the block averages
+		double max_error;		// largest absolute channel difference of the block averages
+		double bias;			// mean signed difference, test - reference
+		double mean_reference;	// mean channel value of the reference, to put the errors into scale
+	};
+
+	/*
+		Per-channel difference of two linear images of the same size, e.g. the
+		PFM of an RT_FLOAT build against the one of a double build. Two renders
+		decorrelate after a few bounces as soon as one rounding differs, so the
+		raw pixels only differ by their sampling noise; both images are averaged
+		over block x block tiles first, which keeps systematic errors (acne, light
+		leaking, a darker mean) and removes most of the noise.
+	*/
+	inline IMAGE_DIFF compare_images(const pfm_image& reference, const pfm_image& test, unsigned int block = 8) {
+		if (reference.width != test.width || reference.height != test.height)
+			throw std::runtime_error("images differ in size!");
+		block = std::max(block, 1u);
+
+		IMAGE_DIFF diff{ 0.0, 0.0, 0.0, 0.0 };
+		size_t nblocks = 0;
+		for (unsigned int by = 0; by < reference.height; by += block) {
+			for (unsigned int bx = 0; bx < reference.width; bx += block) {
+				const unsigned int ey = std::min(by + block, reference.height);
+				const unsigned int ex = std::min(bx + block, reference.width);
+				double ref_sum[3] = {}, test_sum[3] = {};
+				for (unsigned int y = by; y < ey; y++) {
+					for (unsigned int x = bx; x < ex; x++) {
+						const size_t k = 3 * (static_cast<size_t>(y) * reference.width + x);
+						for (int c = 0; c < 3; c++) {
+							ref_sum[c] += reference.pixels[k + c];
+							test_sum[c] += test.pixels[k + c];
+						}
+					}
+				}
+				const double area = static_cast<double>(ey - by) * (ex - bx);
+				for (int c = 0; c < 3; c++) {
+					const double e = (test_sum[c] - ref_sum[c]) / area;
+					diff.rmse += e * e;
+					diff.max_error = std::max(diff.max_error, std::fabs(e));
+					diff.bias += e;
+					diff.mean_reference += ref_sum[c] / area;
+				}
+				nblocks += 3;
+			}
+		}
+		if (nblocks > 0) {
+			diff.rmse = std::sqrt(diff.rmse / nblocks);
+			diff.bias /= nblocks;
+			diff.mean_reference /= nblocks;
+		}
+		return diff;
+	}
+}
+
+#endif //!IMAGEWRITER_HPP
\ No newline at end of file
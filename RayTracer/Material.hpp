@@ -2,49 +2,138 @@
 #define MATERIAL_HPP
 
 #include "Hittable.hpp"
+#include "Counters.hpp"
+#include <algorithm>
 
 namespace raytracer {
 	struct hit_record;
 
-	class material {
-	public:
-		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+	// parameters of a material, the form scene files and the device backends store it in
+	struct MATERIAL_DESCRIPTOR {
+		material_kind kind = material_kind::lambertian;
+		color albedo{ 1.0, 1.0, 1.0 };	// emissive: the radiance it emits
+		real fuzz = 0;					// metal: radius of the blur added to reflections, 0 = mirror
+		real ior = 1;					// dielectric: index of refraction
 	};
 
-	class lambertian : public material {
-	public:
-		lambertian(const color& a) : albedo(a) {}
+	/*
+		Scatter functions of the material kinds. material::scatter switches
+		between them; they are free functions so a benchmark can run the very
+		same code through virtual calls.
+	*/
+	inline bool scatter_lambertian(const MATERIAL_DESCRIPTOR& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+		auto scatter_direction = rec.normal + random_unit_vector();
+
+		// Catch degenerate scatter direction
+		if (scatter_direction.near_zero())
+			scatter_direction = rec.normal;
+
+		scattered = ray(rec.p, scatter_direction);
+		attenuation = m.albedo;
+		RT_COUNT_SCATTER(lambertian, false);
+		return true;
+	}
+
+	inline bool scatter_metal(const MATERIAL_DESCRIPTOR& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+		// a mirror draws no random numbers
+		if (m.fuzz > 0)
+			reflected += m.fuzz * random_in_unit_sphere();
+		scattered = ray(rec.p, reflected);
+		attenuation = m.albedo;
+		// reflected into the surface, i.e. absorbed
+		const bool outward = dot(scattered.direction(), rec.normal) > 0;
+		RT_COUNT_SCATTER(metal, !outward);
+		return outward;
+	}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-			auto scatter_direction = rec.normal + random_unit_vector();
+	// Schlick's approximation of the share of light a dielectric reflects
+	inline real reflectance(real cosine, real ratio) {
+		real r0 = (1 - ratio) / (1 + ratio);
+		r0 = r0 * r0;
+		return r0 + (1 - r0) * std::pow(1 - cosine, 5);
+	}
 
-			// Catch degenerate scatter direction
-			if (scatter_direction.near_zero())
-				scatter_direction = rec.normal;
+	/*
+		Reflects or refracts, picked at random by the reflectance. Bounced rays
+		are traced from t_min = 0, so the new origin is moved off the surface to
+		the side the ray leaves on; otherwise a refracted ray would hit the
+		surface it just went through. The offset is ten surface_offsets, so a
+		refracted ray also gets past a mesh hit point, which sits one
+		surface_offset in front of the surface (triangle_mesh::surface_record).
+	*/
+	inline bool scatter_dielectric(const MATERIAL_DESCRIPTOR& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+		const real offset = 10 * surface_offset(rec.p);
+		const real ratio = rec.front_face ? 1 / m.ior : m.ior;
+		const vec3 unit = unit_vector(r_in.direction());
+		const real cos_theta = std::min(-dot(unit, rec.normal), real(1));
+		const real sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
-			scattered = ray(rec.p, scatter_direction);
-			attenuation = albedo;
-			return true;
+		// total internal reflection draws no random number
+		if (ratio * sin_theta > 1 || reflectance(cos_theta, ratio) > random_real())
+			scattered = ray(rec.p + offset * rec.normal, reflect(unit, rec.normal));
+		else
+			scattered = ray(rec.p - offset * rec.normal, refract(unit, rec.normal, ratio));
+		attenuation = m.albedo;
+		RT_COUNT_SCATTER(dielectric, false);
+		return true;
+	}
+
+	/*
+		A material is a tagged record rather than a class hierarchy: scatter()
+		switches on the kind, so shading a hit costs no virtual call, and the
+		materials of a scene sit one after the other in its material_arena.
+		The subclasses only name the kinds' constructors and add no members,
+		so any of them can be stored as a plain material.
+	*/
+	class material {
+	public:
+		explicit material(const MATERIAL_DESCRIPTOR& desc) : m_desc(desc) {}
+
+		bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+			switch (m_desc.kind) {
+			case material_kind::metal: return scatter_metal(m_desc, r_in, rec, attenuation, scattered);
+			case material_kind::dielectric: return scatter_dielectric(m_desc, r_in, rec, attenuation, scattered);
+			case material_kind::emissive: return false;
+			default: return scatter_lambertian(m_desc, r_in, rec, attenuation, scattered);
+			}
 		}
+
+		// a path that hits an emissive material ends there with emitted()
+		bool emits() const { return m_desc.kind == material_kind::emissive; }
+		color emitted() const { return emits() ? m_desc.albedo : color{ 0, 0, 0 }; }
+
+		material_kind kind() const { return m_desc.kind; }
+		const MATERIAL_DESCRIPTOR& describe() const { return m_desc; }
+
 	private:
-		color albedo;
+		//member data
+		MATERIAL_DESCRIPTOR m_desc;
+		//!member data
 	};
 
+	class lambertian : public material {
+	public:
+		lambertian(const color& a) : material({ material_kind::lambertian, a }) {}
+	};
+
+	// fuzz is clamped to 1, beyond that most reflections would go into the surface
 	class metal : public material {
 	public:
-		metal(const color& a) : albedo(a) {}
-
-		virtual bool scatter(
-			const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-		) const override {
-			vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-			scattered = ray(rec.p, reflected);
-			attenuation = albedo;
-			return (dot(scattered.direction(), rec.normal) > 0);
-		}
-	private:
-		color albedo;
+		metal(const color& a, real fuzz = 0) : material({ material_kind::metal, a, std::min(fuzz, real(1)) }) {}
+	};
+
+	// glass, water, ...; the tint is multiplied onto every bounce
+	class dielectric : public material {
+	public:
+		dielectric(real ior, const color& tint = color{ 1.0, 1.0, 1.0 }) : material({ material_kind::dielectric, tint, 0, ior }) {}
+	};
+
+	// a light: emits radiance and scatters nothing
+	class emissive : public material {
+	public:
+		emissive(const color& radiance) : material({ material_kind::emissive, radiance }) {}
 	};
 }
 
-#endif MATERIAL_HPP
\ No newline at end of file
+#endif //!MATERIAL_HPP
@@ -0,0 +1,296 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "Bvh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace raytracer {
+
+	struct MESH_VERTEX {
+		float p[3];
+	};
+
+	/*
+		bvh_node with the box in single precision, rounded outwards so that it
+		still contains its triangles: 32 bytes instead of bvh_node's 56 (48 in
+		RT_FLOAT builds).
+	*/
+	struct MESH_NODE {
+		float min[3];
+		uint32_t offset;	// leaf: index of the first triangle, interior: index of the second child
+		float max[3];
+		uint16_t count;		// number of triangles in a leaf, 0 for interior nodes
+		uint16_t axis;		// split axis of an interior node
+	};
+
+	/*
+		Indexed triangle mesh with one material. A triangle is three indices into
+		the mesh's vertex buffer, so a vertex shared by six triangles is stored
+		once; build() adds a bvh of the mesh's own and puts the triangles in its
+		leaf order. Memory per triangle once built, for a closed mesh (about half
+		as many vertices as triangles):
+			indices		12 bytes
+			vertices	 6 bytes (12 per vertex)
+			bvh			16 bytes (32 per node, about one node per two triangles)
+		34 bytes in all, where a hittable per triangle in a hittable_list costs
+		well over 100. Intersection is the watertight test of Woop, Benthin and
+		Wald (JCGT 2013): a ray through an edge or vertex shared by two triangles
+		hits at least one of them, so there are no cracks between triangles.
+	*/
+	class triangle_mesh : public hittable {
+	public:
+		triangle_mesh() = default;
+		explicit triangle_mesh(const material* mat) : m_material(mat) {}
+
+		void reserve(size_t vertices, size_t triangles) {
+			m_vertices.reserve(vertices);
+			m_indices.reserve(3 * triangles);
+		}
+
+		uint32_t add_vertex(const point3& p) {
+			m_vertices.push_back({ { static_cast<float>(p.x()), static_cast<float>(p.y()), static_cast<float>(p.z()) } });
+			return static_cast<uint32_t>(m_vertices.size() - 1);
+		}
+
+		// counter-clockwise seen from the front
+		void add_triangle(uint32_t a, uint32_t b, uint32_t c) {
+			m_indices.push_back(a);
+			m_indices.push_back(b);
+			m_indices.push_back(c);
+		}
+
+		// direct access for bulk loaders; every index must be below the vertex count before build()
+		std::vector<MESH_VERTEX>& vertices() { return m_vertices; }
+		std::vector<uint32_t>& indices() { return m_indices; }
+		const std::vector<MESH_VERTEX>& vertices() const { return m_vertices; }
+		const std::vector<uint32_t>& indices() const { return m_indices; }
+
+		size_t vertex_count() const { return m_vertices.size(); }
+		size_t triangle_count() const { return m_indices.size() / 3; }
+		const material* mat_ptr() const { return m_material; }
+		void set_material(const material* mat) { m_material = mat; }
+
+		size_t memory_bytes() const {
+			return m_vertices.capacity() * sizeof(MESH_VERTEX) + m_indices.capacity() * sizeof(uint32_t)
+				+ m_nodes.capacity() * sizeof(MESH_NODE);
+		}
+
+		// builds the bvh; the triangles are reordered, the vertices stay as they are
+		void build() {
+			const size_t n = triangle_count();
+			std::vector<aabb> boxes(n);
+			for (size_t i = 0; i < n; i++) {
+				for (int k = 0; k < 3; k++)
+					boxes[i].expand(vertex(m_indices[3 * i + k]));
+			}
+			const bvh_tree tree(boxes);
+
+			std::vector<uint32_t> sorted(m_indices.size());
+			for (size_t i = 0; i < n; i++) {
+				for (int k = 0; k < 3; k++)
+					sorted[3 * i + k] = m_indices[3 * tree.order()[i] + k];
+			}
+			m_indices.swap(sorted);
+
+			m_nodes.clear();
+			m_nodes.reserve(tree.nodes().size());
+			for (const bvh_node& node : tree.nodes()) {
+				MESH_NODE compact;
+				const point3 bmin = node.box.min(), bmax = node.box.max();
+				const real lo[3] = { bmin.x(), bmin.y(), bmin.z() }, hi[3] = { bmax.x(), bmax.y(), bmax.z() };
+				for (int a = 0; a < 3; a++) {
+					compact.min[a] = round_down(lo[a]);
+					compact.max[a] = round_up(hi[a]);
+				}
+				compact.offset = node.offset;
+				compact.count = node.count;
+				compact.axis = node.axis;
+				m_nodes.push_back(compact);
+			}
+			m_bounds = tree.bounds();
+		}
+
+		/*
+			Closest triangle beyond t_min; on success closest is lowered to its
+			distance and tri receives the triangle, like sphere_pack::hit_range.
+		*/
+		bool closest_hit(const ray& r, real t_min, real& closest, uint32_t& tri) const {
+			if (m_nodes.empty()) return false;
+			const WOOP_RAY w = woop_ray(r);
+			const vec3 d = r.direction();
+			const real inv[3] = { 1 / d.x(), 1 / d.y(), 1 / d.z() };
+
+			uint32_t stack[bvh_tree::stack_size];
+			int sp = 0;
+			uint32_t current = 0;
+			bool hit_anything = false;
+			while (true) {
+				const MESH_NODE& node = m_nodes[current];
+				RT_COUNT(box_tests);
+				if (hit_node(node, w.origin, inv, t_min, closest)) {
+					if (node.count > 0) {
+						RT_COUNT_N(primitive_tests, node.count);
+						for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+							if (hit_triangle(w, k, t_min, closest)) {
+								tri = k;
+								hit_anything = true;
+							}
+						}
+					}
+					else {
+						// near child first, as bvh_tree::traverse
+						const bool neg = inv[node.axis] < 0;
+						stack[sp++] = neg ? current + 1 : node.offset;
+						current = neg ? node.offset : current + 1;
+						continue;
+					}
+				}
+				if (sp == 0) break;
+				current = stack[--sp];
+			}
+			return hit_anything;
+		}
+
+		// unit normal of triangle tri, on the side its vertices run counter-clockwise
+		vec3 face_normal(uint32_t tri) const {
+			const point3 a = vertex(m_indices[3 * tri]);
+			const point3 b = vertex(m_indices[3 * tri + 1]);
+			const point3 c = vertex(m_indices[3 * tri + 2]);
+			return unit_vector(cross(b - a, c - a));
+		}
+
+		// fills rec for a hit at distance t on triangle tri, see surface_record
+		void fill_record(const ray& r, uint32_t tri, real t, hit_record& rec) const {
+			surface_record(r, t, face_normal(tri), m_material, rec);
+		}
+
+		/*
+			Fills rec for a hit at distance t on a flat surface. Bounced rays start
+			at t_min = 0, so the hit point is moved off the surface to the side the
+			ray came from by surface_offset; otherwise it could hit its own triangle
+			again. A ray that goes through (scatter_dielectric) moves back by more.
+		*/
+		static void surface_record(const ray& r, real t, const vec3& outward_normal, const material* mat, hit_record& rec) {
+			rec.t = t;
+			rec.set_face_normal(r, outward_normal);
+			const point3 p = r.at(t);
+			rec.p = p + surface_offset(p) * rec.normal;
+			rec.mat_ptr = mat;
+		}
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			real closest = static_cast<real>(t_max);
+			uint32_t tri;
+			if (!closest_hit(r, static_cast<real>(t_min), closest, tri))
+				return false;
+			fill_record(r, tri, closest, rec);
+			return true;
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			if (m_nodes.empty()) return false;
+			output_box = m_bounds;
+			return true;
+		}
+
+	private:
+		// a ray's constants of the watertight test: the axis it is most aligned with and the shear onto it
+		struct WOOP_RAY {
+			real origin[3];
+			int kx, ky, kz;
+			real sx, sy, sz;
+		};
+
+		static WOOP_RAY woop_ray(const ray& r) {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const real dir[3] = { d.x(), d.y(), d.z() };
+			WOOP_RAY w{ { o.x(), o.y(), o.z() } };
+			const real ax = std::fabs(dir[0]), ay = std::fabs(dir[1]), az = std::fabs(dir[2]);
+			w.kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+			w.kx = (w.kz + 1) % 3;
+			w.ky = (w.kx + 1) % 3;
+			// keeps the winding, and with it the sign of the edge functions
+			if (dir[w.kz] < 0) std::swap(w.kx, w.ky);
+			w.sx = dir[w.kx] / dir[w.kz];
+			w.sy = dir[w.ky] / dir[w.kz];
+			w.sz = 1 / dir[w.kz];
+			return w;
+		}
+
+		bool hit_triangle(const WOOP_RAY& w, uint32_t tri, real t_min, real& closest) const {
+			const float* v[3] = { m_vertices[m_indices[3 * tri]].p, m_vertices[m_indices[3 * tri + 1]].p, m_vertices[m_indices[3 * tri + 2]].p };
+			// vertices relative to the ray origin, sheared so the ray runs along +z
+			real x[3], y[3], z[3];
+			for (int k = 0; k < 3; k++) {
+				const real rel[3] = { v[k][0] - w.origin[0], v[k][1] - w.origin[1], v[k][2] - w.origin[2] };
+				x[k] = rel[w.kx] - w.sx * rel[w.kz];
+				y[k] = rel[w.ky] - w.sy * rel[w.kz];
+				z[k] = rel[w.kz];
+			}
+			// edge functions, all of one sign inside the triangle
+			real e0 = x[2] * y[1] - y[2] * x[1];
+			real e1 = x[0] * y[2] - y[0] * x[2];
+			real e2 = x[1] * y[0] - y[1] * x[0];
+			// on an edge in single precision: the paper's fallback, the edge functions again in double
+			if constexpr (std::is_same<real, float>::value) {
+				if (e0 == 0 || e1 == 0 || e2 == 0) {
+					e0 = static_cast<real>(double(x[2]) * y[1] - double(y[2]) * x[1]);
+					e1 = static_cast<real>(double(x[0]) * y[2] - double(y[0]) * x[2]);
+					e2 = static_cast<real>(double(x[1]) * y[0] - double(y[1]) * x[0]);
+				}
+			}
+			if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+				return false;
+			const real det = e0 + e1 + e2;
+			if (det == 0)
+				return false;
+			const real t = w.sz * (e0 * z[0] + e1 * z[1] + e2 * z[2]) / det;
+			if (t < t_min || closest < t)
+				return false;
+			closest = t;
+			return true;
+		}
+
+		static bool hit_node(const MESH_NODE& node, const real org[3], const real inv[3], real t_min, real t_max) {
+			for (int a = 0; a < 3; a++) {
+				real t0 = (node.min[a] - org[a]) * inv[a];
+				real t1 = (node.max[a] - org[a]) * inv[a];
+				if (inv[a] < 0) std::swap(t0, t1);
+				t_min = t0 > t_min ? t0 : t_min;
+				t_max = t1 < t_max ? t1 : t_max;
+				if (t_max < t_min) return false;
+			}
+			return true;
+		}
+
+		point3 vertex(uint32_t i) const {
+			const float* p = m_vertices[i].p;
+			return point3(p[0], p[1], p[2]);
+		}
+
+		static float round_down(real x) {
+			const float f = static_cast<float>(x);
+			return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+		}
+
+		static float round_up(real x) {
+			const float f = static_cast<float>(x);
+			return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+		}
+
+		//member data
+		std::vector<MESH_VERTEX> m_vertices;
+		std::vector<uint32_t> m_indices;	// 3 per triangle, in bvh leaf order after build()
+		std::vector<MESH_NODE> m_nodes;
+		aabb m_bounds;
+		const material* m_material = nullptr;
+		//!member data
+	};
+}
+
+#endif //!MESH_HPP
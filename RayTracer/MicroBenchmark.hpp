@@ -0,0 +1,457 @@
+#ifndef MICROBENCHMARK_HPP
+#define MICROBENCHMARK_HPP
+
+#include "Benchmark.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace raytracer {
+namespace bench {
+
+	// keeps the compiler from optimizing away a result nobody reads
+	template<typename T>
+	inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile char sink;
+		sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+	}
+
+	struct MICRO_RESULT {
+		std::string name;
+		uint64_t iterations;
+		double ns_per_op;
+		double rays_per_op;	// 0 when the case traces no rays
+	};
+
+	/*
+		Google Benchmark style runner: body(n) performs the operation n times.
+		n grows until one run takes min_ms, then the run is repeated and the
+		median time per op is reported, so a preempted run does not skew it.
+	*/
+	template<typename Body>
+	MICRO_RESULT run_case(const std::string& name, double rays_per_op, Body&& body) {
+		constexpr double min_ms = 50.0;
+		constexpr int repetitions = 5;
+		timer t;
+
+		uint64_t n = 1;
+		while (true) {
+			t.reset();
+			body(n);
+			const double ms = t.elapsed();
+			if (ms >= min_ms || n >= (uint64_t(1) << 40)) break;
+			n = ms > 0.0 ? std::max(2 * n, static_cast<uint64_t>(1.2 * n * min_ms / ms)) : 10 * n;
+		}
+
+		std::vector<double> ns(repetitions);
+		for (double& r : ns) {
+			t.reset();
+			body(n);
+			r = t.elapsed() * 1e6 / n;
+		}
+		std::sort(ns.begin(), ns.end());
+		return { name, n, ns[repetitions / 2], rays_per_op };
+	}
+
+	// the four spheres main renders
+	inline hittable_list default_world() {
+		auto material_ground = std::make_shared<lambertian>(color(0.8, 0.8, 0.0));
+		auto material_center = std::make_shared<lambertian>(color(0.7, 0.3, 0.3));
+		auto material_left = std::make_shared<metal>(color(0.8, 0.8, 0.8));
+		auto material_right = std::make_shared<metal>(color(0.8, 0.6, 0.2));
+
+		hittable_list world;
+		world.add(std::make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
+		world.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
+		world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+		world.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+		return world;
+	}
+
+	// camera rays through random points of a 400x225 image
+	inline std::vector<ray> camera_rays(const camera1& cam, size_t count, unsigned int seed = 13) {
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<real> uv(0, 1);
+		std::vector<ray> rays(count);
+		for (ray& r : rays)
+			r = cam.get_ray(uv(gen), uv(gen));
+		return rays;
+	}
+
+	// closed sphere of 2 * segments * (segments / 2 - 1) triangles, as an OBJ exporter would write it
+	inline triangle_mesh uv_sphere_mesh(const point3& center, real radius, uint32_t segments, const material* mat) {
+		const uint32_t rings = segments / 2;
+		triangle_mesh mesh(mat);
+		mesh.reserve(2 + segments * (rings - 1), 2 * segments * (rings - 1));
+		const uint32_t north = mesh.add_vertex(center + vec3(0, radius, 0));
+		for (uint32_t r = 1; r < rings; r++) {
+			const real theta = static_cast<real>(pi * r / rings);
+			for (uint32_t s = 0; s < segments; s++) {
+				const real phi = static_cast<real>(2 * pi * s / segments);
+				mesh.add_vertex(center + radius * vec3(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi)));
+			}
+		}
+		const uint32_t south = mesh.add_vertex(center - vec3(0, radius, 0));
+		const auto at = [=](uint32_t r, uint32_t s) { return 1 + (r - 1) * segments + s % segments; };
+		for (uint32_t s = 0; s < segments; s++) {
+			mesh.add_triangle(north, at(1, s), at(1, s + 1));
+			for (uint32_t r = 1; r + 1 < rings; r++) {
+				mesh.add_triangle(at(r, s), at(r + 1, s), at(r + 1, s + 1));
+				mesh.add_triangle(at(r, s), at(r + 1, s + 1), at(r, s + 1));
+			}
+			mesh.add_triangle(south, at(rings - 1, s + 1), at(rings - 1, s));
+		}
+		return mesh;
+	}
+
+	/*
+		count copies of one uv_sphere_mesh, randomly turned and scaled, spread
+		over the same cube as random_spheres(count); the mesh is stored once.
+	*/
+	inline std::shared_ptr<const frozen_scene> instanced_scene(size_t count, uint32_t segments, unsigned int seed = 7) {
+		std::mt19937 gen(seed);
+		const double side = 2.0 * std::cbrt(static_cast<double>(count));
+		std::uniform_real_distribution<real> coord(static_cast<real>(-side / 2), static_cast<real>(side / 2));
+		std::uniform_real_distribution<real> unit(0, 1);
+
+		scene builder;
+		const material* mat = builder.add_material<lambertian>(color(0.5, 0.5, 0.5));
+		const uint32_t mesh = builder.add_mesh(uv_sphere_mesh(point3(0.0, 0.0, 0.0), 0.4, segments, mat));
+		for (size_t i = 0; i < count; i++) {
+			const vec3 axis(unit(gen) - real(0.5), unit(gen) - real(0.5), unit(gen) + real(0.1));
+			builder.add_instance(mesh, affine_transform::translate(vec3(coord(gen), coord(gen), coord(gen)))
+				* affine_transform::rotate(axis, 360 * unit(gen)) * affine_transform::scale(vec3(1, real(0.5) + unit(gen), 1)));
+		}
+		return builder.freeze();
+	}
+
+	/*
+		Materials as they were before they became tagged records: one heap
+		object per material, shaded through a virtual call. They run the same
+		scatter functions as material::scatter, so the scatter cases measure
+		dispatch and memory layout and nothing else.
+	*/
+	class virtual_material {
+	public:
+		virtual ~virtual_material() = default;
+		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+	};
+
+	template<material_kind Kind>
+	class virtual_kind : public virtual_material {
+	public:
+		explicit virtual_kind(const MATERIAL_DESCRIPTOR& desc) : m_desc(desc) {}
+
+		virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+			if constexpr (Kind == material_kind::metal)
+				return scatter_metal(m_desc, r_in, rec, attenuation, scattered);
+			else if constexpr (Kind == material_kind::dielectric)
+				return scatter_dielectric(m_desc, r_in, rec, attenuation, scattered);
+			else if constexpr (Kind == material_kind::emissive)
+				return false;
+			else
+				return scatter_lambertian(m_desc, r_in, rec, attenuation, scattered);
+		}
+
+	private:
+		//member data
+		MATERIAL_DESCRIPTOR m_desc;
+		//!member data
+	};
+
+	inline std::unique_ptr<virtual_material> make_virtual_material(const MATERIAL_DESCRIPTOR& desc) {
+		switch (desc.kind) {
+		case material_kind::metal: return std::make_unique<virtual_kind<material_kind::metal>>(desc);
+		case material_kind::dielectric: return std::make_unique<virtual_kind<material_kind::dielectric>>(desc);
+		case material_kind::emissive: return std::make_unique<virtual_kind<material_kind::emissive>>(desc);
+		default: return std::make_unique<virtual_kind<material_kind::lambertian>>(desc);
+		}
+	}
+
+	/*
+		count materials, every kind but emissive in turn (mirror and fuzzy
+		metal), and nhits hits on them in random order. The hits' rays come in
+		against the normal, on the outside of every other surface.
+	*/
+	struct SHADING_SET {
+		std::vector<MATERIAL_DESCRIPTOR> materials;
+		std::vector<uint32_t> material;		// per hit
+		std::vector<ray> rays;
+		std::vector<hit_record> hits;
+	};
+
+	inline SHADING_SET shading_set(size_t count, size_t nhits, unsigned int seed = 23) {
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<double> unit(0, 1), coord(-1, 1);
+		const auto direction = [&]() {
+			while (true) {
+				const vec3 v(coord(gen), coord(gen), coord(gen));
+				if (v.length_squared() > 0.01 && v.length_squared() < 1) return unit_vector(v);
+			}
+		};
+
+		SHADING_SET set;
+		for (size_t m = 0; m < count; m++) {
+			MATERIAL_DESCRIPTOR desc;
+			desc.albedo = color(unit(gen), unit(gen), unit(gen));
+			switch (m % 4) {
+			case 1: desc.kind = material_kind::metal; break;
+			case 2: desc.kind = material_kind::metal; desc.fuzz = static_cast<real>(unit(gen)); break;
+			case 3: desc.kind = material_kind::dielectric; desc.ior = real(1.5); break;
+			default: break;
+			}
+			set.materials.push_back(desc);
+		}
+		std::uniform_int_distribution<uint32_t> pick(0, static_cast<uint32_t>(count - 1));
+		for (size_t k = 0; k < nhits; k++) {
+			hit_record rec;
+			rec.p = point3(coord(gen), coord(gen), coord(gen));
+			const vec3 outward = direction();
+			const vec3 jitter = direction();
+			const vec3 d = 0.5 * jitter - outward;
+			const ray r(rec.p - d, d);
+			rec.set_face_normal(r, k % 2 ? outward : -1 * outward);
+			set.material.push_back(pick(gen));
+			set.rays.push_back(r);
+			set.hits.push_back(rec);
+		}
+		return set;
+	}
+
+	/*
+		One case per hot path of the renderer. A case's name can be passed to
+		run_micro as a filter (substring match), e.g. "ray_color" runs the three
+		depths only.
+	*/
+	inline std::vector<std::pair<std::string, std::function<MICRO_RESULT()>>> micro_cases() {
+		constexpr size_t nrays = 1024; // power of two, the bodies wrap with & (nrays - 1)
+		std::vector<std::pair<std::string, std::function<MICRO_RESULT()>>> cases;
+
+		cases.emplace_back("sphere::hit", [=]() {
+			sphere s(point3(0.0, 0.0, 0.0), 0.4, std::make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+			const std::vector<ray> rays = random_rays(nrays, 1);
+			return run_case("sphere::hit", 1.0, [&](uint64_t n) {
+				hit_record rec;
+				for (uint64_t k = 0; k < n; k++)
+					keep(s.hit(rays[k & (nrays - 1)], 0.001, infinity, rec));
+				keep(rec);
+			});
+		});
+
+		// the sphere above as a mesh of about 16k triangles
+		cases.emplace_back("triangle_mesh::hit", [=]() {
+			const lambertian mat(color(0.5, 0.5, 0.5));
+			triangle_mesh mesh = uv_sphere_mesh(point3(0.0, 0.0, 0.0), 0.4, 128, &mat);
+			mesh.build();
+			const std::vector<ray> rays = random_rays(nrays, 1);
+			return run_case("triangle_mesh::hit", 1.0, [&](uint64_t n) {
+				hit_record rec;
+				for (uint64_t k = 0; k < n; k++)
+					keep(mesh.hit(rays[k & (nrays - 1)], 0.001, infinity, rec));
+				keep(rec);
+			});
+		});
+
+		// that mesh placed once by a transform, the MESH_INSTANCE path of frozen_scene
+		cases.emplace_back("frozen_scene::hit/placed_mesh", [=]() {
+			scene builder;
+			const material* mat = builder.add_material<lambertian>(color(0.5, 0.5, 0.5));
+			const uint32_t mesh = builder.add_mesh(uv_sphere_mesh(point3(0.0, 0.0, 0.0), 0.4, 128, mat));
+			builder.add_instance(mesh, affine_transform::rotate(vec3(0, 1, 0), 30) * affine_transform::scale(vec3(1, 1.5, 1)));
+			const std::shared_ptr<const frozen_scene> world = builder.freeze();
+			const std::vector<ray> rays = random_rays(nrays, 1);
+			return run_case("frozen_scene::hit/placed_mesh", 1.0, [&](uint64_t n) {
+				hit_record rec;
+				for (uint64_t k = 0; k < n; k++)
+					keep(world->hit(rays[k & (nrays - 1)], 0.001, infinity, rec));
+				keep(rec);
+			});
+		});
+
+		// two-level traversal: the same mesh once, and instanced over a scene as large as random_spheres(4096)
+		for (size_t count : { size_t(1), size_t(4096) }) {
+			const std::string name = "frozen_scene::hit/instances:" + std::to_string(count);
+			cases.emplace_back(name, [=]() {
+				const std::shared_ptr<const frozen_scene> world = instanced_scene(count, 64);
+				const std::vector<ray> rays = random_rays(nrays, count);
+				return run_case(name, 1.0, [&](uint64_t n) {
+					hit_record rec;
+					for (uint64_t k = 0; k < n; k++)
+						keep(world->hit(rays[k & (nrays - 1)], 0.001, infinity, rec));
+					keep(rec);
+				});
+			});
+		}
+
+		for (size_t count : { size_t(4), size_t(64) }) {
+			const std::string name = "hittable_list::hit/" + std::to_string(count);
+			cases.emplace_back(name, [=]() {
+				const hittable_list list = count == 4 ? default_world()
+					: random_spheres(count, std::make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+				const std::vector<ray> rays = count == 4 ? camera_rays(camera1(CAM_DESCRIPTOR{}), nrays) : random_rays(nrays, count);
+				return run_case(name, 1.0, [&](uint64_t n) {
+					hit_record rec;
+					for (uint64_t k = 0; k < n; k++)
+						keep(list.hit(rays[k & (nrays - 1)], 0.001, infinity, rec));
+					keep(rec);
+				});
+			});
+		}
+
+		for (int depth : { 1, 5, 50 }) {
+			const std::string name = "ray_color/depth:" + std::to_string(depth);
+			cases.emplace_back(name, [=]() {
+				const hittable_list world = default_world();
+				const std::vector<ray> rays = camera_rays(camera1(CAM_DESCRIPTOR{}), nrays);
+
+				// rays per call = average path length, measured on the same rays
+				thread_rng().seed(1, 1);
+				uint64_t segments = 0;
+				for (const ray& r : rays) {
+					int path_length;
+					keep(ray_color(r, world, depth, 3, path_length));
+					segments += path_length;
+				}
+				return run_case(name, static_cast<double>(segments) / nrays, [&](uint64_t n) {
+					int path_length;
+					for (uint64_t k = 0; k < n; k++)
+						keep(ray_color(rays[k & (nrays - 1)], world, depth, 3, path_length));
+				});
+			});
+		}
+
+		cases.emplace_back("random_unit_vector", [=]() {
+			return run_case("random_unit_vector", 0.0, [&](uint64_t n) {
+				for (uint64_t k = 0; k < n; k++)
+					keep(random_unit_vector());
+			});
+		});
+
+		cases.emplace_back("camera1::get_ray", [=]() {
+			const camera1 cam(CAM_DESCRIPTOR{});
+			return run_case("camera1::get_ray", 1.0, [&](uint64_t n) {
+				const real step = real(1) / 4096;
+				for (uint64_t k = 0; k < n; k++)
+					keep(cam.get_ray((k & 4095) * step, ((k >> 12) & 4095) * step));
+			});
+		});
+
+		// a 32x32 tile of primary rays per call, as render_tile_packets generates them
+		cases.emplace_back("camera1::get_rays", [=]() {
+			const camera1 cam(CAM_DESCRIPTOR{});
+			ray_batch batch;
+			batch.resize(1024);
+			for (size_t k = 0; k < batch.size(); k++) {
+				batch.s[k] = (k & 31) / real(31);
+				batch.t[k] = (k >> 5) / real(31);
+			}
+			return run_case("camera1::get_rays", static_cast<double>(batch.size()), [&](uint64_t n) {
+				for (uint64_t k = 0; k < n; k++) {
+					cam.get_rays(batch);
+					keep(batch.dz[k & 1023]);
+				}
+			});
+		});
+
+		// shading throughput: the switch of material::scatter against a virtual call per hit
+		for (size_t count : { size_t(4), size_t(256) }) {
+			const std::string switch_name = "material::scatter/" + std::to_string(count);
+			cases.emplace_back(switch_name, [=]() {
+				const SHADING_SET set = shading_set(count, nrays);
+				std::vector<material> table(set.materials.begin(), set.materials.end());
+				std::vector<const material*> mats;
+				for (uint32_t m : set.material)
+					mats.push_back(&table[m]);
+				thread_rng().seed(1, 1);
+				return run_case(switch_name, 1.0, [&](uint64_t n) {
+					color attenuation;
+					ray scattered;
+					for (uint64_t k = 0; k < n; k++) {
+						const size_t h = k & (nrays - 1);
+						keep(mats[h]->scatter(set.rays[h], set.hits[h], attenuation, scattered));
+						keep(scattered);
+					}
+				});
+			});
+
+			const std::string virtual_name = "virtual_material::scatter/" + std::to_string(count);
+			cases.emplace_back(virtual_name, [=]() {
+				const SHADING_SET set = shading_set(count, nrays);
+				std::vector<std::unique_ptr<virtual_material>> objects;
+				for (const MATERIAL_DESCRIPTOR& desc : set.materials)
+					objects.push_back(make_virtual_material(desc));
+				std::vector<const virtual_material*> mats;
+				for (uint32_t m : set.material)
+					mats.push_back(objects[m].get());
+				thread_rng().seed(1, 1);
+				return run_case(virtual_name, 1.0, [&](uint64_t n) {
+					color attenuation;
+					ray scattered;
+					for (uint64_t k = 0; k < n; k++) {
+						const size_t h = k & (nrays - 1);
+						keep(mats[h]->scatter(set.rays[h], set.hits[h], attenuation, scattered));
+						keep(scattered);
+					}
+				});
+			});
+		}
+
+		for (image_format format : { image_format::P6, image_format::PFM }) {
+			const std::string name = std::string("write_img_buff/") + (format == image_format::P6 ? "P6" : "PFM");
+			cases.emplace_back(name, [=]() {
+				STATS_DESCRIPTOR sdesc = {};
+				sdesc.image_width = 400;
+				sdesc.image_height = 225;
+				sdesc.samples_per_pixel = 100;
+				ADRENALINE_DESCRIPTOR adesc;
+				adesc.world = std::make_shared<hittable_list>(default_world());
+				adesc.format = format;
+				adesc.foutput = std::string("bench_micro.") + image_extension(format);
+				adrenaline adr(adesc, sdesc);
+
+				framebuffer fb(sdesc.image_width, sdesc.image_height);
+				std::mt19937 gen(17);
+				std::uniform_real_distribution<real> value(0, 100);
+				for (UINT j = 0; j < sdesc.image_height; j++)
+					for (UINT i = 0; i < sdesc.image_width; i++)
+						fb.set(i, j, color(value(gen), value(gen), value(gen)));
+				return run_case(name, 0.0, [&](uint64_t n) {
+					for (uint64_t k = 0; k < n; k++)
+						adr.write_img_buff(fb);
+				});
+			});
+		}
+
+		return cases;
+	}
+
+	inline int run_micro(const std::string& filter = "") {
+		std::cout << std::setw(28) << std::left << "case" << std::right
+			<< std::setw(14) << "iterations"
+			<< std::setw(14) << "ns/op"
+			<< std::setw(14) << "Mrays/s" << '\n';
+
+		for (auto& [name, run] : micro_cases()) {
+			if (name.find(filter) == std::string::npos) continue;
+			const MICRO_RESULT result = run();
+			std::cout << std::setw(28) << std::left << result.name << std::right
+				<< std::setw(14) << result.iterations
+				<< std::setw(14) << std::fixed << std::setprecision(1) << result.ns_per_op;
+			if (result.rays_per_op > 0)
+				std::cout << std::setw(14) << std::setprecision(2) << result.rays_per_op * 1e3 / result.ns_per_op;
+			else
+				std::cout << std::setw(14) << "-";
+			std::cout << '\n' << std::defaultfloat;
+		}
+		return 0;
+	}
+}
+}
+
+#endif //!MICROBENCHMARK_HPP
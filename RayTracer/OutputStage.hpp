@@ -0,0 +1,230 @@
+#ifndef OUTPUTSTAGE_HPP
+#define OUTPUTSTAGE_HPP
+
+#include "Framebuffer.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace raytracer {
+
+	/*
+		Bounded multi-producer multi-consumer queue without locks (Vyukov): every
+		cell carries a sequence number that tells a producer whether the cell is
+		free and a consumer whether it is filled, so a push or pop is one
+		compare-exchange on the tail or head. The capacity is rounded up to a
+		power of two.
+	*/
+	template<typename T>
+	class bounded_queue {
+	public:
+		explicit bounded_queue(size_t capacity) {
+			size_t n = 2;
+			while (n < capacity) n *= 2;
+			m_cells = std::make_unique<CELL[]>(n);
+			m_mask = n - 1;
+			for (size_t i = 0; i < n; i++)
+				m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		bounded_queue(const bounded_queue&) = delete;
+		bounded_queue& operator=(const bounded_queue&) = delete;
+
+		size_t capacity() const { return m_mask + 1; }
+
+		// false when the queue is full
+		bool try_push(const T& value) {
+			size_t pos = m_tail.load(std::memory_order_relaxed);
+			while (true) {
+				CELL& cell = m_cells[pos & m_mask];
+				const size_t seq = cell.sequence.load(std::memory_order_acquire);
+				const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - pos);
+				if (diff == 0) {
+					if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						cell.value = value;
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		// false when the queue is empty
+		bool try_pop(T& value) {
+			size_t pos = m_head.load(std::memory_order_relaxed);
+			while (true) {
+				CELL& cell = m_cells[pos & m_mask];
+				const size_t seq = cell.sequence.load(std::memory_order_acquire);
+				const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+				if (diff == 0) {
+					if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						value = cell.value;
+						// the cell is free again one lap later
+						cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		struct alignas(64) CELL {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		//member data
+		std::unique_ptr<CELL[]> m_cells;
+		size_t m_mask = 0;
+		alignas(64) std::atomic<size_t> m_head{ 0 };	// producers and the consumer on lines of their own
+		alignas(64) std::atomic<size_t> m_tail{ 0 };
+		//!member data
+	};
+
+	/*
+		Writes a P6 or PFM image while it is being rendered. The render threads
+		push every finished tile (or scanline, as a tile one pixel high) into a
+		bounded_queue; a writer thread counts the pixels done per scanline and,
+		as soon as scanlines are complete, encodes them from the framebuffer and
+		writes them at their offset in the file. Scanlines of both formats have
+		a fixed size, so bands can go out in any order and only the last band
+		is left when the render ends: the time to the last byte is the render
+		time plus the encoding of one band.
+	*/
+	class output_stage {
+	public:
+		static constexpr size_t queue_capacity = 1024;
+
+		// writes the header; out has to be opened in binary mode and is the writer's until finish()
+		output_stage(std::ostream& out, image_format format, const framebuffer& fb, int samples_per_pixel)
+			: m_out(out), m_format(format), m_fb(fb), m_scale(1.0 / samples_per_pixel),
+			m_row_pixels(fb.height(), 0), m_queue(queue_capacity)
+		{
+			const std::string header = image_header(format, fb.width(), fb.height());
+			m_out.seekp(0);
+			m_out.write(header.data(), header.size());
+			m_writer = std::thread(&output_stage::writer_loop, this);
+		}
+
+		output_stage(const output_stage&) = delete;
+		output_stage& operator=(const output_stage&) = delete;
+
+		~output_stage() { finish(); }
+
+		// called by the render threads once every pixel of t is in the framebuffer
+		void push(const tile& t) {
+			while (!m_queue.try_push(t))
+				std::this_thread::yield();
+		}
+
+		/*
+			Waits for the writer after the last push and flushes. True when every
+			scanline was written; false after an incomplete render or a failed
+			stream, in which case the image is to be written again as a whole.
+		*/
+		bool finish() {
+			if (m_writer.joinable()) {
+				m_closing.store(true, std::memory_order_release);
+				m_writer.join();
+				m_out.flush();
+			}
+			return m_rows_written == m_fb.height() && m_out.good();
+		}
+
+	private:
+		static constexpr std::chrono::microseconds min_idle{ 50 };
+		static constexpr std::chrono::microseconds max_idle{ 2000 };
+
+		/*
+			Sleeps while the queue is empty, twice as long every time up to 2ms:
+			waking every few microseconds would take a core from the render
+			threads, the cost is at most 2ms more to the last byte.
+		*/
+		void writer_loop() {
+			tile t;
+			std::chrono::microseconds idle = min_idle;
+			while (m_rows_written < m_fb.height()) {
+				if (m_queue.try_pop(t)) {
+					add(t);
+					idle = min_idle;
+					continue;
+				}
+				if (m_closing.load(std::memory_order_acquire)) {
+					// every push happened before closing was set
+					while (m_queue.try_pop(t))
+						add(t);
+					return;
+				}
+				std::this_thread::sleep_for(idle);
+				idle = std::min(2 * idle, max_idle);
+			}
+		}
+
+		// counts t's pixels and writes the scanlines it completes, one block per contiguous run
+		void add(const tile& t) {
+			const unsigned int width = m_fb.width();
+			unsigned int first = t.y1;
+			for (unsigned int j = t.y0; j < t.y1; j++) {
+				m_row_pixels[j] += t.x1 - t.x0;
+				if (m_row_pixels[j] < width) {
+					if (first < j) write_rows(first, j);
+					first = t.y1;
+				}
+				else if (first == t.y1)
+					first = j;
+			}
+			if (first < t.y1) write_rows(first, t.y1);
+		}
+
+		// scanlines [j0, j1) in one write, the top one first in a P6
+		void write_rows(unsigned int j0, unsigned int j1) {
+			const unsigned int width = m_fb.width(), height = m_fb.height();
+			const size_t row_bytes = scanline_bytes(m_format, width);
+			m_line.resize(3 * static_cast<size_t>(width));
+			m_block.resize((j1 - j0) * row_bytes);
+
+			const unsigned int first_in_file = m_format == image_format::PFM ? j0 : j1 - 1;
+			const size_t start = scanline_offset(m_format, width, height, first_in_file);
+			for (unsigned int j = j0; j < j1; j++) {
+				m_fb.resolve_row(j, m_line.data());
+				encode_scanline(m_format, m_line.data(), width, m_scale,
+					m_block.data() + (scanline_offset(m_format, width, height, j) - start));
+			}
+			m_out.seekp(static_cast<std::streamoff>(start));
+			m_out.write(m_block.data(), m_block.size());
+			m_rows_written += j1 - j0;
+		}
+
+		//member data
+		std::ostream& m_out;
+		image_format m_format;
+		const framebuffer& m_fb;
+		double m_scale;
+
+		// the writer's own
+		std::vector<unsigned int> m_row_pixels;
+		std::vector<float> m_line;
+		std::vector<char> m_block;
+		unsigned int m_rows_written = 0;
+
+		bounded_queue<tile> m_queue;
+		std::atomic<bool> m_closing{ false };
+		std::thread m_writer;
+		//!member data
+	};
+}
+
+#endif //!OUTPUTSTAGE_HPP
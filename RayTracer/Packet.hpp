@@ -0,0 +1,50 @@
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include "Ray.hpp"
+#include <cstdint>
+
+namespace raytracer {
+
+	/*
+		N rays stored as structure of arrays, traced together through the bvh: every
+		node is fetched once for the whole packet and visited when any of its active
+		rays can hit it. Works best for coherent rays, e.g. camera rays of
+		neighbouring pixels.
+	*/
+	template<int N>
+	struct ray_packet {
+		static constexpr int size = N;
+		static constexpr uint32_t no_hit = 0xffffffffu;
+
+		real ox[N]{}, oy[N]{}, oz[N]{};
+		real dx[N]{}, dy[N]{}, dz[N]{};
+		real inv_dx[N]{}, inv_dy[N]{}, inv_dz[N]{};
+		real t[N]{};			// closest hit found so far
+		uint32_t prim[N]{};		// primitive of that hit, no_hit if none
+		uint32_t part[N]{};		// the triangle within prim, if prim is a mesh instance
+		uint32_t active = 0;	// bit k set: lane k carries a ray
+
+		void set(int k, const ray& r, real t_max) {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			ox[k] = o.x(); oy[k] = o.y(); oz[k] = o.z();
+			dx[k] = d.x(); dy[k] = d.y(); dz[k] = d.z();
+			inv_dx[k] = 1 / d.x(); inv_dy[k] = 1 / d.y(); inv_dz[k] = 1 / d.z();
+			t[k] = t_max;
+			prim[k] = no_hit;
+			active |= 1u << k;
+		}
+
+		ray get(int k) const {
+			return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]));
+		}
+
+		bool hit(int k) const { return prim[k] != no_hit; }
+	};
+
+	// 8 rays: a row of 8 pixels, and one AVX-512 (double) or AVX (float) register per component
+	using ray_packet8 = ray_packet<8>;
+}
+
+#endif //!PACKET_HPP
\ No newline at end of file
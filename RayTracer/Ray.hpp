@@ -16,7 +16,7 @@ namespace raytracer {
 		vec3 direction() const { return m_dir; }
 
 		// Op
-		point3 at(double t) const {
+		point3 at(real t) const {
 			return m_origin + t * m_dir;
 		}
 
@@ -1,5 +1,8 @@
-﻿#define MT
+﻿// build configuration of the Visual Studio project; the CMake build passes its own
+#ifndef RAYTRACER_CMAKE
+#define MT
 	#define ENABLE_ASYNC
+	#define ENABLE_POOL
 
 //#define PAR_RENDER_WRITE
 
@@ -8,67 +11,268 @@
 	//#define ENABLE_KERNEL_CPU
 #define SYCL
 
+//#define BENCHMARK
+
+//#define RT_FLOAT
+//#define RT_COUNTERS
+#endif
+
 #include "Adrenaline.hpp"
+#include "SceneFile.hpp"
 #include "Sphere.hpp"
+#ifdef BENCHMARK
+	#include "MicroBenchmark.hpp"
+	#include "FrameBenchmark.hpp"
+#endif
 #include <array>
+#include <fstream>
+#include <string>
 
 using namespace raytracer;
 
-auto main() -> int {
+/*
+	--compare reference.pfm test.pfm [max_rmse]
+	Precision check of two renders of the same scene and seed, typically the PFM
+	of an RT_FLOAT build against the one of the default double build. Fails when
+	the RMSE of the 8x8 block averages exceeds max_rmse (default 0.01, in linear
+	radiance; see compare_images).
+*/
+static int compare_pfm(const std::string& reference, const std::string& test, double max_rmse) {
+	std::ifstream ref_file(reference, std::ios::in | std::ios::binary);
+	std::ifstream test_file(test, std::ios::in | std::ios::binary);
+	const IMAGE_DIFF diff = compare_images(read_pfm(ref_file), read_pfm(test_file));
 
-	// Image setup
-	raytracer::STATS_DESCRIPTOR sdesc = {};
-	sdesc.aspect_ratio = 16.0 / 9.0;
-	sdesc.image_width = 400;
-	sdesc.image_height = static_cast<int>(sdesc.image_width / sdesc.aspect_ratio);
-	sdesc.samples_per_pixel = 100;
-	sdesc.max_depth = 50;
-	sdesc.measurements.iteration_count = 0;
-	sdesc.measurements.elapsed = std::vector<double>(sdesc.measurements.iteration_count);
+	std::cout << "rmse:\t\t" << diff.rmse << "\nmax error:\t" << diff.max_error
+		<< "\nbias:\t\t" << diff.bias << "\nmean radiance:\t" << diff.mean_reference << std::endl;
+	if (diff.rmse > max_rmse) {
+		std::cout << "FAILED: rmse above " << max_rmse << std::endl;
+		return 1;
+	}
+	std::cout << "OK" << std::endl;
+	return 0;
+}
+
+auto main(int argc, char** argv) -> int {
+
+#ifdef BENCHMARK
+	// --micro [filter]: one case per hot function; otherwise the whole-renderer benchmarks
+	if (argc > 1 && std::string(argv[1]) == "--micro")
+		return bench::run_micro(argc > 2 ? argv[2] : "");
+	// --frame [--quick] [--json results.json] [--baseline base.json] [--threshold 0.05]: whole frames, exits 1 on a regression
+	if (argc > 1 && std::string(argv[1]) == "--frame") {
+		bench::FRAME_OPTIONS options;
+		for (int a = 2; a < argc; a++) {
+			const std::string arg = argv[a];
+			if (arg == "--quick")
+				options.quick = true;
+			else if (arg == "--json" && a + 1 < argc)
+				options.json = argv[++a];
+			else if (arg == "--baseline" && a + 1 < argc)
+				options.baseline = argv[++a];
+			else if (arg == "--threshold" && a + 1 < argc)
+				options.threshold = std::atof(argv[++a]);
+		}
+		return bench::run_frames(options);
+	}
+	return bench::run_all();
+#endif
+
+	std::string foutput = "output.ppm";
+	// progressive renders only keep checkpoints when asked to
+	std::string fcheckpoint;
+	std::string fheatmap;
+	std::string fscene;
+	std::string fsave_scene;
+	std::string sycl_device = "gpu";
+	double noise_threshold = 0.0;
+	std::string backend_arg;
+	bool stream_output = true;
+	for (int a = 1; a < argc; a++) {
+		const std::string arg = argv[a];
+		if (arg == "--compare" && a + 2 < argc)
+			return compare_pfm(argv[a + 1], argv[a + 2], a + 3 < argc ? std::stod(argv[a + 3]) : 0.01);
+		if (arg == "--output" && a + 1 < argc)
+			foutput = argv[++a];
+		if (arg == "--checkpoint" && a + 1 < argc)
+			fcheckpoint = argv[++a];
+		if (arg == "--sycl-device" && a + 1 < argc)
+			sycl_device = argv[++a];
+		if (arg == "--heatmap" && a + 1 < argc)
+			fheatmap = argv[++a];
+		if (arg == "--scene" && a + 1 < argc)
+			fscene = argv[++a];
+		if (arg == "--save-scene" && a + 1 < argc)
+			fsave_scene = argv[++a];
+		if (arg == "--noise" && a + 1 < argc)
+			noise_threshold = std::stod(argv[++a]);
+		if (arg == "--backend" && a + 1 < argc)
+			backend_arg = argv[++a];
+		if (arg == "--no-stream")
+			stream_output = false;
+	}
 
-	// World setup
-	hittable_list world;
+	// World setup: the built-in scene, or a scene file with its settings and camera
+	SCENE_FILE scene_file;
+	if (!fscene.empty()) {
+		try {
+			timer load;
+			load.reset();
+			scene_file = load_scene_file(fscene);
+			std::cerr << "scene: " << scene_file.world.sphere_count() << " spheres";
+			if (const size_t triangles = scene_file.world.triangle_count())
+				std::cerr << ", " << triangles << " triangles in " << scene_file.world.meshes().size() << " meshes placed "
+					<< scene_file.world.instances().size() << " times";
+			std::cerr << " loaded in " << load.elapsed() << "ms" << std::endl;
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+	else {
+		scene& world = scene_file.world;
 
-	auto material_ground = std::make_shared<lambertian>(color(0.8, 0.8, 0.0));
-	auto material_center = std::make_shared<lambertian>(color(0.7, 0.3, 0.3));
-	auto material_left	 = std::make_shared<metal>(color(0.8, 0.8, 0.8));
-	auto material_right  = std::make_shared<metal>(color(0.8, 0.6, 0.2));
+		auto material_ground = world.add_material<lambertian>(color(0.8, 0.8, 0.0));
+		auto material_center = world.add_material<lambertian>(color(0.7, 0.3, 0.3));
+		auto material_left	 = world.add_material<metal>(color(0.8, 0.8, 0.8));
+		auto material_right  = world.add_material<metal>(color(0.8, 0.6, 0.2));
 
-	world.add(std::make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-	world.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-	world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-	world.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+		world.add_sphere(point3(0.0, -100.5, -1.0), 100.0, material_ground);
+		world.add_sphere(point3(0.0, 0.0, -1.0), 0.5, material_center);
+		world.add_sphere(point3(-1.0, 0.0, -1.0), 0.5, material_left);
+		world.add_sphere(point3(1.0, 0.0, -1.0), 0.5, material_right);
+	}
+	if (!fsave_scene.empty()) {
+		try {
+			save_scene_file(fsave_scene, scene_file);
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	const RENDER_SETTINGS& settings = scene_file.settings;
+
+	// Image setup
+	raytracer::STATS_DESCRIPTOR sdesc = {};
+	sdesc.aspect_ratio = settings.aspect_ratio();
+	sdesc.image_width = settings.image_width;
+	sdesc.image_height = settings.image_height;
+	sdesc.samples_per_pixel = settings.samples_per_pixel;
+	sdesc.max_depth = settings.max_depth;
+	sdesc.rr_depth = settings.rr_depth;
+	sdesc.seed = settings.seed;
+	sdesc.tile_size = 32;
+	sdesc.thread_count = 0;
+	sdesc.noise_threshold = noise_threshold;
+	sdesc.min_samples = 16;
+	sdesc.max_samples = 4 * sdesc.samples_per_pixel;
+	sdesc.pass_samples = 10;
+	sdesc.preview_interval = 1;
+	sdesc.measurements.iteration_count = 1;
+	sdesc.measurements.elapsed = std::vector<double>(sdesc.measurements.iteration_count);
 
 	// Camera setup
-	raytracer::CAM_DESCRIPTOR camd;
+	CAM_DESCRIPTOR camd = scene_file.camera;
+	camd.aspect_ratio = static_cast<real>(sdesc.aspect_ratio);
 	camera1 cam(camd);
+	// where the animation starts, taken before the scene is frozen
+	const frame_sequence sequence(scene_file.animation, scene_file.world, camd);
 
 	// Rendering
 	raytracer::ADRENALINE_DESCRIPTOR adesc;
 	adesc.cam = cam;
+	timer freeze;
+	freeze.reset();
+	const std::shared_ptr<frozen_scene> world = scene_file.world.freeze();
 	adesc.world = world;
-	adesc.foutput = "output.ppm";
+	if (!fscene.empty())
+		std::cerr << "bvh built in " << freeze.elapsed() << "ms" << std::endl;
+	if (!world->instances().empty())
+		std::cerr << "meshes: " << world->geometry_bytes() / 1024 << " KiB with instances and top level bvh" << std::endl;
+	adesc.foutput = sequence.frames() > 1 ? frame_path(foutput, 0) : foutput;
+	adesc.fcheckpoint = fcheckpoint;
+	adesc.fheatmap = fheatmap;
+	adesc.sycl_device = sycl_device;
+	adesc.stream_output = stream_output;
+	adesc.format = foutput.substr(foutput.find_last_of('.') + 1) == "pfm" ? image_format::PFM : image_format::P6;
 
 	adrenaline adr(adesc, sdesc);
-#ifdef KERNEL
-	adr.initOpenCL();
-#elif defined(SYCL)
-	std::vector<color> buff(sdesc.img_size());
-	adr.initSycl(buff);
-#else // pure C++
 	#ifndef PAR_RENDER_WRITE
-		color* img_buff = new color[sdesc.img_size()];
-		std::fill(img_buff, img_buff + sdesc.img_size(), color{ 0, 0, 0 });
-		adr.render_w_future(&img_buff);
-		adr.write_img_buff(&img_buff);
-		delete[] img_buff;
+		backend render_backend = default_backend();
+		try {
+			if (!backend_arg.empty())
+				render_backend = parse_backend(backend_arg);
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		std::cerr << "backend: " << backend_name(render_backend) << std::endl;
+
+		framebuffer fb(sdesc.image_width, sdesc.image_height, sdesc.tile_size);
+		// an animation renders every frame into numbered files, with the same pool, world and trees
+		const uint32_t frames = sequence.frames();
+		double setup_total = 0.0, render_total = 0.0;
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			double setup_ms = 0.0;
+			if (frames > 1) {
+				timer setup;
+				setup.reset();
+				const CAM_DESCRIPTOR frame_camd = sequence.apply(frame, *world);
+				adr.begin_frame(camera1(frame_camd), frame_path(foutput, frame), fcheckpoint.empty() ? fcheckpoint : frame_path(fcheckpoint, frame));
+				setup_ms = setup.elapsed();
+			}
+
+			bool rendered = false;
+			try {
+				rendered = adr.render(render_backend, fb);
+				if (!rendered)
+					std::cerr << "backend " << backend_name(render_backend) << " is not part of this build" << std::endl;
+			}
+			catch (const std::exception& e) { // device backends: no device, kernel build errors, ...
+				std::cerr << e.what() << std::endl;
+			}
+			if (!rendered)
+				return 1;
+			adr.write_img_buff(fb);
+
+			if (frames > 1) {
+				const double render_ms = sdesc.measurements.elapsed[0];
+				std::cerr << "frame " << frame << ":\tsetup " << setup_ms << "ms\trender " << render_ms
+					<< "ms\tavg path length " << sdesc.measurements.avg_path_length
+					<< "\tsamples " << sdesc.measurements.samples_taken << std::endl;
+				setup_total += setup_ms;
+				render_total += render_ms;
+			}
+		}
+		if (frames > 1)
+			std::cerr << frames << " frames:\tsetup " << setup_total << "ms (" << setup_total / frames << "ms per frame)\trender "
+				<< render_total << "ms (" << render_total / frames << "ms per frame)" << std::endl;
 	#else
 		adr.render();
 	#endif
-#endif
+
+	// a sequence has its numbers per frame above, these would only be the last frame's
+	if (sequence.frames() > 1)
+		return 0;
 
 	std::cerr << "MEASUREMENT:\n";
 	for (double m : sdesc.measurements.elapsed)
 		std::cerr << "time: ...\t" << m << "ms" << std::endl;
+	std::cerr << "avg path length: " << sdesc.measurements.avg_path_length << std::endl;
+	std::cerr << "samples: " << sdesc.measurements.samples_taken << " taken, ";
+	if (sdesc.measurements.samples_resumed)
+		std::cerr << sdesc.measurements.samples_resumed << " resumed, ";
+	std::cerr << sdesc.measurements.samples_saved << " saved" << std::endl;
+	for (size_t i = 0; i < sdesc.measurements.worker_times.size(); i++) {
+		const WORKER_TIMES& wt = sdesc.measurements.worker_times[i];
+		std::cerr << "worker " << i << ":\tbusy " << wt.busy_ms << "ms\tidle " << wt.idle_ms
+			<< "ms\ttiles " << wt.tasks << " (" << wt.steals << " stolen)" << std::endl;
+	}
+#ifdef RT_COUNTERS
+	print_counters(std::cerr, sdesc.measurements.counters);
+#endif
 
 }
\ No newline at end of file
@@ -0,0 +1,364 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include "Bvh.hpp"
+#include "Material.hpp"
+#include "Mesh.hpp"
+#include "Sphere.hpp"
+#include "SpherePack.hpp"
+#include "Transform.hpp"
+#include <deque>
+
+namespace raytracer {
+
+	/*
+		Owns every material of a scene, the tagged records one after the other.
+		Primitives only keep the raw pointer returned by add(); a deque never
+		moves its elements, so it stays valid for the arena's lifetime and no
+		shared_ptr reference count is touched while rendering.
+	*/
+	class material_arena {
+	public:
+		material_arena() = default;
+		material_arena(material_arena&&) = default;
+		material_arena& operator=(material_arena&&) = default;
+
+		template<typename T, typename... Args>
+		const material* add(Args&&... args) {
+			static_assert(sizeof(T) == sizeof(material), "material kinds must not add members, they are stored as material");
+			m_materials.emplace_back(T(std::forward<Args>(args)...));
+			return &m_materials.back();
+		}
+
+		size_t size() const { return m_materials.size(); }
+
+	private:
+		//member data
+		std::deque<material> m_materials;
+		//!member data
+	};
+
+	// one placement of a mesh: the mesh stays in object space, the transform takes it to the world
+	struct MESH_INSTANCE {
+		affine_transform transform;
+		uint32_t mesh;
+	};
+
+	/*
+		Read-only scene adrenaline renders from. The spheres are packed into one
+		sphere_pack stored in bvh leaf order, so every leaf is a contiguous range
+		that the batch kernel tests in one go.
+
+		Meshes are stored once however often they are placed, each with a bvh of
+		its own (the bottom level). A second bvh over the world boxes of the
+		instances (the top level) finds the instances a ray may hit, and the ray
+		is taken to each one's object space to traverse its mesh. Memory grows
+		with the unique triangles; an instance costs its two matrices and a leaf
+		of the top level.
+
+		Primitive ids, as hit_packet reports them, number the spheres first and
+		then the instances; packet.part holds the triangle of an instance hit.
+
+		Between the frames of an animation (never while a render runs) spheres
+		and instances can be moved, by their index in the scene they were
+		frozen from; refit() then updates the boxes of both trees, the meshes
+		and their bottom levels stay as they are.
+	*/
+	class frozen_scene : public hittable {
+	public:
+		frozen_scene(material_arena&& materials, sphere_pack&& spheres,
+			std::vector<triangle_mesh>&& meshes = {}, std::vector<MESH_INSTANCE>&& instances = {})
+			: m_materials(std::move(materials)), m_spheres(std::move(spheres)),
+			m_meshes(std::move(meshes)), m_instances(std::move(instances))
+		{
+			std::vector<aabb> boxes(m_spheres.size());
+			for (size_t i = 0; i < m_spheres.size(); i++)
+				boxes[i] = m_spheres.sphere_box(i);
+			m_tree.build(boxes);
+			m_spheres.permute(m_tree.order());
+
+			for (triangle_mesh& mesh : m_meshes)
+				mesh.build();
+			std::vector<aabb> instance_boxes;
+			for (const MESH_INSTANCE& inst : m_instances)
+				instance_boxes.push_back(instance_box(inst));
+			// an instance costs a whole mesh traversal, so every leaf of the top level holds as few as it can
+			m_top.build(instance_boxes, 1);
+			std::vector<MESH_INSTANCE> sorted;
+			sorted.reserve(m_instances.size());
+			for (uint32_t i : m_top.order())
+				sorted.push_back(m_instances[i]);
+			m_instances.swap(sorted);
+		}
+
+		frozen_scene(const frozen_scene&) = delete;
+		frozen_scene& operator=(const frozen_scene&) = delete;
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			size_t index = 0;
+			real t = t_max;
+			bool hit_anything = m_tree.traverse(r, t_min, t_max,
+				[&](uint32_t first, uint32_t count, real tmin, real& closest) {
+					if (!m_spheres.hit_range(r, first, count, tmin, closest, index))
+						return false;
+					t = closest;
+					return true;
+				});
+
+			// the top level only looks behind the closest sphere
+			uint32_t inst = 0, tri = 0;
+			const bool hit_instance = m_top.traverse(r, t_min, t,
+				[&](uint32_t first, uint32_t count, real tmin, real& closest) {
+					if (!hit_instances(r, first, count, tmin, closest, inst, tri))
+						return false;
+					t = closest;
+					return true;
+				});
+			if (hit_instance) {
+				fill_instance_record(r, inst, tri, t, rec);
+				return true;
+			}
+			if (!hit_anything)
+				return false;
+
+			// the traversal only tracks distances, the record is built once for the winner
+			m_spheres.fill_record(r, index, t, rec);
+			return true;
+		}
+
+		// closest hit of every active lane; hits are reported through packet.t, packet.prim and packet.part
+		template<int N>
+		void hit_packet(ray_packet<N>& packet, real t_min) const {
+			m_tree.traverse_packet(packet, t_min,
+				[&](uint32_t first, uint32_t count, uint32_t lanes, real tmin) {
+					for (int k = 0; k < N; k++) {
+						if (!(lanes & (1u << k))) continue;
+						size_t index;
+						if (m_spheres.hit_range(packet.get(k), first, count, tmin, packet.t[k], index))
+							packet.prim[k] = static_cast<uint32_t>(index);
+					}
+				});
+			// the top level in packets, the meshes ray by ray: every instance takes the rays elsewhere
+			const uint32_t first_instance = static_cast<uint32_t>(m_spheres.size());
+			m_top.traverse_packet(packet, t_min,
+				[&](uint32_t first, uint32_t count, uint32_t lanes, real tmin) {
+					for (int k = 0; k < N; k++) {
+						if (!(lanes & (1u << k))) continue;
+						uint32_t inst, tri;
+						if (hit_instances(packet.get(k), first, count, tmin, packet.t[k], inst, tri)) {
+							packet.prim[k] = first_instance + inst;
+							packet.part[k] = tri;
+						}
+					}
+				});
+		}
+
+		// hit_record of a packet lane that hit something, as hit() would have returned it
+		void fill_record(const ray& r, uint32_t prim, uint32_t part, real t, hit_record& rec) const {
+			if (prim < m_spheres.size())
+				m_spheres.fill_record(r, prim, t, rec);
+			else
+				fill_instance_record(r, prim - static_cast<uint32_t>(m_spheres.size()), part, t, rec);
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			aabb box = m_tree.bounds();
+			if (!m_top.empty())
+				box.expand(m_top.bounds());
+			if (box.empty()) return false;
+			output_box = box;
+			return true;
+		}
+
+		// sphere is the index it had in the scene
+		void set_sphere_center(size_t sphere, const point3& center) {
+			m_spheres.set_center(slot_of(m_tree, m_sphere_slots, sphere), center);
+			m_spheres_moved = true;
+		}
+
+		// instance is the index it had in the scene
+		void set_instance_transform(size_t instance, const affine_transform& transform) {
+			m_instances[slot_of(m_top, m_instance_slots, instance)].transform = transform;
+			m_instances_moved = true;
+		}
+
+		// the boxes of the trees whose primitives moved since the last refit, see bvh_tree::refit
+		void refit() {
+			if (m_spheres_moved)
+				m_tree.refit([&](uint32_t slot) { return m_spheres.sphere_box(slot); });
+			if (m_instances_moved)
+				m_top.refit([&](uint32_t slot) { return instance_box(m_instances[slot]); });
+			m_spheres_moved = m_instances_moved = false;
+		}
+
+		const sphere_pack& spheres() const { return m_spheres; }
+		const bvh_tree& tree() const { return m_tree; }
+		const std::vector<triangle_mesh>& meshes() const { return m_meshes; }
+		// in top level leaf order
+		const std::vector<MESH_INSTANCE>& instances() const { return m_instances; }
+		size_t material_count() const { return m_materials.size(); }
+
+		/*
+			Hash of what the scene looks like: spheres and meshes with their
+			materials, and the instances. Progressive checkpoints record it, so a
+			render never resumes the sums of another scene.
+		*/
+		uint64_t fingerprint() const {
+			uint64_t h = hash_bytes(nullptr, 0);
+			const auto add = [&h](real x) { h = hash_bytes(&x, sizeof(x), h); };
+			const auto add_material = [&](const material* mat) {
+				const MATERIAL_DESCRIPTOR& desc = mat->describe();
+				const uint32_t kind = static_cast<uint32_t>(desc.kind);
+				h = hash_bytes(&kind, sizeof(kind), h);
+				add(desc.albedo.x()); add(desc.albedo.y()); add(desc.albedo.z());
+				add(desc.fuzz);
+				add(desc.ior);
+			};
+			for (size_t i = 0; i < m_spheres.size(); i++) {
+				const point3 center = m_spheres.center(i);
+				add(center.x()); add(center.y()); add(center.z());
+				add(m_spheres.radius(i));
+				add_material(m_spheres.material_of(i));
+			}
+			for (const triangle_mesh& mesh : m_meshes) {
+				h = hash_bytes(mesh.vertices().data(), mesh.vertices().size() * sizeof(MESH_VERTEX), h);
+				h = hash_bytes(mesh.indices().data(), mesh.indices().size() * sizeof(uint32_t), h);
+				add_material(mesh.mat_ptr());
+			}
+			for (const MESH_INSTANCE& instance : m_instances) {
+				for (int k = 0; k < 12; k++)
+					add(instance.transform.matrix()[k]);
+				h = hash_bytes(&instance.mesh, sizeof(instance.mesh), h);
+			}
+			return h;
+		}
+
+		// bytes of the meshes, the instances and the top level
+		size_t geometry_bytes() const {
+			size_t bytes = m_instances.capacity() * sizeof(MESH_INSTANCE) + m_top.nodes().capacity() * sizeof(bvh_node);
+			for (const triangle_mesh& mesh : m_meshes)
+				bytes += mesh.memory_bytes();
+			return bytes;
+		}
+
+	private:
+		aabb instance_box(const MESH_INSTANCE& inst) const {
+			aabb box;
+			m_meshes[inst.mesh].bounding_box(box);
+			return inst.transform.box_to_world(box);
+		}
+
+		// storage slot of the primitive index had before the build; the map is made on first use
+		static uint32_t slot_of(const bvh_tree& tree, std::vector<uint32_t>& slots, size_t index) {
+			if (slots.empty()) {
+				slots.resize(tree.order().size());
+				for (uint32_t slot = 0; slot < slots.size(); slot++)
+					slots[tree.order()[slot]] = slot;
+			}
+			return slots.at(index);
+		}
+
+		// closest hit among the instances [first, first + count), like sphere_pack::hit_range
+		bool hit_instances(const ray& r, uint32_t first, uint32_t count, real t_min, real& closest, uint32_t& inst, uint32_t& tri) const {
+			bool hit_anything = false;
+			for (uint32_t i = first; i < first + count; i++) {
+				const MESH_INSTANCE& instance = m_instances[i];
+				if (m_meshes[instance.mesh].closest_hit(instance.transform.to_object(r), t_min, closest, tri)) {
+					inst = i;
+					hit_anything = true;
+				}
+			}
+			return hit_anything;
+		}
+
+		// the normal goes to the world, the hit point is found on the world ray
+		void fill_instance_record(const ray& r, uint32_t inst, uint32_t tri, real t, hit_record& rec) const {
+			const MESH_INSTANCE& instance = m_instances[inst];
+			const triangle_mesh& mesh = m_meshes[instance.mesh];
+			const vec3 normal = unit_vector(instance.transform.normal_to_world(mesh.face_normal(tri)));
+			triangle_mesh::surface_record(r, t, normal, mesh.mat_ptr(), rec);
+		}
+
+		//member data
+		material_arena m_materials;
+		sphere_pack m_spheres;
+		bvh_tree m_tree;
+		std::vector<triangle_mesh> m_meshes;
+		std::vector<MESH_INSTANCE> m_instances;
+		bvh_tree m_top;		// over the instances
+
+		// animation only: scene index to storage slot, and what refit() has to do
+		std::vector<uint32_t> m_sphere_slots;
+		std::vector<uint32_t> m_instance_slots;
+		bool m_spheres_moved = false;
+		bool m_instances_moved = false;
+		//!member data
+	};
+
+	// mutable scene description; freeze() turns it into the frozen_scene that gets rendered
+	class scene {
+	public:
+		template<typename T, typename... Args>
+		const material* add_material(Args&&... args) {
+			return m_materials.add<T>(std::forward<Args>(args)...);
+		}
+
+		void add_sphere(const point3& center, double radius, const material* mat) {
+			m_spheres.add(center, radius, mat);
+		}
+
+		void reserve_spheres(size_t count) { m_spheres.reserve(count); }
+		size_t sphere_count() const { return m_spheres.size(); }
+
+		/*
+			Stores a mesh once and returns its id; add_instance places it, as often
+			as needed. The mesh's material has to come from add_material; its bvh
+			is built by freeze().
+		*/
+		uint32_t add_mesh(triangle_mesh&& mesh) {
+			m_meshes.push_back(std::move(mesh));
+			return static_cast<uint32_t>(m_meshes.size() - 1);
+		}
+
+		void add_instance(uint32_t mesh, const affine_transform& transform = affine_transform()) {
+			m_instances.push_back({ transform, mesh });
+		}
+
+		// stored triangles, however often they are placed
+		size_t triangle_count() const {
+			size_t count = 0;
+			for (const triangle_mesh& mesh : m_meshes)
+				count += mesh.triangle_count();
+			return count;
+		}
+
+		std::vector<triangle_mesh>& meshes() { return m_meshes; }
+		const std::vector<triangle_mesh>& meshes() const { return m_meshes; }
+		const std::vector<MESH_INSTANCE>& instances() const { return m_instances; }
+
+		// direct access for bulk loaders, see sphere_pack::append
+		sphere_pack& spheres() { return m_spheres; }
+		const sphere_pack& spheres() const { return m_spheres; }
+
+		// hands the storage over to the frozen scene, the builder is empty afterwards
+		std::shared_ptr<frozen_scene> freeze() {
+			auto frozen = std::make_shared<frozen_scene>(std::move(m_materials), std::move(m_spheres),
+				std::move(m_meshes), std::move(m_instances));
+			m_materials = material_arena();
+			m_spheres = sphere_pack();
+			m_meshes.clear();
+			m_instances.clear();
+			return frozen;
+		}
+
+	private:
+		//member data
+		material_arena m_materials;
+		sphere_pack m_spheres;
+		std::vector<triangle_mesh> m_meshes;
+		std::vector<MESH_INSTANCE> m_instances;
+		//!member data
+	};
+}
+
+#endif //!SCENE_HPP
\ No newline at end of file
@@ -0,0 +1,992 @@
+#ifndef SCENEFILE_HPP
+#define SCENEFILE_HPP
+
+#include "Animation.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace raytracer {
+
+	/*
+		Scene files describe the spheres, materials, camera and render settings of
+		a scene, so it can change without a recompile. The extension picks one of
+		two formats:
+
+		.rtsb	binary: a SCENE_FILE_HEADER, then material_count SCENE_MATERIAL_RECORDs,
+				then sphere_count SCENE_SPHERE_RECORDs, then mesh_count meshes, each
+				a SCENE_MESH_RECORD followed by its MESH_VERTEXs and 3 indices per
+				triangle, then instance_count SCENE_INSTANCE_RECORDs; little endian
+				as written. The loader maps the file and copies the records straight
+				into the scene's sphere_pack and meshes.
+		other	text, one statement per line, '#' starts a comment:
+					image <width> <height>
+					samples <samples per pixel>
+					max_depth <bounces>
+					rr_depth <bounce>
+					seed <seed>
+					camera [look_from <x> <y> <z>] [look_at <x> <y> <z>] [up <x> <y> <z>]
+						[vfov <degrees>] [aperture <diameter>] [focus_dist <distance>]
+					material <name> lambertian|metal|dielectric|emissive <r> <g> <b>
+						[fuzz <radius>] [ior <index>]
+					sphere <x> <y> <z> <radius> <material name>
+					mesh <OBJ file, relative to the scene file> <material name>
+					object <name> <OBJ file> <material name>
+					instance <object name> [translate <x> <y> <z>] [rotate <x> <y> <z> <degrees>]
+						[scale <x> <y> <z>] [matrix <12 numbers, row by row>]
+					frames <count>
+					animate camera [look_from <x> <y> <z>] [look_at <x> <y> <z>]
+					animate sphere <index> <x> <y> <z>
+					animate instance <index> [translate <x> <y> <z>] [rotate <x> <y> <z> <degrees>]
+				mesh places a mesh as it is. object loads one without placing it,
+				and every instance places it once more, the transforms applied in the
+				order given; the mesh is stored once. A material or object may be
+				used above the line that defines it.
+				frames makes the scene an animation (see ANIMATION): an animate
+				statement gives where the camera, a sphere or an instance is at the
+				last frame. Spheres are counted from 0 in the order of the file,
+				instances likewise, the mesh statements' first. Binary files hold
+				no animation; save_scene_file refuses to write one for an animated
+				scene.
+
+		Both loaders split their input between the hardware threads and
+		allocate all spheres at once (sphere_pack::append), so even scenes of
+		millions of spheres load in a fraction of a second. Building the bvh
+		(scene::freeze) is a separate step.
+	*/
+
+	// what a scene file may set besides the scene; the defaults are the built-in scene's
+	struct RENDER_SETTINGS {
+		uint32_t image_width = 400;
+		uint32_t image_height = 225;
+		int32_t samples_per_pixel = 100;
+		int32_t max_depth = 50;
+		int32_t rr_depth = 3;
+		uint64_t seed = 0;
+
+		double aspect_ratio() const { return static_cast<double>(image_width) / image_height; }
+	};
+
+	struct SCENE_FILE {
+		RENDER_SETTINGS settings;
+		// the aspect ratio is the image's, see RENDER_SETTINGS::aspect_ratio
+		CAM_DESCRIPTOR camera;
+		scene world;
+		ANIMATION animation;
+	};
+
+	struct SCENE_FILE_HEADER {
+		char magic[4] = { 'R', 'T', 'S', 'C' };
+		uint32_t version = 5;
+		uint32_t image_width = 0;
+		uint32_t image_height = 0;
+		int32_t samples_per_pixel = 0;
+		int32_t max_depth = 0;
+		int32_t rr_depth = 0;
+		uint32_t material_count = 0;
+		uint64_t seed = 0;
+		uint64_t sphere_count = 0;
+		uint64_t mesh_count = 0;
+		uint64_t instance_count = 0;
+		double look_from[3] = {};
+		double look_at[3] = {};
+		double up[3] = {};
+		double vfov = 0;
+		double aperture = 0;
+		double focus_dist = 0;
+	};
+
+	struct SCENE_MATERIAL_RECORD {
+		uint32_t kind;		// material_kind
+		float albedo[3];
+		float fuzz;
+		float ior;
+	};
+
+	struct SCENE_SPHERE_RECORD {
+		float center[3];
+		float radius;
+		uint32_t material;	// index of the material record
+	};
+
+	struct SCENE_MESH_RECORD {
+		uint32_t material;	// index of the material record
+		uint32_t vertex_count;
+		uint64_t triangle_count;
+	};
+
+	struct SCENE_INSTANCE_RECORD {
+		float matrix[12];	// object to world, see affine_transform
+		uint32_t mesh;		// index of the mesh, in file order
+	};
+
+	// read-only memory mapping of a whole file
+	class mapped_file {
+	public:
+		explicit mapped_file(const std::string& path) {
+#ifdef _WIN32
+			m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (m_file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("cannot open " + path);
+			LARGE_INTEGER size;
+			GetFileSizeEx(m_file, &size);
+			m_size = static_cast<size_t>(size.QuadPart);
+			if (m_size == 0) return;
+			m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (m_mapping)
+				m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!m_data) {
+				release();
+				throw std::runtime_error("cannot map " + path);
+			}
+#else
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw std::runtime_error("cannot open " + path);
+			struct stat st;
+			if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+				m_size = static_cast<size_t>(st.st_size);
+				void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED) {
+					::madvise(data, m_size, MADV_WILLNEED);
+					m_data = static_cast<const char*>(data);
+				}
+			}
+			::close(fd);
+			if (m_size > 0 && !m_data)
+				throw std::runtime_error("cannot map " + path);
+#endif
+		}
+
+		~mapped_file() { release(); }
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		const char* data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		void release() {
+#ifdef _WIN32
+			if (m_data) UnmapViewOfFile(m_data);
+			if (m_mapping) CloseHandle(m_mapping);
+			if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+			m_mapping = nullptr;
+			m_file = INVALID_HANDLE_VALUE;
+#else
+			if (m_data) ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+			m_data = nullptr;
+		}
+
+		//member data
+		const char* m_data = nullptr;
+		size_t m_size = 0;
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#endif
+		//!member data
+	};
+
+	namespace scene_io {
+
+		// one part per hardware thread, but no part smaller than about min_items
+		inline size_t part_count(size_t items, size_t min_items) {
+			const size_t threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+			const size_t parts = items / min_items + 1;
+			return parts < threads ? parts : threads;
+		}
+
+		// fn(part) for every part in [0, parts), part 0 on the calling thread; fn must not throw
+		template<typename F>
+		void for_each_part(size_t parts, F&& fn) {
+			std::vector<std::thread> workers;
+			for (size_t p = 1; p < parts; p++)
+				workers.emplace_back([&fn, p]() { fn(p); });
+			fn(0);
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		inline bool parse_kind(std::string_view name, material_kind& kind) {
+			for (int k = 0; k < static_cast<int>(material_kind::count); k++) {
+				if (name == material_kind_name(static_cast<material_kind>(k))) {
+					kind = static_cast<material_kind>(k);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// whitespace separated tokens of one line, comment already cut off
+		class line_reader {
+		public:
+			line_reader(const char* begin, const char* end) : m_pos(begin), m_end(end) {}
+
+			// next token, empty at the end of the line
+			std::string_view token() {
+				while (m_pos < m_end && is_space(*m_pos)) m_pos++;
+				const char* start = m_pos;
+				while (m_pos < m_end && !is_space(*m_pos)) m_pos++;
+				return std::string_view(start, static_cast<size_t>(m_pos - start));
+			}
+
+			template<typename T>
+			bool number(T& value) {
+				const std::string_view t = token();
+				const auto [end, ec] = std::from_chars(t.data(), t.data() + t.size(), value);
+				return !t.empty() && ec == std::errc() && end == t.data() + t.size();
+			}
+
+			bool at_end() {
+				while (m_pos < m_end && is_space(*m_pos)) m_pos++;
+				return m_pos == m_end;
+			}
+
+		private:
+			static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+			//member data
+			const char* m_pos;
+			const char* m_end;
+			//!member data
+		};
+
+		struct SPHERE_LINE {
+			double center[3];
+			double radius;
+			std::string_view material;
+			uint32_t line;
+		};
+
+		// what one thread parsed of its share of a text file; lines are counted from the part's start
+		struct TEXT_PART {
+			std::vector<SPHERE_LINE> spheres;
+			std::vector<std::pair<uint32_t, line_reader>> statements;	// every line but the spheres, in order
+			uint32_t lines = 0;
+			uint32_t error_line = 0;
+			std::string error;
+		};
+
+		inline void parse_part(const char* begin, const char* end, TEXT_PART& part) {
+			for (const char* line = begin; line < end; ) {
+				const char* eol = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+				if (!eol) eol = end;
+				const char* comment = static_cast<const char*>(std::memchr(line, '#', static_cast<size_t>(eol - line)));
+				line_reader reader(line, comment ? comment : eol);
+				const uint32_t number = ++part.lines;
+				line = eol + 1;
+
+				line_reader peek = reader;
+				const std::string_view keyword = peek.token();
+				if (keyword.empty()) continue;
+				if (keyword != "sphere") {
+					part.statements.emplace_back(number, reader);
+					continue;
+				}
+
+				SPHERE_LINE s;
+				s.line = number;
+				if (!peek.number(s.center[0]) || !peek.number(s.center[1]) || !peek.number(s.center[2]) || !peek.number(s.radius)
+					|| (s.material = peek.token()).empty() || !peek.at_end())
+				{
+					part.error_line = number;
+					part.error = "expected sphere <x> <y> <z> <radius> <material>";
+					return;
+				}
+				part.spheres.push_back(s);
+			}
+		}
+
+		inline bool parse_vector(line_reader& reader, vec3& v) {
+			double x, y, z;
+			if (!reader.number(x) || !reader.number(y) || !reader.number(z))
+				return false;
+			v = vec3(x, y, z);
+			return true;
+		}
+
+		// an animate statement; the indices are checked once the scene is loaded
+		inline std::string parse_animate(line_reader& reader, ANIMATION& animation) {
+			const std::string_view what = reader.token();
+			if (what == "camera") {
+				for (std::string_view key = reader.token(); !key.empty(); key = reader.token()) {
+					vec3 v;
+					if ((key != "look_from" && key != "look_at") || !parse_vector(reader, v))
+						return "expected animate camera [look_from <x> <y> <z>] [look_at <x> <y> <z>]";
+					(key == "look_from" ? animation.look_from : animation.look_at) = v;
+				}
+			}
+			else if (what == "sphere") {
+				SPHERE_MOTION motion;
+				if (!reader.number(motion.sphere) || !parse_vector(reader, motion.to) || !reader.at_end())
+					return "expected animate sphere <index> <x> <y> <z>";
+				animation.spheres.push_back(motion);
+			}
+			else if (what == "instance") {
+				INSTANCE_MOTION motion;
+				const char* const usage = "expected animate instance <index> [translate <x> <y> <z>] [rotate <x> <y> <z> <degrees>]";
+				if (!reader.number(motion.instance))
+					return usage;
+				for (std::string_view key = reader.token(); !key.empty(); key = reader.token()) {
+					double degrees;
+					if (key == "translate" && parse_vector(reader, motion.translate))
+						continue;
+					if (key != "rotate" || !parse_vector(reader, motion.axis) || !reader.number(degrees) || motion.axis.length_squared() == 0)
+						return usage;
+					motion.degrees = static_cast<real>(degrees);
+				}
+				animation.instances.push_back(motion);
+			}
+			else {
+				return "expected animate camera|sphere|instance";
+			}
+			return "";
+		}
+
+		// a statement other than sphere; returns the error, empty on success
+		inline std::string parse_statement(line_reader reader, SCENE_FILE& file, std::unordered_map<std::string_view, uint32_t>& materials) {
+			const std::string_view keyword = reader.token();
+			RENDER_SETTINGS& settings = file.settings;
+			if (keyword == "image") {
+				if (!reader.number(settings.image_width) || !reader.number(settings.image_height) || !reader.at_end()
+					|| settings.image_width < 2 || settings.image_height < 2)
+					return "expected image <width> <height>, both at least 2";
+			}
+			else if (keyword == "samples") {
+				if (!reader.number(settings.samples_per_pixel) || !reader.at_end() || settings.samples_per_pixel < 1)
+					return "expected samples <count>, at least 1";
+			}
+			else if (keyword == "max_depth") {
+				if (!reader.number(settings.max_depth) || !reader.at_end() || settings.max_depth < 1)
+					return "expected max_depth <bounces>, at least 1";
+			}
+			else if (keyword == "rr_depth") {
+				if (!reader.number(settings.rr_depth) || !reader.at_end() || settings.rr_depth < 0)
+					return "expected rr_depth <bounce>, 0 turns Russian roulette off";
+			}
+			else if (keyword == "seed") {
+				if (!reader.number(settings.seed) || !reader.at_end())
+					return "expected seed <seed>";
+			}
+			else if (keyword == "camera") {
+				CAM_DESCRIPTOR& camd = file.camera;
+				for (std::string_view key = reader.token(); !key.empty(); key = reader.token()) {
+					double x, y, z;
+					const bool is_vector = key == "look_from" || key == "look_at" || key == "up";
+					if (is_vector && reader.number(x) && reader.number(y) && reader.number(z))
+						(key == "look_from" ? camd.look_from : key == "look_at" ? camd.look_at : camd.up) = vec3(x, y, z);
+					else if (key == "vfov" && reader.number(x) && x > 0 && x < 180)
+						camd.vfov = static_cast<real>(x);
+					else if (key == "aperture" && reader.number(x) && x >= 0)
+						camd.aperture = static_cast<real>(x);
+					else if (key == "focus_dist" && reader.number(x) && x >= 0)
+						camd.focus_dist = static_cast<real>(x);
+					else
+						return "expected camera [look_from <x> <y> <z>] [look_at <x> <y> <z>] [up <x> <y> <z>] "
+							"[vfov <degrees>] [aperture <diameter>] [focus_dist <distance>]";
+				}
+				if (const char* problem = camera_problem(camd))
+					return std::string("camera: ") + problem;
+			}
+			else if (keyword == "material") {
+				const std::string_view name = reader.token();
+				const char* const usage = "expected material <name> lambertian|metal|dielectric|emissive <r> <g> <b> [fuzz <radius>] [ior <index>]";
+				MATERIAL_DESCRIPTOR desc;
+				double r, g, b;
+				if (name.empty() || !parse_kind(reader.token(), desc.kind) || !reader.number(r) || !reader.number(g) || !reader.number(b))
+					return usage;
+				desc.albedo = color(r, g, b);
+				for (std::string_view key = reader.token(); !key.empty(); key = reader.token()) {
+					double x;
+					if (key == "fuzz" && reader.number(x) && x >= 0 && x <= 1)
+						desc.fuzz = static_cast<real>(x);
+					else if (key == "ior" && reader.number(x) && x > 0)
+						desc.ior = static_cast<real>(x);
+					else
+						return usage;
+				}
+				const material* mat = file.world.add_material<material>(desc);
+				if (!materials.emplace(name, file.world.spheres().material_id(mat)).second)
+					return "material " + std::string(name) + " is defined twice";
+			}
+			else if (keyword == "frames") {
+				if (!reader.number(file.animation.frames) || !reader.at_end() || file.animation.frames < 1)
+					return "expected frames <count>, at least 1";
+			}
+			else if (keyword == "animate") {
+				return parse_animate(reader, file.animation);
+			}
+			else {
+				return "unknown statement " + std::string(keyword);
+			}
+			return "";
+		}
+
+		// the options of an instance statement, each applied after the ones before it
+		inline bool parse_transform(line_reader& reader, affine_transform& transform) {
+			for (std::string_view key = reader.token(); !key.empty(); key = reader.token()) {
+				double v[12];
+				const int count = key == "matrix" ? 12 : key == "rotate" ? 4 : 3;
+				for (int i = 0; i < count; i++) {
+					if (!reader.number(v[i]))
+						return false;
+				}
+				const vec3 xyz(static_cast<real>(v[0]), static_cast<real>(v[1]), static_cast<real>(v[2]));
+				try {
+					if (key == "translate")
+						transform = affine_transform::translate(xyz) * transform;
+					else if (key == "scale")
+						transform = affine_transform::scale(xyz) * transform;
+					else if (key == "rotate")
+						transform = affine_transform::rotate(xyz, static_cast<real>(v[3])) * transform;
+					else if (key == "matrix") {
+						real m[12];
+						for (int i = 0; i < 12; i++)
+							m[i] = static_cast<real>(v[i]);
+						transform = affine_transform(m) * transform;
+					}
+					else
+						return false;
+				}
+				catch (const std::runtime_error&) { // zero scale or rotation axis, singular matrix
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	/*
+		Streams a Wavefront OBJ file into a mesh: one pass over the mapped file
+		puts vertices (v) straight into the vertex buffer and faces (f) into the
+		index buffer, polygons as triangle fans, with no object per vertex or
+		face in between. Counting the v and f lines first sizes both buffers, so
+		they do not reallocate on the way. Texture coordinates, normals, groups
+		and materials are skipped; faces may only use vertices above them.
+	*/
+	inline triangle_mesh load_obj(const std::string& path, const material* mat) {
+		using namespace scene_io;
+		const mapped_file mapping(path);
+		const char* const data = mapping.data();
+		const char* const end = data + mapping.size();
+		const auto next_line = [end](const char* line) {
+			const char* eol = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+			return eol ? eol : end;
+		};
+
+		size_t vertex_lines = 0, face_lines = 0;
+		for (const char* line = data; line < end; line = next_line(line) + 1) {
+			if (end - line > 1 && (line[1] == ' ' || line[1] == '\t')) {
+				vertex_lines += line[0] == 'v';
+				face_lines += line[0] == 'f';
+			}
+		}
+		triangle_mesh mesh(mat);
+		mesh.reserve(vertex_lines, face_lines);
+		std::vector<MESH_VERTEX>& vertices = mesh.vertices();
+
+		uint32_t number = 0;
+		const auto fail = [&](const std::string& message) {
+			throw std::runtime_error(path + ":" + std::to_string(number) + ": " + message);
+		};
+		for (const char* line = data; line < end; ) {
+			const char* eol = next_line(line);
+			const char* comment = static_cast<const char*>(std::memchr(line, '#', static_cast<size_t>(eol - line)));
+			line_reader reader(line, comment ? comment : eol);
+			number++;
+			line = eol + 1;
+
+			const std::string_view keyword = reader.token();
+			if (keyword == "v") {
+				MESH_VERTEX v;
+				if (!reader.number(v.p[0]) || !reader.number(v.p[1]) || !reader.number(v.p[2]))
+					fail("expected v <x> <y> <z>");
+				if (vertices.size() == std::numeric_limits<uint32_t>::max())
+					fail("more vertices than 32 bit indices can address");
+				vertices.push_back(v);
+			}
+			else if (keyword == "f") {
+				// v, v/vt, v//vn or v/vt/vn; negative indices count back from the last vertex
+				uint32_t corners = 0, first = 0, previous = 0;
+				for (std::string_view corner = reader.token(); !corner.empty(); corner = reader.token()) {
+					long long index = 0;
+					const auto [stop, ec] = std::from_chars(corner.data(), corner.data() + corner.size(), index);
+					if (ec != std::errc() || (stop != corner.data() + corner.size() && *stop != '/'))
+						fail("bad vertex index " + std::string(corner));
+					const long long resolved = index < 0 ? static_cast<long long>(vertices.size()) + index : index - 1;
+					if (index == 0 || resolved < 0 || resolved >= static_cast<long long>(vertices.size()))
+						fail("vertex index " + std::string(corner) + " out of range, " + std::to_string(vertices.size()) + " vertices so far");
+					const uint32_t current = static_cast<uint32_t>(resolved);
+					if (corners == 0)
+						first = current;
+					else if (corners >= 2)
+						mesh.add_triangle(first, previous, current);
+					previous = current;
+					corners++;
+				}
+				if (corners < 3)
+					fail("a face needs at least 3 vertices");
+			}
+		}
+		return mesh;
+	}
+
+	// the mesh as OBJ, counter-clockwise triangles as triangle_mesh has them
+	inline void save_obj(const std::string& path, const triangle_mesh& mesh) {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		out.precision(std::numeric_limits<float>::max_digits10);
+		for (const MESH_VERTEX& v : mesh.vertices())
+			out << "v " << v.p[0] << ' ' << v.p[1] << ' ' << v.p[2] << '\n';
+		const std::vector<uint32_t>& indices = mesh.indices();
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			out << "f " << indices[i] + 1 << ' ' << indices[i + 1] + 1 << ' ' << indices[i + 2] + 1 << '\n';
+		if (!out)
+			throw std::runtime_error("cannot write " + path);
+	}
+
+	inline SCENE_FILE load_scene_text(const std::string& path) {
+		using namespace scene_io;
+		const mapped_file mapping(path);
+		const char* const data = mapping.data();
+		const size_t size = mapping.size();
+
+		// parts start behind a line break, so no line is split between two threads
+		const size_t parts = part_count(size, size_t(1) << 20);
+		std::vector<const char*> bounds(parts + 1, data + size);
+		bounds[0] = data;
+		for (size_t p = 1; p < parts; p++) {
+			const char* split = data + size * p / parts;
+			split = split > bounds[p - 1] ? split : bounds[p - 1];
+			const char* eol = static_cast<const char*>(std::memchr(split, '\n', static_cast<size_t>(data + size - split)));
+			bounds[p] = eol ? eol + 1 : data + size;
+		}
+		std::vector<TEXT_PART> text(parts);
+		for_each_part(parts, [&](size_t p) { parse_part(bounds[p], bounds[p + 1], text[p]); });
+
+		std::vector<uint32_t> first_line(parts, 0);
+		for (size_t p = 1; p < parts; p++)
+			first_line[p] = first_line[p - 1] + text[p - 1].lines;
+		const auto fail = [&](size_t p, uint32_t line, const std::string& message) {
+			throw std::runtime_error(path + ":" + std::to_string(first_line[p] + line) + ": " + message);
+		};
+		for (size_t p = 0; p < parts; p++) {
+			if (!text[p].error.empty())
+				fail(p, text[p].error_line, text[p].error);
+		}
+
+		SCENE_FILE file;
+		std::unordered_map<std::string_view, uint32_t> materials;
+		size_t sphere_count = 0;
+		// meshes are loaded once all materials are known, instances placed once all objects are
+		struct MESH_LINE {
+			std::string_view name, obj, material;	// mesh statements have no name
+			size_t part;
+			uint32_t line;
+		};
+		struct INSTANCE_LINE {
+			std::string_view object;
+			affine_transform transform;
+			size_t part;
+			uint32_t line;
+		};
+		std::vector<MESH_LINE> meshes;
+		std::vector<INSTANCE_LINE> instances;
+		for (size_t p = 0; p < parts; p++) {
+			for (const auto& [line, reader] : text[p].statements) {
+				line_reader args = reader;
+				const std::string_view keyword = args.token();
+				if (keyword == "mesh" || keyword == "object") {
+					MESH_LINE m{ keyword == "object" ? args.token() : std::string_view(), args.token(), args.token(), p, line };
+					if (m.obj.empty() || m.material.empty() || !args.at_end())
+						fail(p, line, keyword == "mesh" ? "expected mesh <OBJ file> <material>" : "expected object <name> <OBJ file> <material>");
+					meshes.push_back(m);
+					continue;
+				}
+				if (keyword == "instance") {
+					INSTANCE_LINE i{ args.token(), affine_transform(), p, line };
+					if (i.object.empty() || !parse_transform(args, i.transform))
+						fail(p, line, "expected instance <object> [translate <x> <y> <z>] [rotate <x> <y> <z> <degrees>] "
+							"[scale <x> <y> <z>] [matrix <12 numbers>], with an invertible result");
+					instances.push_back(i);
+					continue;
+				}
+				const std::string error = parse_statement(reader, file, materials);
+				if (!error.empty())
+					fail(p, line, error);
+			}
+			sphere_count += text[p].spheres.size();
+		}
+
+		sphere_pack& spheres = file.world.spheres();
+		size_t next = spheres.append(sphere_count);
+		std::vector<size_t> first_sphere(parts);
+		for (size_t p = 0; p < parts; p++) {
+			first_sphere[p] = next;
+			next += text[p].spheres.size();
+		}
+		for_each_part(parts, [&](size_t p) {
+			TEXT_PART& part = text[p];
+			for (size_t k = 0; k < part.spheres.size(); k++) {
+				const SPHERE_LINE& s = part.spheres[k];
+				const auto it = materials.find(s.material);
+				if (it == materials.end()) {
+					part.error_line = s.line;
+					part.error = "unknown material " + std::string(s.material);
+					return;
+				}
+				spheres.set(first_sphere[p] + k, point3(s.center[0], s.center[1], s.center[2]), static_cast<real>(s.radius), it->second);
+			}
+		});
+		for (size_t p = 0; p < parts; p++) {
+			if (!text[p].error.empty())
+				fail(p, text[p].error_line, text[p].error);
+		}
+
+		const std::filesystem::path folder = std::filesystem::path(path).parent_path();
+		std::unordered_map<std::string_view, uint32_t> objects;
+		for (const MESH_LINE& m : meshes) {
+			const auto it = materials.find(m.material);
+			if (it == materials.end())
+				fail(m.part, m.line, "unknown material " + std::string(m.material));
+			const uint32_t id = file.world.add_mesh(load_obj((folder / std::string(m.obj)).string(), spheres.material_by_id(it->second)));
+			if (m.name.empty())
+				file.world.add_instance(id);
+			else if (!objects.emplace(m.name, id).second)
+				fail(m.part, m.line, "object " + std::string(m.name) + " is defined twice");
+		}
+		for (const INSTANCE_LINE& i : instances) {
+			const auto it = objects.find(i.object);
+			if (it == objects.end())
+				fail(i.part, i.line, "unknown object " + std::string(i.object));
+			file.world.add_instance(it->second, i.transform);
+		}
+
+		for (const SPHERE_MOTION& motion : file.animation.spheres) {
+			if (motion.sphere >= spheres.size())
+				throw std::runtime_error(path + ": animate sphere " + std::to_string(motion.sphere) + ", but there are "
+					+ std::to_string(spheres.size()) + " spheres");
+		}
+		for (const INSTANCE_MOTION& motion : file.animation.instances) {
+			if (motion.instance >= file.world.instances().size())
+				throw std::runtime_error(path + ": animate instance " + std::to_string(motion.instance) + ", but there are "
+					+ std::to_string(file.world.instances().size()) + " instances");
+		}
+		for (uint32_t frame = 1; frame < file.animation.frames; frame++) {
+			const real t = static_cast<real>(frame) / (file.animation.frames - 1);
+			if (const char* problem = camera_problem(frame_camera(file.animation, file.camera, t)))
+				throw std::runtime_error(path + ": camera of frame " + std::to_string(frame) + ": " + problem);
+		}
+		return file;
+	}
+
+	inline SCENE_FILE load_scene_binary(const std::string& path) {
+		using namespace scene_io;
+		const mapped_file mapping(path);
+		const SCENE_FILE_HEADER expected;
+		SCENE_FILE_HEADER header;
+		if (mapping.size() < sizeof(header))
+			throw std::runtime_error(path + ": not a scene file");
+		std::memcpy(&header, mapping.data(), sizeof(header));
+		if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version)
+			throw std::runtime_error(path + ": not a scene file of version " + std::to_string(expected.version));
+
+		const size_t material_bytes = sizeof(SCENE_MATERIAL_RECORD) * header.material_count;
+		const size_t payload = mapping.size() - sizeof(header);
+		const auto corrupt = [&path]() {
+			return std::runtime_error(path + ": size does not match the header, the file is truncated or corrupt");
+		};
+		if (material_bytes > payload || header.sphere_count > (payload - material_bytes) / sizeof(SCENE_SPHERE_RECORD))
+			throw corrupt();
+		if (header.image_width < 2 || header.image_height < 2 || header.samples_per_pixel < 1 || header.max_depth < 1 || header.rr_depth < 0)
+			throw std::runtime_error(path + ": invalid render settings");
+
+		SCENE_FILE file;
+		file.settings = { header.image_width, header.image_height, header.samples_per_pixel, header.max_depth, header.rr_depth, header.seed };
+		file.camera.look_from = point3(header.look_from[0], header.look_from[1], header.look_from[2]);
+		file.camera.look_at = point3(header.look_at[0], header.look_at[1], header.look_at[2]);
+		file.camera.up = vec3(header.up[0], header.up[1], header.up[2]);
+		file.camera.vfov = static_cast<real>(header.vfov);
+		file.camera.aperture = static_cast<real>(header.aperture);
+		file.camera.focus_dist = static_cast<real>(header.focus_dist);
+		if (const char* problem = camera_problem(file.camera))
+			throw std::runtime_error(path + ": camera: " + problem);
+
+		sphere_pack& spheres = file.world.spheres();
+		const char* records = mapping.data() + sizeof(header);
+		std::vector<uint32_t> material_ids(header.material_count);
+		for (uint32_t m = 0; m < header.material_count; m++) {
+			SCENE_MATERIAL_RECORD record;
+			std::memcpy(&record, records + m * sizeof(record), sizeof(record));
+			if (record.kind >= static_cast<uint32_t>(material_kind::count))
+				throw std::runtime_error(path + ": material " + std::to_string(m) + " has an unknown kind");
+			if (!(record.fuzz >= 0 && record.fuzz <= 1 && record.ior > 0))
+				throw std::runtime_error(path + ": material " + std::to_string(m) + " has an invalid fuzz or index of refraction");
+			const MATERIAL_DESCRIPTOR desc{ static_cast<material_kind>(record.kind),
+				color(record.albedo[0], record.albedo[1], record.albedo[2]), record.fuzz, record.ior };
+			const material* mat = file.world.add_material<material>(desc);
+			material_ids[m] = spheres.material_id(mat);
+		}
+		records += material_bytes;
+
+		const size_t count = static_cast<size_t>(header.sphere_count);
+		const size_t first = spheres.append(count);
+		const size_t parts = part_count(count, size_t(1) << 16);
+		std::vector<size_t> bad_sphere(parts, count);
+		for_each_part(parts, [&](size_t p) {
+			for (size_t i = count * p / parts; i < count * (p + 1) / parts; i++) {
+				SCENE_SPHERE_RECORD record;
+				std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+				if (record.material >= material_ids.size()) {
+					bad_sphere[p] = i;
+					return;
+				}
+				spheres.set(first + i, point3(record.center[0], record.center[1], record.center[2]), record.radius, material_ids[record.material]);
+			}
+		});
+		for (size_t bad : bad_sphere) {
+			if (bad < count)
+				throw std::runtime_error(path + ": sphere " + std::to_string(bad) + " has no material");
+		}
+		records += count * sizeof(SCENE_SPHERE_RECORD);
+
+		// vertices and indices are copied as they are, only the indices are checked
+		const char* const data_end = mapping.data() + mapping.size();
+		for (uint64_t m = 0; m < header.mesh_count; m++) {
+			SCENE_MESH_RECORD record;
+			if (static_cast<size_t>(data_end - records) < sizeof(record))
+				throw corrupt();
+			std::memcpy(&record, records, sizeof(record));
+			records += sizeof(record);
+			const size_t vertex_bytes = sizeof(MESH_VERTEX) * record.vertex_count;
+			if (record.material >= material_ids.size())
+				throw std::runtime_error(path + ": mesh " + std::to_string(m) + " has no material");
+			if (vertex_bytes > static_cast<size_t>(data_end - records)
+				|| record.triangle_count > (static_cast<size_t>(data_end - records) - vertex_bytes) / (3 * sizeof(uint32_t)))
+				throw corrupt();
+
+			triangle_mesh mesh(spheres.material_by_id(material_ids[record.material]));
+			mesh.vertices().resize(record.vertex_count);
+			mesh.indices().resize(3 * static_cast<size_t>(record.triangle_count));
+			std::memcpy(mesh.vertices().data(), records, vertex_bytes);
+			records += vertex_bytes;
+			std::memcpy(mesh.indices().data(), records, mesh.indices().size() * sizeof(uint32_t));
+			records += mesh.indices().size() * sizeof(uint32_t);
+			for (uint32_t index : mesh.indices()) {
+				if (index >= record.vertex_count)
+					throw std::runtime_error(path + ": mesh " + std::to_string(m) + " refers to a vertex it does not have");
+			}
+			file.world.add_mesh(std::move(mesh));
+		}
+		if (header.instance_count > static_cast<size_t>(data_end - records) / sizeof(SCENE_INSTANCE_RECORD))
+			throw corrupt();
+		for (uint64_t i = 0; i < header.instance_count; i++) {
+			SCENE_INSTANCE_RECORD record;
+			std::memcpy(&record, records, sizeof(record));
+			records += sizeof(record);
+			if (record.mesh >= header.mesh_count)
+				throw std::runtime_error(path + ": instance " + std::to_string(i) + " has no mesh");
+			real m[12];
+			for (int k = 0; k < 12; k++)
+				m[k] = record.matrix[k];
+			try {
+				file.world.add_instance(record.mesh, affine_transform(m));
+			}
+			catch (const std::runtime_error& e) {
+				throw std::runtime_error(path + ": instance " + std::to_string(i) + ": " + e.what());
+			}
+		}
+		if (records != data_end)
+			throw corrupt();
+		return file;
+	}
+
+	inline bool is_binary_scene(const std::string& path) {
+		return path.size() > 5 && path.substr(path.size() - 5) == ".rtsb";
+	}
+
+	// throws std::runtime_error naming the file (and line) of what is wrong
+	inline SCENE_FILE load_scene_file(const std::string& path) {
+		return is_binary_scene(path) ? load_scene_binary(path) : load_scene_text(path);
+	}
+
+	/*
+		Writes file in the format its extension asks for, e.g. to turn a text
+		scene into a binary one. Materials nothing uses are left out; the binary
+		format stores single precision. A text scene refers to its meshes, which
+		are written next to it as <path>.mesh<k>.obj and placed by instance
+		statements. An animated scene only goes to a text file, the binary
+		format has no place for its frames and motions.
+	*/
+	inline void save_scene_file(const std::string& path, const SCENE_FILE& file) {
+		const ANIMATION& animation = file.animation;
+		if (is_binary_scene(path) && (animation.frames > 1 || animation.look_from || animation.look_at
+			|| !animation.spheres.empty() || !animation.instances.empty()))
+			throw std::runtime_error(path + ": binary scene files hold no animation, save the scene as text");
+
+		const sphere_pack& spheres = file.world.spheres();
+		std::unordered_map<const material*, uint32_t> ids;
+		std::vector<MATERIAL_DESCRIPTOR> materials;
+		std::vector<uint32_t> sphere_materials(spheres.size());
+		for (size_t i = 0; i < spheres.size(); i++) {
+			const material* mat = spheres.material_of(i);
+			const auto [it, inserted] = ids.emplace(mat, static_cast<uint32_t>(materials.size()));
+			if (inserted)
+				materials.push_back(mat->describe());
+			sphere_materials[i] = it->second;
+		}
+		const std::vector<triangle_mesh>& meshes = file.world.meshes();
+		std::vector<uint32_t> mesh_materials(meshes.size());
+		for (size_t k = 0; k < meshes.size(); k++) {
+			const auto [it, inserted] = ids.emplace(meshes[k].mat_ptr(), static_cast<uint32_t>(materials.size()));
+			if (inserted)
+				materials.push_back(meshes[k].mat_ptr()->describe());
+			mesh_materials[k] = it->second;
+		}
+
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		const RENDER_SETTINGS& settings = file.settings;
+		if (is_binary_scene(path)) {
+			SCENE_FILE_HEADER header;
+			header.image_width = settings.image_width;
+			header.image_height = settings.image_height;
+			header.samples_per_pixel = settings.samples_per_pixel;
+			header.max_depth = settings.max_depth;
+			header.rr_depth = settings.rr_depth;
+			header.material_count = static_cast<uint32_t>(materials.size());
+			header.seed = settings.seed;
+			header.sphere_count = spheres.size();
+			header.mesh_count = meshes.size();
+			header.instance_count = file.world.instances().size();
+			const CAM_DESCRIPTOR& camd = file.camera;
+			const auto store = [](const vec3& v, double* dst) {
+				dst[0] = v.x();
+				dst[1] = v.y();
+				dst[2] = v.z();
+			};
+			store(camd.look_from, header.look_from);
+			store(camd.look_at, header.look_at);
+			store(camd.up, header.up);
+			header.vfov = camd.vfov;
+			header.aperture = camd.aperture;
+			header.focus_dist = camd.focus_dist;
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			for (const MATERIAL_DESCRIPTOR& desc : materials) {
+				const SCENE_MATERIAL_RECORD record{ static_cast<uint32_t>(desc.kind),
+					{ static_cast<float>(desc.albedo.x()), static_cast<float>(desc.albedo.y()), static_cast<float>(desc.albedo.z()) },
+					static_cast<float>(desc.fuzz), static_cast<float>(desc.ior) };
+				out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			}
+			std::vector<SCENE_SPHERE_RECORD> records(spheres.size());
+			for (size_t i = 0; i < spheres.size(); i++) {
+				const point3 c = spheres.center(i);
+				records[i] = { { static_cast<float>(c.x()), static_cast<float>(c.y()), static_cast<float>(c.z()) },
+					static_cast<float>(spheres.radius(i)), sphere_materials[i] };
+			}
+			out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SCENE_SPHERE_RECORD));
+			for (size_t k = 0; k < meshes.size(); k++) {
+				const triangle_mesh& mesh = meshes[k];
+				const SCENE_MESH_RECORD record{ mesh_materials[k], static_cast<uint32_t>(mesh.vertex_count()), mesh.triangle_count() };
+				out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+				out.write(reinterpret_cast<const char*>(mesh.vertices().data()), mesh.vertex_count() * sizeof(MESH_VERTEX));
+				out.write(reinterpret_cast<const char*>(mesh.indices().data()), mesh.indices().size() * sizeof(uint32_t));
+			}
+			for (const MESH_INSTANCE& inst : file.world.instances()) {
+				SCENE_INSTANCE_RECORD record;
+				for (int k = 0; k < 12; k++)
+					record.matrix[k] = static_cast<float>(inst.transform.matrix()[k]);
+				record.mesh = inst.mesh;
+				out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			}
+		}
+		else {
+			out.precision(std::numeric_limits<double>::max_digits10);
+			const CAM_DESCRIPTOR& camd = file.camera;
+			const auto triple = [](const vec3& v) {
+				std::ostringstream text;
+				text.precision(std::numeric_limits<double>::max_digits10);
+				text << v.x() << ' ' << v.y() << ' ' << v.z();
+				return text.str();
+			};
+			out << "image " << settings.image_width << ' ' << settings.image_height << '\n'
+				<< "samples " << settings.samples_per_pixel << '\n'
+				<< "max_depth " << settings.max_depth << '\n'
+				<< "rr_depth " << settings.rr_depth << '\n'
+				<< "seed " << settings.seed << '\n'
+				<< "camera look_from " << triple(camd.look_from) << " look_at " << triple(camd.look_at) << " up " << triple(camd.up)
+				<< " vfov " << camd.vfov << " aperture " << camd.aperture << " focus_dist " << camd.focus_dist << '\n';
+			for (size_t m = 0; m < materials.size(); m++) {
+				const MATERIAL_DESCRIPTOR& desc = materials[m];
+				out << "material m" << m << ' ' << material_kind_name(desc.kind) << ' ' << triple(desc.albedo);
+				if (desc.kind == material_kind::metal)
+					out << " fuzz " << desc.fuzz;
+				if (desc.kind == material_kind::dielectric)
+					out << " ior " << desc.ior;
+				out << '\n';
+			}
+			for (size_t i = 0; i < spheres.size(); i++) {
+				const point3 c = spheres.center(i);
+				out << "sphere " << c.x() << ' ' << c.y() << ' ' << c.z() << ' ' << spheres.radius(i) << " m" << sphere_materials[i] << '\n';
+			}
+			for (size_t k = 0; k < meshes.size(); k++) {
+				const std::filesystem::path obj = path + ".mesh" + std::to_string(k) + ".obj";
+				save_obj(obj.string(), meshes[k]);
+				out << "object g" << k << ' ' << obj.filename().string() << " m" << mesh_materials[k] << '\n';
+			}
+			for (const MESH_INSTANCE& inst : file.world.instances()) {
+				out << "instance g" << inst.mesh;
+				if (!inst.transform.is_identity()) {
+					out << " matrix";
+					for (int k = 0; k < 12; k++)
+						out << ' ' << inst.transform.matrix()[k];
+				}
+				out << '\n';
+			}
+
+			const ANIMATION& animation = file.animation;
+			if (animation.frames > 1)
+				out << "frames " << animation.frames << '\n';
+			if (animation.look_from || animation.look_at) {
+				out << "animate camera";
+				if (animation.look_from)
+					out << " look_from " << triple(*animation.look_from);
+				if (animation.look_at)
+					out << " look_at " << triple(*animation.look_at);
+				out << '\n';
+			}
+			for (const SPHERE_MOTION& motion : animation.spheres)
+				out << "animate sphere " << motion.sphere << ' ' << triple(motion.to) << '\n';
+			for (const INSTANCE_MOTION& motion : animation.instances)
+				out << "animate instance " << motion.instance << " translate " << triple(motion.translate)
+					<< " rotate " << triple(motion.axis) << ' ' << motion.degrees << '\n';
+		}
+		if (!out)
+			throw std::runtime_error("cannot write " + path);
+	}
+}
+
+#endif //!SCENEFILE_HPP
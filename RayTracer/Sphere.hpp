@@ -7,29 +7,35 @@ namespace raytracer {
     class sphere : public hittable {
     public:
         sphere() = default;
-        sphere(point3 cen, double r, std::shared_ptr<material> m) 
+        sphere(point3 cen, real r, std::shared_ptr<material> m) 
+            : center(cen), radius(r), mat_ptr(m.get()), mat_owner(m) {}
+        // the material is owned elsewhere (e.g. by a material_arena)
+        sphere(point3 cen, real r, const material* m)
             : center(cen), radius(r), mat_ptr(m) {}
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
 
     public:
         point3 center;
-        double radius;
-        std::shared_ptr<material> mat_ptr;
+        real radius;
+        const material* mat_ptr;
+        std::shared_ptr<material> mat_owner;
     };
 
     bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        RT_COUNT(primitive_tests);
         vec3 oc = r.origin() - center;
-        double a = r.direction().length_squared();
-        double half_b = dot(oc, r.direction());
-        double c = oc.length_squared() - radius * radius;
+        real a = r.direction().length_squared();
+        real half_b = dot(oc, r.direction());
+        real c = oc.length_squared() - radius * radius;
 
-        double discriminant = half_b * half_b - a * c;
+        real discriminant = half_b * half_b - a * c;
         if (discriminant < 0) return false;
-        double sqrtd = std::sqrt(discriminant);
+        real sqrtd = std::sqrt(discriminant);
 
         // Find the nearest root that lies in the acceptable range.
-        double root = (-half_b - sqrtd) / a;
+        real root = (-half_b - sqrtd) / a;
         if (root < t_min || t_max < root) {
             root = (-half_b + sqrtd) / a;
             if (root < t_min || t_max < root)
@@ -44,6 +50,13 @@ namespace raytracer {
 
         return true;
     }
+
+    bool sphere::bounding_box(aabb& output_box) const {
+        real r = std::fabs(radius);
+        vec3 extent{ r, r, r };
+        output_box = aabb(center - extent, center + extent);
+        return true;
+    }
 }
 
 #endif //!SPHERE_HPP
\ No newline at end of file
@@ -0,0 +1,457 @@
+#ifndef SPHEREPACK_HPP
+#define SPHEREPACK_HPP
+
+#include "Hittable.hpp"
+#include <cstdint>
+#include <unordered_map>
+
+/*
+	Width of the batch intersection kernel, picked from the instruction set the
+	translation unit is compiled for (/arch:AVX2, -mavx2, -march=native, ...)
+	and from the scalar: a register holds twice as many floats as doubles.
+*/
+#if defined(__AVX512F__)
+	#define SPHERE_PACK_AVX512
+	#ifdef RT_FLOAT
+		#define SPHERE_PACK_LANES 16
+	#else
+		#define SPHERE_PACK_LANES 8
+	#endif
+#elif defined(__AVX__)
+	#define SPHERE_PACK_AVX
+	#ifdef RT_FLOAT
+		#define SPHERE_PACK_LANES 8
+	#else
+		#define SPHERE_PACK_LANES 4
+	#endif
+#else
+	#define SPHERE_PACK_LANES 1
+#endif
+
+#if SPHERE_PACK_LANES > 1
+	#include <immintrin.h>
+#endif
+
+namespace raytracer {
+
+	/*
+		Structure-of-arrays sphere collection: centers, radii and material ids sit
+		in separate contiguous arrays, so one ray is tested against SPHERE_PACK_LANES
+		spheres per instruction without a pointer chase or a virtual call per sphere.
+		The arrays carry lanes - 1 NaN spheres (which never hit) behind the last
+		one: a range starts anywhere (a bvh leaf's first sphere), and a batch load
+		from its last sphere still stays inside the arrays.
+	*/
+	class sphere_pack : public hittable {
+	public:
+		static constexpr size_t lanes = SPHERE_PACK_LANES;
+
+		sphere_pack() = default;
+
+		void reserve(size_t count) {
+			const size_t padded = padded_size(count);
+			m_cx.reserve(padded);
+			m_cy.reserve(padded);
+			m_cz.reserve(padded);
+			m_radius.reserve(padded);
+			m_material.reserve(count);
+		}
+
+		void add(const point3& center, real radius, const material* mat) {
+			trim();
+			m_cx.push_back(center.x());
+			m_cy.push_back(center.y());
+			m_cz.push_back(center.z());
+			m_radius.push_back(radius);
+			m_material.push_back(material_id(mat));
+			m_count++;
+			pad();
+		}
+
+		/*
+			Appends count spheres in one allocation and returns the index of the
+			first. They are filled in with set(), which different threads may call
+			for different spheres; scene loaders use this instead of add().
+		*/
+		size_t append(size_t count) {
+			trim();
+			const size_t first = m_count;
+			m_count += count;
+			m_cx.resize(m_count);
+			m_cy.resize(m_count);
+			m_cz.resize(m_count);
+			m_radius.resize(m_count);
+			m_material.resize(m_count);
+			pad();
+			return first;
+		}
+
+		// material is an index returned by material_id
+		void set(size_t i, const point3& center, real radius, uint32_t material) {
+			m_cx[i] = center.x();
+			m_cy[i] = center.y();
+			m_cz[i] = center.z();
+			m_radius[i] = radius;
+			m_material[i] = material;
+		}
+
+		void set_center(size_t i, const point3& center) {
+			m_cx[i] = center.x();
+			m_cy[i] = center.y();
+			m_cz[i] = center.z();
+		}
+
+		// index of mat in this pack's material table, added on first use
+		uint32_t material_id(const material* mat) {
+			auto it = m_material_ids.find(mat);
+			if (it != m_material_ids.end()) return it->second;
+			const uint32_t id = static_cast<uint32_t>(m_materials.size());
+			m_materials.push_back(mat);
+			m_material_ids.emplace(mat, id);
+			return id;
+		}
+
+		size_t size() const { return m_count; }
+
+		point3 center(size_t i) const { return point3(m_cx[i], m_cy[i], m_cz[i]); }
+		real radius(size_t i) const { return m_radius[i]; }
+		const material* material_of(size_t i) const { return m_materials[m_material[i]]; }
+		const material* material_by_id(uint32_t id) const { return m_materials[id]; }
+
+		aabb sphere_box(size_t i) const {
+			const real r = std::fabs(m_radius[i]);
+			const vec3 extent{ r, r, r };
+			return aabb(center(i) - extent, center(i) + extent);
+		}
+
+		// reorders the spheres so that the i-th one is the old order[i]-th (e.g. bvh leaf order)
+		void permute(const std::vector<uint32_t>& order) {
+			sphere_pack sorted;
+			sorted.m_materials = m_materials;
+			sorted.m_material_ids = m_material_ids;
+			sorted.append(order.size());
+			for (size_t i = 0; i < order.size(); i++)
+				sorted.set(i, center(order[i]), m_radius[order[i]], m_material[order[i]]);
+			*this = std::move(sorted);
+		}
+
+		/*
+			Closest hit among the spheres [first, first + count). On success closest
+			is lowered to the hit distance and index receives the sphere's index.
+		*/
+		bool hit_range(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			RT_COUNT_N(primitive_tests, count);
+#if defined(SPHERE_PACK_AVX512)
+			return hit_range_avx512(r, first, count, t_min, closest, index);
+#elif defined(SPHERE_PACK_AVX)
+			return hit_range_avx(r, first, count, t_min, closest, index);
+#else
+			return hit_range_scalar(r, first, count, t_min, closest, index);
+#endif
+		}
+
+		// fills rec for a hit at distance t with sphere index, as sphere::hit would
+		void fill_record(const ray& r, size_t index, real t, hit_record& rec) const {
+			rec.t = t;
+			rec.p = r.at(t);
+			vec3 outward_normal = (rec.p - center(index)) / m_radius[index];
+			rec.set_face_normal(r, outward_normal);
+			rec.mat_ptr = material_of(index);
+		}
+
+		virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+			size_t index;
+			real closest = t_max;
+			if (!hit_range(r, 0, m_count, t_min, closest, index))
+				return false;
+			fill_record(r, index, closest, rec);
+			return true;
+		}
+
+		virtual bool bounding_box(aabb& output_box) const override {
+			if (m_count == 0) return false;
+			output_box = aabb();
+			for (size_t i = 0; i < m_count; i++)
+				output_box.expand(sphere_box(i));
+			return true;
+		}
+
+		bool hit_range_scalar(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const real a = d.length_squared();
+			bool hit_anything = false;
+
+			for (size_t k = first; k < first + count; k++) {
+				const real ocx = o.x() - m_cx[k], ocy = o.y() - m_cy[k], ocz = o.z() - m_cz[k];
+				const real half_b = ocx * d.x() + ocy * d.y() + ocz * d.z();
+				const real c = (ocx * ocx + ocy * ocy + ocz * ocz) - m_radius[k] * m_radius[k];
+				const real discriminant = half_b * half_b - a * c;
+				if (discriminant < 0) continue;
+				const real sqrtd = std::sqrt(discriminant);
+
+				real root = (-half_b - sqrtd) / a;
+				if (root < t_min || closest < root) {
+					root = (-half_b + sqrtd) / a;
+					if (root < t_min || closest < root)
+						continue;
+				}
+				closest = root;
+				index = k;
+				hit_anything = true;
+			}
+			return hit_anything;
+		}
+
+	private:
+		static size_t padded_size(size_t count) {
+			return count + lanes - 1;
+		}
+
+		// drops the padding behind the last real sphere
+		void trim() {
+			m_cx.resize(m_count);
+			m_cy.resize(m_count);
+			m_cz.resize(m_count);
+			m_radius.resize(m_count);
+		}
+
+		void pad() {
+			const real nan = std::numeric_limits<real>::quiet_NaN();
+			const size_t padded = padded_size(m_count);
+			m_cx.resize(padded, nan);
+			m_cy.resize(padded, nan);
+			m_cz.resize(padded, nan);
+			m_radius.resize(padded, nan);
+		}
+
+#if defined(SPHERE_PACK_AVX) && !defined(RT_FLOAT)
+		bool hit_range_avx(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+			const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+			const __m256d a = _mm256_set1_pd(d.length_squared());
+			const __m256d tmin = _mm256_set1_pd(t_min);
+			const __m256d zero = _mm256_setzero_pd();
+			const __m256d lane_index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+			bool hit_anything = false;
+
+			for (size_t k = first; k < first + count; k += 4) {
+				const __m256d tmax = _mm256_set1_pd(closest);
+				const __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&m_cx[k]));
+				const __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&m_cy[k]));
+				const __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&m_cz[k]));
+				const __m256d rad = _mm256_loadu_pd(&m_radius[k]);
+
+				const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+				const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+				const __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rad, rad));
+				const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+
+				// lanes past the end of the range are masked off by their index
+				const __m256d in_range = _mm256_cmp_pd(lane_index, _mm256_set1_pd(static_cast<double>(first + count - k)), _CMP_LT_OQ);
+				const __m256d has_root = _mm256_and_pd(in_range, _mm256_cmp_pd(disc, zero, _CMP_GE_OQ));
+				if (_mm256_movemask_pd(has_root) == 0) continue;
+
+				const __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+				const __m256d neg_b = _mm256_sub_pd(zero, half_b);
+				const __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+				const __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+				const __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, tmin, _CMP_GE_OQ), _mm256_cmp_pd(near_root, tmax, _CMP_LE_OQ));
+				const __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_root, tmin, _CMP_GE_OQ), _mm256_cmp_pd(far_root, tmax, _CMP_LE_OQ));
+
+				const __m256d root = _mm256_blendv_pd(far_root, near_root, near_ok);
+				const int mask = _mm256_movemask_pd(_mm256_and_pd(has_root, _mm256_or_pd(near_ok, far_ok)));
+				if (mask == 0) continue;
+
+				alignas(32) double roots[4];
+				_mm256_store_pd(roots, root);
+				for (int lane = 0; lane < 4; lane++) {
+					if ((mask & (1 << lane)) && roots[lane] <= closest) {
+						closest = roots[lane];
+						index = k + lane;
+						hit_anything = true;
+					}
+				}
+			}
+			return hit_anything;
+		}
+#endif
+
+#if defined(SPHERE_PACK_AVX512) && !defined(RT_FLOAT)
+		bool hit_range_avx512(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const __m512d ox = _mm512_set1_pd(o.x()), oy = _mm512_set1_pd(o.y()), oz = _mm512_set1_pd(o.z());
+			const __m512d dx = _mm512_set1_pd(d.x()), dy = _mm512_set1_pd(d.y()), dz = _mm512_set1_pd(d.z());
+			const __m512d a = _mm512_set1_pd(d.length_squared());
+			const __m512d tmin = _mm512_set1_pd(t_min);
+			const __m512d zero = _mm512_setzero_pd();
+			bool hit_anything = false;
+
+			for (size_t k = first; k < first + count; k += 8) {
+				const size_t remaining = first + count - k;
+				const __mmask8 in_range = remaining >= 8 ? 0xff : static_cast<__mmask8>((1u << remaining) - 1);
+
+				const __m512d tmax = _mm512_set1_pd(closest);
+				const __m512d ocx = _mm512_sub_pd(ox, _mm512_loadu_pd(&m_cx[k]));
+				const __m512d ocy = _mm512_sub_pd(oy, _mm512_loadu_pd(&m_cy[k]));
+				const __m512d ocz = _mm512_sub_pd(oz, _mm512_loadu_pd(&m_cz[k]));
+				const __m512d rad = _mm512_loadu_pd(&m_radius[k]);
+
+				const __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+				const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+				const __m512d c = _mm512_sub_pd(oc2, _mm512_mul_pd(rad, rad));
+				const __m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(a, c));
+
+				const __mmask8 has_root = _mm512_mask_cmp_pd_mask(in_range, disc, zero, _CMP_GE_OQ);
+				if (has_root == 0) continue;
+
+				// lanes without a root are zero rather than left undefined
+				const __m512d sqrtd = _mm512_maskz_sqrt_pd(has_root, disc);
+				const __m512d neg_b = _mm512_sub_pd(zero, half_b);
+				const __m512d near_root = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), a);
+				const __m512d far_root = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), a);
+				const __mmask8 near_ok = _mm512_cmp_pd_mask(near_root, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(near_root, tmax, _CMP_LE_OQ);
+				const __mmask8 far_ok = _mm512_cmp_pd_mask(far_root, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(far_root, tmax, _CMP_LE_OQ);
+
+				const __mmask8 mask = has_root & (near_ok | far_ok);
+				if (mask == 0) continue;
+				const __m512d root = _mm512_mask_blend_pd(near_ok, far_root, near_root);
+
+				alignas(64) double roots[8];
+				_mm512_store_pd(roots, root);
+				for (int lane = 0; lane < 8; lane++) {
+					if ((mask & (1u << lane)) && roots[lane] <= closest) {
+						closest = roots[lane];
+						index = k + lane;
+						hit_anything = true;
+					}
+				}
+			}
+			return hit_anything;
+		}
+#endif
+
+#if defined(SPHERE_PACK_AVX) && defined(RT_FLOAT)
+		bool hit_range_avx(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()), oz = _mm256_set1_ps(o.z());
+			const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+			const __m256 a = _mm256_set1_ps(d.length_squared());
+			const __m256 tmin = _mm256_set1_ps(t_min);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 lane_index = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+			bool hit_anything = false;
+
+			for (size_t k = first; k < first + count; k += 8) {
+				const __m256 tmax = _mm256_set1_ps(closest);
+				const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&m_cx[k]));
+				const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&m_cy[k]));
+				const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&m_cz[k]));
+				const __m256 rad = _mm256_loadu_ps(&m_radius[k]);
+
+				const __m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+				const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+				const __m256 c = _mm256_sub_ps(oc2, _mm256_mul_ps(rad, rad));
+				const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(a, c));
+
+				const __m256 in_range = _mm256_cmp_ps(lane_index, _mm256_set1_ps(static_cast<float>(first + count - k)), _CMP_LT_OQ);
+				const __m256 has_root = _mm256_and_ps(in_range, _mm256_cmp_ps(disc, zero, _CMP_GE_OQ));
+				if (_mm256_movemask_ps(has_root) == 0) continue;
+
+				const __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+				const __m256 neg_b = _mm256_sub_ps(zero, half_b);
+				const __m256 near_root = _mm256_div_ps(_mm256_sub_ps(neg_b, sqrtd), a);
+				const __m256 far_root = _mm256_div_ps(_mm256_add_ps(neg_b, sqrtd), a);
+				const __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(near_root, tmin, _CMP_GE_OQ), _mm256_cmp_ps(near_root, tmax, _CMP_LE_OQ));
+				const __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(far_root, tmin, _CMP_GE_OQ), _mm256_cmp_ps(far_root, tmax, _CMP_LE_OQ));
+
+				const __m256 root = _mm256_blendv_ps(far_root, near_root, near_ok);
+				const int mask = _mm256_movemask_ps(_mm256_and_ps(has_root, _mm256_or_ps(near_ok, far_ok)));
+				if (mask == 0) continue;
+
+				alignas(32) float roots[8];
+				_mm256_store_ps(roots, root);
+				for (int lane = 0; lane < 8; lane++) {
+					if ((mask & (1 << lane)) && roots[lane] <= closest) {
+						closest = roots[lane];
+						index = k + lane;
+						hit_anything = true;
+					}
+				}
+			}
+			return hit_anything;
+		}
+#endif
+
+#if defined(SPHERE_PACK_AVX512) && defined(RT_FLOAT)
+		bool hit_range_avx512(const ray& r, size_t first, size_t count, real t_min, real& closest, size_t& index) const {
+			const point3 o = r.origin();
+			const vec3 d = r.direction();
+			const __m512 ox = _mm512_set1_ps(o.x()), oy = _mm512_set1_ps(o.y()), oz = _mm512_set1_ps(o.z());
+			const __m512 dx = _mm512_set1_ps(d.x()), dy = _mm512_set1_ps(d.y()), dz = _mm512_set1_ps(d.z());
+			const __m512 a = _mm512_set1_ps(d.length_squared());
+			const __m512 tmin = _mm512_set1_ps(t_min);
+			const __m512 zero = _mm512_setzero_ps();
+			bool hit_anything = false;
+
+			for (size_t k = first; k < first + count; k += 16) {
+				const size_t remaining = first + count - k;
+				const __mmask16 in_range = remaining >= 16 ? 0xffff : static_cast<__mmask16>((1u << remaining) - 1);
+
+				const __m512 tmax = _mm512_set1_ps(closest);
+				const __m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&m_cx[k]));
+				const __m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&m_cy[k]));
+				const __m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&m_cz[k]));
+				const __m512 rad = _mm512_loadu_ps(&m_radius[k]);
+
+				const __m512 half_b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, dx), _mm512_mul_ps(ocy, dy)), _mm512_mul_ps(ocz, dz));
+				const __m512 oc2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz));
+				const __m512 c = _mm512_sub_ps(oc2, _mm512_mul_ps(rad, rad));
+				const __m512 disc = _mm512_sub_ps(_mm512_mul_ps(half_b, half_b), _mm512_mul_ps(a, c));
+
+				const __mmask16 has_root = _mm512_mask_cmp_ps_mask(in_range, disc, zero, _CMP_GE_OQ);
+				if (has_root == 0) continue;
+
+				// lanes without a root are zero rather than left undefined
+				const __m512 sqrtd = _mm512_maskz_sqrt_ps(has_root, disc);
+				const __m512 neg_b = _mm512_sub_ps(zero, half_b);
+				const __m512 near_root = _mm512_div_ps(_mm512_sub_ps(neg_b, sqrtd), a);
+				const __m512 far_root = _mm512_div_ps(_mm512_add_ps(neg_b, sqrtd), a);
+				const __mmask16 near_ok = _mm512_cmp_ps_mask(near_root, tmin, _CMP_GE_OQ) & _mm512_cmp_ps_mask(near_root, tmax, _CMP_LE_OQ);
+				const __mmask16 far_ok = _mm512_cmp_ps_mask(far_root, tmin, _CMP_GE_OQ) & _mm512_cmp_ps_mask(far_root, tmax, _CMP_LE_OQ);
+
+				const __mmask16 mask = has_root & (near_ok | far_ok);
+				if (mask == 0) continue;
+				const __m512 root = _mm512_mask_blend_ps(near_ok, far_root, near_root);
+
+				alignas(64) float roots[16];
+				_mm512_store_ps(roots, root);
+				for (int lane = 0; lane < 16; lane++) {
+					if ((mask & (1u << lane)) && roots[lane] <= closest) {
+						closest = roots[lane];
+						index = k + lane;
+						hit_anything = true;
+					}
+				}
+			}
+			return hit_anything;
+		}
+#endif
+
+	private:
+		//member data
+		std::vector<real> m_cx, m_cy, m_cz;
+		std::vector<real> m_radius;
+		std::vector<uint32_t> m_material;				// index into m_materials
+		std::vector<const material*> m_materials;		// distinct materials, usually few
+		std::unordered_map<const material*, uint32_t> m_material_ids;
+		size_t m_count = 0;
+		//!member data
+	};
+}
+
+#endif //!SPHEREPACK_HPP
\ No newline at end of file
@@ -0,0 +1,225 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer {
+
+	// time a worker spent running tasks vs. looking for / waiting on work during one dispatch
+	struct WORKER_TIMES {
+		double busy_ms = 0.0;
+		double idle_ms = 0.0;
+		size_t tasks = 0;
+		size_t steals = 0;
+	};
+
+	//-----------TILES-----------
+	struct tile {
+		unsigned int x0, y0; // inclusive
+		unsigned int x1, y1; // exclusive
+	};
+
+	// interleaves the lower 16 bits of x and y (x in the even bits)
+	inline uint32_t morton2d(uint32_t x, uint32_t y) {
+		const auto spread = [](uint32_t v) {
+			v &= 0x0000ffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+		return spread(x) | (spread(y) << 1);
+	}
+
+	/*
+		Splits the image into tile_size x tile_size tiles (clipped at the borders)
+		sorted along a Z-order curve, so that any contiguous run of tiles covers
+		a compact region of the image.
+	*/
+	inline std::vector<tile> make_morton_tiles(unsigned int width, unsigned int height, unsigned int tile_size) {
+		if (tile_size == 0) tile_size = 32;
+		const unsigned int tx = (width + tile_size - 1) / tile_size;
+		const unsigned int ty = (height + tile_size - 1) / tile_size;
+
+		std::vector<std::pair<uint32_t, tile>> keyed;
+		keyed.reserve(static_cast<size_t>(tx) * ty);
+		for (unsigned int y = 0; y < ty; y++) {
+			for (unsigned int x = 0; x < tx; x++) {
+				tile t{ x * tile_size, y * tile_size,
+					std::min(width, (x + 1) * tile_size), std::min(height, (y + 1) * tile_size) };
+				keyed.emplace_back(morton2d(x, y), t);
+			}
+		}
+		std::sort(keyed.begin(), keyed.end(),
+			[](const auto& a, const auto& b) { return a.first < b.first; });
+
+		std::vector<tile> tiles(keyed.size());
+		for (size_t i = 0; i < keyed.size(); i++)
+			tiles[i] = keyed[i].second;
+		return tiles;
+	}
+	//!-----------TILES-----------
+
+	/*
+		Persistent pool of workers, each with its own task deque. A dispatch hands
+		every worker a contiguous chunk of the task range; a worker pops from the front
+		of its own deque and, once that runs dry, steals from the back of the others'.
+		Tasks never spawn tasks, so a worker that finds every deque empty is done.
+	*/
+	class thread_pool {
+	public:
+		using task_fn = std::function<void(size_t task, unsigned int worker)>;
+
+		explicit thread_pool(unsigned int nthreads = 0) {
+			if (nthreads == 0)
+				nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+			m_queues = std::vector<worker_queue>(nthreads);
+			m_times.resize(nthreads);
+			m_workers.reserve(nthreads);
+			for (unsigned int id = 0; id < nthreads; id++)
+				m_workers.emplace_back(&thread_pool::worker_loop, this, id);
+		}
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		~thread_pool() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+			for (std::thread& worker : m_workers)
+				worker.join();
+		}
+
+		unsigned int size() const { return static_cast<unsigned int>(m_workers.size()); }
+
+		// runs task(i, worker) for every i in [0, count) and blocks until all of them finished
+		std::vector<WORKER_TIMES> run(size_t count, const task_fn& task) {
+			const size_t nworkers = m_workers.size();
+			const size_t chunk = (count + nworkers - 1) / nworkers;
+			for (size_t w = 0; w < nworkers; w++) {
+				std::lock_guard<std::mutex> lock(m_queues[w].mutex);
+				m_queues[w].tasks.clear();
+				for (size_t i = w * chunk; i < std::min(count, (w + 1) * chunk); i++)
+					m_queues[w].tasks.push_back(i);
+			}
+
+			const auto start = clock::now();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_task = &task;
+				m_finished = 0;
+				m_times.assign(nworkers, WORKER_TIMES{});
+				m_generation++;
+			}
+			m_wake.notify_all();
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [&]() { return m_finished == nworkers; });
+			m_task = nullptr;
+
+			// everything a worker did not spend running tasks within the dispatch counts as idle
+			const double wall_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+			for (WORKER_TIMES& t : m_times)
+				t.idle_ms = std::max(0.0, wall_ms - t.busy_ms);
+			return m_times;
+		}
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		struct worker_queue {
+			std::mutex mutex;
+			std::deque<size_t> tasks;
+		};
+
+		bool pop_own(unsigned int id, size_t& task) {
+			worker_queue& q = m_queues[id];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (q.tasks.empty()) return false;
+			task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+
+		bool steal(unsigned int id, size_t& task) {
+			const size_t n = m_queues.size();
+			for (size_t k = 1; k < n; k++) {
+				worker_queue& q = m_queues[(id + k) % n];
+				std::lock_guard<std::mutex> lock(q.mutex);
+				if (q.tasks.empty()) continue;
+				task = q.tasks.back();
+				q.tasks.pop_back();
+				return true;
+			}
+			return false;
+		}
+
+		void worker_loop(unsigned int id) {
+			uint64_t seen = 0;
+			while (true) {
+				const task_fn* task_ptr;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+					if (m_stop) return;
+					seen = m_generation;
+					task_ptr = m_task;
+				}
+
+				WORKER_TIMES times;
+				size_t task;
+				while (true) {
+					bool stolen = false;
+					if (!pop_own(id, task)) {
+						if (!steal(id, task)) break;
+						stolen = true;
+					}
+
+					const auto begin = clock::now();
+					(*task_ptr)(task, id);
+					times.busy_ms += std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+					times.tasks++;
+					times.steals += stolen;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_times[id] = times;
+					if (++m_finished == m_workers.size())
+						m_done.notify_one();
+				}
+			}
+		}
+
+	private:
+		//member data
+		std::vector<std::thread> m_workers;
+		std::vector<worker_queue> m_queues;
+		std::vector<WORKER_TIMES> m_times;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		const task_fn* m_task = nullptr;
+		uint64_t m_generation = 0;
+		size_t m_finished = 0;
+		bool m_stop = false;
+		//!member data
+	};
+}
+
+#endif //!THREADPOOL_HPP
\ No newline at end of file
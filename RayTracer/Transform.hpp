@@ -0,0 +1,143 @@
+#ifndef TRANSFORM_HPP
+#define TRANSFORM_HPP
+
+#include "Aabb.hpp"
+#include "Ray.hpp"
+#include <cmath>
+#include <stdexcept>
+
+namespace raytracer {
+
+	/*
+		Affine map from object to world space, as 3x4 row major matrices:
+		the linear part in columns 0-2, the translation in column 3. The inverse
+		is computed once when the transform is made, so taking a ray to object
+		space is a matrix product and no division.
+	*/
+	class affine_transform {
+	public:
+		// identity
+		affine_transform() = default;
+
+		// throws std::runtime_error if the linear part is singular
+		explicit affine_transform(const real (&m)[12]) {
+			for (int i = 0; i < 12; i++)
+				m_to_world[i] = m[i];
+			invert();
+		}
+
+		static affine_transform translate(const vec3& v) {
+			const real m[12] = { 1, 0, 0, v.x(), 0, 1, 0, v.y(), 0, 0, 1, v.z() };
+			return affine_transform(m);
+		}
+
+		static affine_transform scale(const vec3& s) {
+			const real m[12] = { s.x(), 0, 0, 0, 0, s.y(), 0, 0, 0, 0, s.z(), 0 };
+			return affine_transform(m);
+		}
+
+		// counter-clockwise looking down the axis towards the origin
+		static affine_transform rotate(const vec3& axis, real degrees) {
+			const vec3 a = unit_vector(axis);
+			const real angle = static_cast<real>(degrees_to_radians(degrees));
+			const real c = std::cos(angle), s = std::sin(angle), k = 1 - c;
+			const real x = a.x(), y = a.y(), z = a.z();
+			const real m[12] = {
+				c + x * x * k,		x * y * k - z * s,	x * z * k + y * s,	0,
+				y * x * k + z * s,	c + y * y * k,		y * z * k - x * s,	0,
+				z * x * k - y * s,	z * y * k + x * s,	c + z * z * k,		0 };
+			return affine_transform(m);
+		}
+
+		// b first, then a
+		friend affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+			const real* l = a.m_to_world;
+			const real* r = b.m_to_world;
+			real m[12];
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 4; j++)
+					m[4 * i + j] = l[4 * i] * r[j] + l[4 * i + 1] * r[4 + j] + l[4 * i + 2] * r[8 + j] + (j == 3 ? l[4 * i + 3] : 0);
+			}
+			return affine_transform(m);
+		}
+
+		point3 point_to_world(const point3& p) const { return apply(m_to_world, p, 1); }
+		vec3 vector_to_world(const vec3& v) const { return apply(m_to_world, v, 0); }
+		point3 point_to_object(const point3& p) const { return apply(m_to_object, p, 1); }
+		vec3 vector_to_object(const vec3& v) const { return apply(m_to_object, v, 0); }
+
+		// normals go by the inverse transpose; not normalized
+		vec3 normal_to_world(const vec3& n) const {
+			const real* m = m_to_object;
+			return vec3(m[0] * n.x() + m[4] * n.y() + m[8] * n.z(),
+				m[1] * n.x() + m[5] * n.y() + m[9] * n.z(),
+				m[2] * n.x() + m[6] * n.y() + m[10] * n.z());
+		}
+
+		// the direction is not normalized, so a hit's distance t is the same in both spaces
+		ray to_object(const ray& r) const {
+			return ray(point_to_object(r.origin()), vector_to_object(r.direction()));
+		}
+
+		// bounds of the transformed box, from its center and half extent (Arvo)
+		aabb box_to_world(const aabb& box) const {
+			if (box.empty()) return box;
+			const point3 center = point_to_world(box.centroid());
+			const vec3 half = 0.5 * (box.max() - box.min());
+			const real* m = m_to_world;
+			const vec3 extent(std::fabs(m[0]) * half.x() + std::fabs(m[1]) * half.y() + std::fabs(m[2]) * half.z(),
+				std::fabs(m[4]) * half.x() + std::fabs(m[5]) * half.y() + std::fabs(m[6]) * half.z(),
+				std::fabs(m[8]) * half.x() + std::fabs(m[9]) * half.y() + std::fabs(m[10]) * half.z());
+			return aabb(center - extent, center + extent);
+		}
+
+		// the 12 values of the object to world matrix, row by row
+		const real* matrix() const { return m_to_world; }
+
+		bool is_identity() const {
+			const affine_transform identity;
+			for (int i = 0; i < 12; i++) {
+				if (m_to_world[i] != identity.m_to_world[i]) return false;
+			}
+			return true;
+		}
+
+	private:
+		static vec3 apply(const real* m, const vec3& v, real w) {
+			return vec3(m[0] * v.x() + m[1] * v.y() + m[2] * v.z() + w * m[3],
+				m[4] * v.x() + m[5] * v.y() + m[6] * v.z() + w * m[7],
+				m[8] * v.x() + m[9] * v.y() + m[10] * v.z() + w * m[11]);
+		}
+
+		// inverse of the linear part by cofactors, in double; the translation follows from it
+		void invert() {
+			const real* m = m_to_world;
+			const double c00 = double(m[5]) * m[10] - double(m[6]) * m[9];
+			const double c01 = double(m[6]) * m[8] - double(m[4]) * m[10];
+			const double c02 = double(m[4]) * m[9] - double(m[5]) * m[8];
+			const double det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+			if (!(std::fabs(det) > 1e-12) || !std::isfinite(det))
+				throw std::runtime_error("transform is not invertible");
+			const double inv = 1 / det;
+			double l[9] = {
+				c00, double(m[2]) * m[9] - double(m[1]) * m[10], double(m[1]) * m[6] - double(m[2]) * m[5],
+				c01, double(m[0]) * m[10] - double(m[2]) * m[8], double(m[2]) * m[4] - double(m[0]) * m[6],
+				c02, double(m[1]) * m[8] - double(m[0]) * m[9], double(m[0]) * m[5] - double(m[1]) * m[4] };
+			for (double& x : l)
+				x *= inv;
+			for (int i = 0; i < 3; i++) {
+				m_to_object[4 * i] = static_cast<real>(l[3 * i]);
+				m_to_object[4 * i + 1] = static_cast<real>(l[3 * i + 1]);
+				m_to_object[4 * i + 2] = static_cast<real>(l[3 * i + 2]);
+				m_to_object[4 * i + 3] = static_cast<real>(-(l[3 * i] * m[3] + l[3 * i + 1] * m[7] + l[3 * i + 2] * m[11]));
+			}
+		}
+
+		//member data
+		real m_to_world[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+		real m_to_object[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+		//!member data
+	};
+}
+
+#endif //!TRANSFORM_HPP
@@ -8,19 +8,19 @@
 
 namespace raytracer {
 
-	class vec3 {
+	class alignas(VEC3_ALIGNMENT) vec3 {
 	public:
 		// Constructors
 		vec3() : e{0, 0, 0} {}
-		vec3(double ex, double ey, double ez)
+		vec3(real ex, real ey, real ez)
 			: e{ex, ey, ez} {}
 		vec3(const vec3& v)
 			: e{v.x(), v.y(), v.z()} {}
 
 		// Functions
-		double x() const { return e[0]; }
-		double y() const { return e[1]; }
-		double z() const { return e[2]; }
+		real x() const { return e[0]; }
+		real y() const { return e[1]; }
+		real z() const { return e[2]; }
 
 		bool near_zero() const {
 			// Return true if the vector is close to zero in all dimensions.
@@ -29,11 +29,11 @@ namespace raytracer {
 		}
 
 		static vec3 random() {
-			return vec3(random_double(), random_double(), random_double());
+			return vec3(random_real(), random_real(), random_real());
 		}
 
-		static vec3 random(double min, double max) {
-			return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+		static vec3 random(real min, real max) {
+			return vec3(random_real(min, max), random_real(min, max), random_real(min, max));
 		}
 
 		// Operators
@@ -45,28 +45,28 @@ namespace raytracer {
 			return *this;
 		}
 
-		vec3& operator*=(const double t) {
+		vec3& operator*=(const real t) {
 			e[0] *= t;
 			e[1] *= t;
 			e[2] *= t;
 			return *this;
 		}
 
-		vec3& operator/=(const double t) {
+		vec3& operator/=(const real t) {
 			return *this *= 1 / t;
 		}
 
-		double length() const {
+		real length() const {
 			return std::sqrt(length_squared());
 		}
 
-		double length_squared() const {
+		real length_squared() const {
 			return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
 		}
 
 	private:
 		//member data
-		double e[3];
+		real e[3];
 		//!member data
 	};
 
@@ -93,19 +93,19 @@ namespace raytracer {
 		return vec3(u.x() * v.x(), u.y() * v.y(), u.z() * v.z());
 	}
 
-	inline vec3 operator*(double t, const vec3& v) {
+	inline vec3 operator*(real t, const vec3& v) {
 		return vec3(t * v.x(), t * v.y(), t * v.z());
 	}
 
-	inline vec3 operator*(const vec3& v, double t) {
+	inline vec3 operator*(const vec3& v, real t) {
 		return t * v;
 	}
 
-	inline vec3 operator/(vec3 v, double t) {
+	inline vec3 operator/(vec3 v, real t) {
 		return (1 / t) * v;
 	}
 
-	inline double dot(const vec3& u, const vec3& v) {
+	inline real dot(const vec3& u, const vec3& v) {
 		return u.x() * v.x()
 			+ u.y() * v.y()
 			+ u.z() * v.z();
@@ -125,6 +125,17 @@ namespace raytracer {
 		}
 	}
 
+	// uniform on the unit disk in the xy plane; x is drawn before y
+	inline vec3 random_in_unit_disk() {
+		while (true) {
+			const real x = random_real(-1, 1);
+			const real y = random_real(-1, 1);
+			const vec3 p(x, y, 0);
+			if (p.length_squared() >= 1) continue;
+			return p;
+		}
+	}
+
 	inline vec3 unit_vector(vec3 v) {
 		return v / v.length();
 	}
@@ -144,6 +155,14 @@ namespace raytracer {
 	vec3 reflect(const vec3& v, const vec3& n) {
 		return v - 2 * dot(v, n) * n;
 	}
+
+	// Snell's law for the unit vector uv through a surface with normal n against it
+	inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+		const real cos_theta = std::fmin(-dot(uv, n), real(1));
+		const vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
+		const vec3 r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
+		return r_out_perp + r_out_parallel;
+	}
 }
 
 
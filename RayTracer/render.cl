@@ -1,194 +1,334 @@
-// -----------RANDOM-----------
-// Define the Mersenne Twister parameters
-#define MT_N 624
-#define MT_M 397
-#define MT_MATRIX_A 0x9908b0dfUL
-#define MT_UPPER_MASK 0x80000000UL
-#define MT_LOWER_MASK 0x7fffffffUL
-
-// Initialize the random number generator with a seed
-void initialize_rng(__global unsigned int* state, unsigned int seed, unsigned int index) {
-    state[index] = seed;
-}
-
-// Generate a random unsigned integer
-unsigned int generate_random_uint(__global unsigned int* state, unsigned int index) {
-    unsigned int y;
-
-    if (index >= MT_N) {
-        for (int i = 0; i < MT_N - MT_M; i++) {
-            y = (state[i] & MT_UPPER_MASK) | (state[i + 1] & MT_LOWER_MASK);
-            state[i] = state[i + MT_M] ^ (y >> 1) ^ (-(y & 1) & MT_MATRIX_A);
-        }
+/*
+	Path tracing kernel of the OpenCL backend (adrenaline::render_w_opencl).
+	The scene comes in the flat layout of DeviceScene.hpp, the structs below
+	mirror it field by field. Everything is float and plain C: no vector types,
+	no images, no double, so it builds on any OpenCL 1.2 runtime, POCL's CPU
+	device included. It is device::render_sample line by line.
+*/
+
+//-----------SCENE-----------
+typedef struct {
+	float min[3];
+	uint offset;	// leaf: index of the first sphere, interior: index of the second child
+	float max[3];
+	ushort count;	// number of spheres in a leaf, 0 for interior nodes
+	ushort axis;	// split axis of an interior node
+} DEVICE_NODE;
 
-        for (int i = MT_N - MT_M; i < MT_N - 1; i++) {
-            y = (state[i] & MT_UPPER_MASK) | (state[i + 1] & MT_LOWER_MASK);
-            state[i] = state[i + (MT_M - MT_N)] ^ (y >> 1) ^ (-(y & 1) & MT_MATRIX_A);
-        }
+typedef struct {
+	float center[3];
+	float radius;
+} DEVICE_SPHERE;
 
-        y = (state[MT_N - 1] & MT_UPPER_MASK) | (state[0] & MT_LOWER_MASK);
-        state[MT_N - 1] = state[MT_M - 1] ^ (y >> 1) ^ (-(y & 1) & MT_MATRIX_A);
+// material_kind
+#define MATERIAL_LAMBERTIAN 0
+#define MATERIAL_METAL 1
+#define MATERIAL_DIELECTRIC 2
+#define MATERIAL_EMISSIVE 3
 
-        index = 0;
-    }
+typedef struct {
+	uint kind;
+	float albedo[3];
+	float fuzz;
+	float ior;
+} DEVICE_MATERIAL;
 
-    y = state[index];
-    index++;
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
+typedef struct {
+	float origin[3];
+	float lower_left_corner[3];
+	float horizontal[3];
+	float vertical[3];
+	float lens_u[3];	// camera right and up, the lens offset's axes
+	float lens_v[3];
+	float lens_radius;	// 0 = pinhole
+} DEVICE_CAMERA;
 
-    return y;
+typedef struct {
+	ulong seed;
+	uint width;
+	uint height;
+	int samples_per_pixel;
+	int max_depth;
+	int rr_depth;
+	uint node_count;
+} DEVICE_RENDER_PARAMS;
+
+// the bvh's depth bound, bvh_tree::stack_size
+#define STACK_SIZE 128
+//!-----------SCENE-----------
+
+//-----------RANDOM-----------
+/*
+	PCG32 as in Utility.hpp. Every sample keys its own generator from the
+	(seed, pixel, sample) counter, so work-items share no state and the
+	sequence of a sample does not depend on which work-item renders it.
+*/
+typedef struct {
+	ulong state;
+	ulong inc;
+} pcg32;
+
+uint pcg32_next(pcg32* rng) {
+	ulong old_state = rng->state;
+	rng->state = old_state * 6364136223846793005UL + rng->inc;
+	uint xorshifted = (uint)(((old_state >> 18) ^ old_state) >> 27);
+	uint rot = (uint)(old_state >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
 }
 
-// Generate a random double in the range [0, 1)
-double random_double(__global unsigned int* state, unsigned int index) {
-    return generate_random_uint(state, index) * (1.0 / 4294967296.0);
+void pcg32_seed(pcg32* rng, ulong init_state, ulong stream) {
+	rng->state = 0;
+	rng->inc = (stream << 1) | 1;
+	pcg32_next(rng);
+	rng->state += init_state;
+	pcg32_next(rng);
 }
-//!-----------RANDOM-----------
-
-//-----------VECTOR-----------
-typedef double3 point3;
-typedef double3 vec3;
-typedef int3	color;
 
-vec3 unit_vector(vec3 dir) {
-	return dir / length(dir);
+ulong mix64(ulong x) {
+	x += 0x9e3779b97f4a7c15UL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+	return x ^ (x >> 31);
 }
 
-double dot(__const vec3* u, __const vec3* v) {
-	return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+// uniform in [0, 1), 24 bits
+float next_float(pcg32* rng) {
+	return (pcg32_next(rng) >> 8) * (1.0f / 16777216.0f);
 }
-//!-----------VECTOR-----------
+//!-----------RANDOM-----------
 
-//-----------RAY-----------
+//-----------VECTOR-----------
 typedef struct {
-
-	point3 origin;
-	vec3 dir;
-
-} ray;
-//!-----------RAY-----------
-
-//-----------UTILITY-----------
-double clamp(double x, double min, double max) {
-	if (x < min) return min;
-	if (x > max) return max;
-	return x;
+	float x, y, z;
+} fvec3;
+
+fvec3 make_fvec3(float x, float y, float z) {
+	fvec3 v;
+	v.x = x;
+	v.y = y;
+	v.z = z;
+	return v;
 }
-//!-----------UTILITY-----------
 
-//-----------CAM-----------
-typedef struct {
+fvec3 load3(const float* v) { return make_fvec3(v[0], v[1], v[2]); }
+fvec3 add3(fvec3 a, fvec3 b) { return make_fvec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+fvec3 sub3(fvec3 a, fvec3 b) { return make_fvec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+fvec3 mul3(fvec3 a, fvec3 b) { return make_fvec3(a.x * b.x, a.y * b.y, a.z * b.z); }
+fvec3 scale3(float s, fvec3 a) { return make_fvec3(s * a.x, s * a.y, s * a.z); }
+float dot3(fvec3 a, fvec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+fvec3 normalize3(fvec3 a) { return scale3(1.0f / sqrt(dot3(a, a)), a); }
+
+fvec3 random_in_unit_sphere(pcg32* rng) {
+	while (true) {
+		const float x = 2 * next_float(rng) - 1;
+		const float y = 2 * next_float(rng) - 1;
+		const float z = 2 * next_float(rng) - 1;
+		const fvec3 p = make_fvec3(x, y, z);
+		if (dot3(p, p) < 1)
+			return p;
+	}
+}
 
-	double aspect_ratio;
-	double viewport_height;
-	double focal_length;
-	double viewport_width;
-
-	double3 horizontal;
-	double3 vertical;
-	point3 origin;
-	point3 lower_left_corner;
-
-} CAM_DESCRIPTOR;
-
-ray get_ray(CAM_DESCRIPTOR* cam, double* u, double* v) {
-	return (ray) {
-		.origin = cam->origin,
-		.dir = cam->lower_left_corner
-			+ u * cam->horizontal,
-			+ v * cam->vertical,
-			- cam->origin
-	};
+fvec3 random_unit_vector(pcg32* rng) {
+	while (true) {
+		const fvec3 p = random_in_unit_sphere(rng);
+		const float len2 = dot3(p, p);
+		if (len2 > 0)
+			return scale3(1.0f / sqrt(len2), p);
+	}
 }
-//!-----------CAM-----------
+//!-----------VECTOR-----------
 
 //-----------HITTABLE-----------
-typedef struct {
-	point3 p;
-	vec3 normal;
-	double t;
-	bool front_face;
-} hit_record;
-
-void set_face_normal(hit_record* rec, const ray* r, const vec3* outward_normal) {
-	rec->front_face = dot(r->dir, outward_normal) < 0;
-	rec->normal = rec->front_face ? outward_normal : (-1)*outward_normal;
+bool hit_box(__global const DEVICE_NODE* node, fvec3 o, fvec3 inv_d, float t_min, float t_max) {
+	const float org[3] = { o.x, o.y, o.z };
+	const float inv[3] = { inv_d.x, inv_d.y, inv_d.z };
+	for (int a = 0; a < 3; a++) {
+		float t0 = (node->min[a] - org[a]) * inv[a];
+		float t1 = (node->max[a] - org[a]) * inv[a];
+		if (inv[a] < 0) { const float tmp = t0; t0 = t1; t1 = tmp; }
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if (t_max < t_min) return false;
+	}
+	return true;
 }
 
-bool hittable_list_hit(const ray* r, double t_min, double t_max, hit_record* rec) {
-	hit_record temp_rec;
+// closest hit beyond t_min through the bvh; t is lowered to it, prim receives the sphere
+bool closest_hit(__global const DEVICE_NODE* nodes, uint node_count, __global const DEVICE_SPHERE* spheres,
+	fvec3 o, fvec3 d, float t_min, float* t, uint* prim)
+{
+	if (node_count == 0) return false;
+	const fvec3 inv_d = make_fvec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+	const float a = dot3(d, d);
+
+	uint stack[STACK_SIZE];
+	int sp = 0;
+	uint current = 0;
 	bool hit_anything = false;
-	double closest_so_far = t_max;
-
-	/*
-		for(__const ) {
-			if() {
-				hit_anything = true;
-				closest_so_far = temp_rec.t;
-				*rec = temp_rec;
+	while (true) {
+		__global const DEVICE_NODE* node = &nodes[current];
+		if (hit_box(node, o, inv_d, t_min, *t)) {
+			if (node->count > 0) {
+				for (uint k = node->offset; k < node->offset + node->count; k++) {
+					const fvec3 center = make_fvec3(spheres[k].center[0], spheres[k].center[1], spheres[k].center[2]);
+					const float radius = spheres[k].radius;
+					const fvec3 oc = sub3(o, center);
+					const float half_b = dot3(oc, d);
+					const float c = dot3(oc, oc) - radius * radius;
+					const float discriminant = half_b * half_b - a * c;
+					if (discriminant < 0) continue;
+					const float sqrtd = sqrt(discriminant);
+					float root = (-half_b - sqrtd) / a;
+					if (root < t_min || *t < root) {
+						root = (-half_b + sqrtd) / a;
+						if (root < t_min || *t < root) continue;
+					}
+					*t = root;
+					*prim = k;
+					hit_anything = true;
+				}
+			}
+			else {
+				const bool neg = node->axis == 0 ? d.x < 0 : node->axis == 1 ? d.y < 0 : d.z < 0;
+				stack[sp++] = neg ? current + 1 : node->offset;
+				current = neg ? node->offset : current + 1;
+				continue;
 			}
 		}
-	*/
+		if (sp == 0) break;
+		current = stack[--sp];
+	}
 	return hit_anything;
 }
 //!-----------HITTABLE-----------
 
-//-----------STATS-----------
-typedef struct {
-
-	double aspect_ratio;
-	unsigned int image_width;
-	unsigned int image_height;
-	int samples_per_pixel;
-
-} STATS_DESCRIPTOR;
-//!-----------STATS-----------
-
-//-----------ADRENALINE-----------
-typedef struct {
-	
-	CAM_DESCRIPTOR cam;
-	hittable* world;
+//-----------PATH-----------
+// one sample of pixel (i, j); bounced rays start at t_min = 0 as in ray_color
+fvec3 render_sample(__global const DEVICE_NODE* nodes, __global const DEVICE_SPHERE* spheres,
+	__global const uint* sphere_materials, __global const DEVICE_MATERIAL* materials,
+	const DEVICE_CAMERA* cam, const DEVICE_RENDER_PARAMS* params, uint i, uint j, int sample, int* path_length)
+{
+	pcg32 rng;
+	pcg32_seed(&rng, mix64(params->seed ^ mix64((ulong)sample)), (ulong)j * params->width + i);
+	const float u = (i + next_float(&rng)) / (params->width - 1);
+	const float v = (j + next_float(&rng)) / (params->height - 1);
+	fvec3 o = load3(cam->origin);
+	fvec3 d = sub3(add3(add3(load3(cam->lower_left_corner), scale3(u, load3(cam->horizontal))), scale3(v, load3(cam->vertical))), o);
+	if (cam->lens_radius > 0) {
+		float x, y;
+		do {
+			x = 2 * next_float(&rng) - 1;
+			y = 2 * next_float(&rng) - 1;
+		} while (x * x + y * y >= 1);
+		const fvec3 offset = add3(scale3(cam->lens_radius * x, load3(cam->lens_u)), scale3(cam->lens_radius * y, load3(cam->lens_v)));
+		o = add3(o, offset);
+		d = sub3(d, offset);
+	}
 
-} ADRENALINE_DESCRIPTOR;
-//!-----------ADRENALINE-----------
+	fvec3 throughput = make_fvec3(1.0f, 1.0f, 1.0f);
+	*path_length = 0;
+	for (int depth = 0; depth < params->max_depth; depth++) {
+		(*path_length)++;
 
-__kernel void render(
-	__global __write_only image2d_t* buff
-	__global __read_only STATS_DESCRIPTOR* sdesc,
-	__global __read_only ADRENALINE_DESCRIPTOR* adesc,
-	) {
- 
-    // Get the index of the current element to be processed
-    int j = get_global_id(0);
-
-	// Do the operation
-	for (int i = 0; i < sdesc->image_width; i++) {
-		color pixel_color = { 0, 0, 0 };
-
-		for (int s = 0; s < sdesc->samples_per_pixel; s++) {
-			double u = (i + random_double()) / (sdesc->image_width - 1);
-			double v = (j + random_double()) / (sdesc->image_height - 1);
-			ray r = get_ray(&adesc->cam, &u, &v);
-			//set_color(&pixel_color, &ray_color(&r, &adesc->world, &sdesc->max_depth));
-			pixel_color = ray_color(r, adesc->world, sdesc->max_depth);
+		float t = 3.4e38f;
+		uint prim = 0;
+		if (!closest_hit(nodes, params->node_count, spheres, o, d, 0.0f, &t, &prim)) {
+			const float y = 0.5f * (normalize3(d).y + 1.0f);
+			return mul3(throughput, make_fvec3(1.0f - 0.5f * y, 1.0f - 0.3f * y, 1.0f));
 		}
 
-		color clr = pixel_color / sdesc->samples_per_pixel;
-
-		double r = sqrt(clr[0]);
-		double g = sqrt(clr[1]);
-		double b = sqrt(clr[2]);
-
-		clr = {
-			int(256 * clamp(r, 0.0, 0.999));
-			int(256 * clamp(g, 0.0, 0.999));
-			int(256 * clamp(b, 0.0, 0.999));
-		};
-		int2 pos = { i, j };
-		write_imagef(buff, pos, clr);
+		const fvec3 center = make_fvec3(spheres[prim].center[0], spheres[prim].center[1], spheres[prim].center[2]);
+		const fvec3 p = add3(o, scale3(t, d));
+		fvec3 normal = scale3(1.0f / spheres[prim].radius, sub3(p, center));
+		const bool front_face = dot3(d, normal) <= 0;
+		if (!front_face)
+			normal = scale3(-1.0f, normal);
+
+		__global const DEVICE_MATERIAL* mat = &materials[sphere_materials[prim]];
+		o = p;
+		if (mat->kind == MATERIAL_EMISSIVE) {
+			return mul3(throughput, make_fvec3(mat->albedo[0], mat->albedo[1], mat->albedo[2]));
+		}
+		else if (mat->kind == MATERIAL_METAL) {
+			const fvec3 unit = normalize3(d);
+			d = sub3(unit, scale3(2 * dot3(unit, normal), normal));
+			if (mat->fuzz > 0)
+				d = add3(d, scale3(mat->fuzz, random_in_unit_sphere(&rng)));
+			if (dot3(d, normal) <= 0)
+				return make_fvec3(0.0f, 0.0f, 0.0f);
+		}
+		else if (mat->kind == MATERIAL_DIELECTRIC) {
+			// offset off the surface, bounced rays start at t_min = 0 (10 * surface_offset)
+			const float offset = 1e-4f * fmax(1.0f, fmax(fabs(p.x), fmax(fabs(p.y), fabs(p.z))));
+			const float ratio = front_face ? 1.0f / mat->ior : mat->ior;
+			const fvec3 unit = normalize3(d);
+			const float cos_theta = fmin(-dot3(unit, normal), 1.0f);
+			const float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
+			float r0 = (1.0f - ratio) / (1.0f + ratio);
+			r0 = r0 * r0;
+			const float reflectance = r0 + (1.0f - r0) * pow(1.0f - cos_theta, 5.0f);
+			if (ratio * sin_theta > 1.0f || reflectance > next_float(&rng)) {
+				d = sub3(unit, scale3(2 * dot3(unit, normal), normal));
+				o = add3(p, scale3(offset, normal));
+			}
+			else {
+				const fvec3 perp = scale3(ratio, add3(unit, scale3(cos_theta, normal)));
+				d = sub3(perp, scale3(sqrt(fabs(1.0f - dot3(perp, perp))), normal));
+				o = sub3(p, scale3(offset, normal));
+			}
+		}
+		else {
+			d = add3(normal, random_unit_vector(&rng));
+			if (fabs(d.x) < 1e-8f && fabs(d.y) < 1e-8f && fabs(d.z) < 1e-8f)
+				d = normal;
+		}
+		throughput = mul3(throughput, make_fvec3(mat->albedo[0], mat->albedo[1], mat->albedo[2]));
+
+		if (params->rr_depth > 0 && depth + 1 >= params->rr_depth) {
+			float q = throughput.x > throughput.y ? throughput.x : throughput.y;
+			q = throughput.z > q ? throughput.z : q;
+			q = q < 0.95f ? q : 0.95f;
+			if (next_float(&rng) >= q)
+				return make_fvec3(0.0f, 0.0f, 0.0f);
+			throughput = scale3(1.0f / q, throughput);
+		}
+	}
+	return make_fvec3(0.0f, 0.0f, 0.0f);
+}
+//!-----------PATH-----------
+
+/*
+	One work-item per pixel over a 2D range rounded up to whole work-groups;
+	items past the image border return. out receives the sum of the pixel's
+	samples (3 floats, rows bottom first like the render buffers), segments
+	the number of rays its paths traced.
+*/
+__kernel void render(
+	__global const DEVICE_NODE* nodes,
+	__global const DEVICE_SPHERE* spheres,
+	__global const uint* sphere_materials,
+	__global const DEVICE_MATERIAL* materials,
+	const DEVICE_CAMERA cam,
+	const DEVICE_RENDER_PARAMS params,
+	__global float* out,
+	__global uint* segments)
+{
+	const uint i = (uint)get_global_id(0);
+	const uint j = (uint)get_global_id(1);
+	if (i >= params.width || j >= params.height) return;
+
+	fvec3 sum = make_fvec3(0.0f, 0.0f, 0.0f);
+	uint path_segments = 0;
+	for (int s = 0; s < params.samples_per_pixel; s++) {
+		int path_length;
+		sum = add3(sum, render_sample(nodes, spheres, sphere_materials, materials, &cam, &params, i, j, s, &path_length));
+		path_segments += path_length;
 	}
-}
\ No newline at end of file
+
+	const size_t pixel = (size_t)j * params.width + i;
+	out[3 * pixel + 0] = sum.x;
+	out[3 * pixel + 1] = sum.y;
+	out[3 * pixel + 2] = sum.z;
+	segments[pixel] = path_segments;
+}
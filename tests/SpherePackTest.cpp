@@ -0,0 +1,47 @@
+/*
+	sphere_pack::hit_range against hit_range_scalar for every sub-range of packs
+	whose size is not a multiple of the lane count, the way bvh leaves hand
+	them out: ranges start anywhere, also on the last spheres of the pack.
+	Built with AddressSanitizer where the compiler has it, so a batch load past
+	the end of the arrays fails the test even when the masked result is right.
+*/
+
+#include "SpherePack.hpp"
+#include <cstdio>
+
+using namespace raytracer;
+
+static ray random_ray() {
+	const point3 origin(random_double(-6, 6), random_double(-6, 6), random_double(-6, 6));
+	const point3 target(random_double(-2, 2), random_double(-2, 2), random_double(-2, 2));
+	return ray(origin, target - origin);
+}
+
+int main() {
+	int failures = 0;
+	const size_t counts[] = { 1, 3, 5, 7, 9, 13, 15, 16, 17, 23, 31, 33, 47 };
+	for (size_t n : counts) {
+		sphere_pack pack;
+		for (size_t i = 0; i < n; i++)
+			pack.add(point3(random_double(-3, 3), random_double(-3, 3), random_double(-3, 3)), random_double(0.2, 1.0), nullptr);
+
+		for (int k = 0; k < 64; k++) {
+			const ray r = random_ray();
+			for (size_t first = 0; first < n; first++) {
+				for (size_t count = 1; first + count <= n; count++) {
+					real closest = infinity, expected_closest = infinity;
+					size_t index = n, expected_index = n;
+					const bool hit = pack.hit_range(r, first, count, 0.001, closest, index);
+					const bool expected = pack.hit_range_scalar(r, first, count, 0.001, expected_closest, expected_index);
+					if (hit != expected || (hit && (index != expected_index || std::fabs(closest - expected_closest) > 1e-4 * (1 + expected_closest)))) {
+						if (failures++ < 10)
+							std::fprintf(stderr, "%zu spheres, range [%zu, %zu): hit %d index %zu t %g, scalar hit %d index %zu t %g\n",
+								n, first, first + count, hit, index, static_cast<double>(closest), expected, expected_index, static_cast<double>(expected_closest));
+					}
+				}
+			}
+		}
+	}
+	std::printf("sphere_pack: %zu lanes, %d mismatches\n", sphere_pack::lanes, failures);
+	return failures == 0 ? 0 : 1;
+}